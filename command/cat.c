@@ -46,6 +46,31 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    // 优先把整个文件映射进来直接输出,不必经过缓冲区一块块地read,映射失败时再退回read
+    struct stat file_stat;
+    if (stat(abs_path, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+        char *map = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            uint32_t pos = 0;
+
+            // 向标准输出一次写的不能超过内核的1024字节中转缓冲区
+            while (pos < file_stat.st_size)
+            {
+                uint32_t chunk = file_stat.st_size - pos < 512 ? file_stat.st_size - pos : 512;
+                write(1, map + pos, chunk);
+                pos += chunk;
+            }
+
+            munmap(map, file_stat.st_size);
+            free(buf);
+            close(fd);
+            return 66;
+        }
+    }
+
     int read_bytes = 0;
     while (1)
     {
@@ -0,0 +1,72 @@
+#include "../lib/user/syscall.h"
+#include "../lib/stdio.h"
+#include "../lib/string.h"
+#include "../lib/kernel/io.h"
+
+/**
+ * @brief
+ * 退出延迟测试:子进程fork出来后自己写满0、64K、1M、8M的堆空间,
+ * 在调用exit前读一次rdtsc,把低31位作为退出状态交给父进程,
+ * 父进程从wait返回后再读rdtsc,两者之差就是子进程exit释放资源到父进程被唤醒的时钟周期数。
+ * 每种大小测EXIT_ROUNDS次,输出最小值和平均值。
+ * 内核编译时加上-D EXIT_BENCH还会打印每次释放地址空间本身用的周期数
+ */
+
+#define EXIT_ROUNDS 8
+#define TSC_MASK    0x7fffffff       // 退出状态是有符号数,只传rdtsc的低31位
+
+static uint32_t bench_one(uint32_t size)
+{
+    uint32_t min_cycles = 0xffffffff;
+    uint32_t sum_cycles = 0;
+    uint32_t round      = 0;
+
+    while (round < EXIT_ROUNDS)
+    {
+        int16_t pid = fork();
+
+        if (pid == 0)
+        {
+            // 子进程自己分配并写过每一页,页框都是自己的,退出时要真正归还
+            char *buf = size == 0 ? NULL : malloc(size);
+            uint32_t off = 0;
+
+            while (buf != NULL && off < size)
+            {
+                buf[off] = 1;
+                off += 4096;
+            }
+
+            exit((int32_t)(rdtsc() & TSC_MASK));
+        }
+
+        if (pid == -1)
+        {
+            printf("exitbench: fork failed\n");
+            break;
+        }
+
+        int32_t status;
+        wait(&status);
+
+        uint32_t cycles = ((uint32_t)rdtsc() - (uint32_t)status) & TSC_MASK;
+
+        min_cycles  = cycles < min_cycles ? cycles : min_cycles;
+        sum_cycles += cycles;
+        round++;
+    }
+
+    printf("%dK: min %d cycles, avg %d cycles\n", size / 1024, min_cycles, round ? sum_cycles / round : 0);
+
+    return min_cycles;
+}
+
+int main(void)
+{
+    bench_one(0);
+    bench_one(64 * 1024);
+    bench_one(1024 * 1024);
+    bench_one(8 * 1024 * 1024);
+
+    return 0;
+}
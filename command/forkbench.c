@@ -0,0 +1,75 @@
+#include "../lib/user/syscall.h"
+#include "../lib/stdio.h"
+#include "../lib/string.h"
+#include "../lib/kernel/io.h"
+
+/**
+ * @brief
+ * fork延迟测试:分别让进程拥有64K、1M、8M的已写过的堆空间,
+ * 用rdtsc测量父进程中fork调用的时钟周期数,子进程立即退出。
+ * 每种大小测FORK_ROUNDS次,输出最小值和平均值
+ */
+
+#define FORK_ROUNDS 8
+
+static uint32_t bench_one(uint32_t size)
+{
+    char *buf = malloc(size);
+
+    if (buf == NULL)
+    {
+        printf("forkbench: malloc %d bytes failed\n", size);
+        return 0;
+    }
+
+    // 每一页都写一次,保证页框已经分配,fork时需要复制或共享
+    uint32_t off = 0;
+    while (off < size)
+    {
+        buf[off] = 1;
+        off += 4096;
+    }
+
+    uint32_t min_cycles = 0xffffffff;
+    uint32_t sum_cycles = 0;
+    uint32_t round      = 0;
+
+    while (round < FORK_ROUNDS)
+    {
+        uint64_t start  = rdtsc();
+        int16_t  pid    = fork();
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+
+        if (pid == 0)
+        {
+            exit(0);
+        }
+
+        if (pid == -1)
+        {
+            printf("forkbench: fork failed\n");
+            break;
+        }
+
+        int32_t status;
+        wait(&status);
+
+        min_cycles  = cycles < min_cycles ? cycles : min_cycles;
+        sum_cycles += cycles;
+        round++;
+    }
+
+    printf("%dK: min %d cycles, avg %d cycles\n", size / 1024, min_cycles, round ? sum_cycles / round : 0);
+    free(buf);
+
+    return min_cycles;
+}
+
+int main(void)
+{
+    bench_one(64 * 1024);
+    bench_one(1024 * 1024);
+    bench_one(8 * 1024 * 1024);
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "../lib/user/syscall.h"
+#include "../lib/stdio.h"
+#include "../lib/string.h"
+#include "../lib/kernel/io.h"
+
+/**
+ * @brief
+ * malloc延迟测试:对比用户态的malloc/free(lib/user/malloc.c)和原来每次都陷入内核的
+ * SYS_MALLOC/SYS_FREE,用rdtsc测量平均一对申请释放的时钟周期数。
+ * 1 同一大小反复申请释放,小块走空闲链表,大块走合并
+ * 2 一批不同大小的块先全部申请再倒序释放
+ * 最后检查大块全部释放后堆有没有缩回去
+ */
+
+#define BENCH_ROUNDS 2000
+#define BENCH_BATCH  32
+
+// 原来的做法,每次申请都是一次系统调用
+static void *trap_malloc(uint32_t size)
+{
+    int retval;
+    asm volatile("int $0x80" : "=a"(retval) : "a"(SYS_MALLOC), "b"(size) : "memory");
+
+    return (void *)retval;
+}
+
+// 原来的做法,每次释放都是一次系统调用
+static void trap_free(void *ptr)
+{
+    int retval;
+    asm volatile("int $0x80" : "=a"(retval) : "a"(SYS_FREE), "b"(ptr) : "memory");
+
+    return;
+}
+
+// 同一大小反复申请释放,返回平均一对的周期数
+static uint32_t bench_same(void *(*alloc)(uint32_t), void (*release)(void *), uint32_t size)
+{
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+
+    while (round < BENCH_ROUNDS)
+    {
+        void *p = alloc(size);
+
+        if (p == NULL)
+        {
+            printf("mallocbench: alloc %d bytes failed\n", size);
+            return 0;
+        }
+
+        *(char *)p = 1;
+        release(p);
+        round++;
+    }
+
+    return (uint32_t)(rdtsc() - start) / BENCH_ROUNDS;
+}
+
+// 一批16字节到8K大小不等的块,先全部申请再倒序释放,返回平均一对的周期数
+static uint32_t bench_batch(void *(*alloc)(uint32_t), void (*release)(void *))
+{
+    void *blocks[BENCH_BATCH];
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+
+    while (round < BENCH_ROUNDS / BENCH_BATCH)
+    {
+        uint32_t idx = 0;
+        while (idx < BENCH_BATCH)
+        {
+            blocks[idx] = alloc(16 << (idx % 10));
+
+            if (blocks[idx] == NULL)
+            {
+                printf("mallocbench: batch alloc failed\n");
+                return 0;
+            }
+
+            idx++;
+        }
+
+        while (idx > 0)
+        {
+            release(blocks[--idx]);
+        }
+
+        round++;
+    }
+
+    return (uint32_t)(rdtsc() - start) / (BENCH_ROUNDS / BENCH_BATCH * BENCH_BATCH);
+}
+
+int main(void)
+{
+    uint32_t sizes[] = {32, 512, 4000};
+    uint32_t idx     = 0;
+
+    while (idx < sizeof(sizes) / sizeof(sizes[0]))
+    {
+        uint32_t user = bench_same(malloc, free, sizes[idx]);
+        uint32_t trap = bench_same(trap_malloc, trap_free, sizes[idx]);
+
+        printf("%d bytes: user malloc %d cycles, syscall malloc %d cycles\n", sizes[idx], user, trap);
+        idx++;
+    }
+
+    printf("mixed batch: user malloc %d cycles, syscall malloc %d cycles\n",
+           bench_batch(malloc, free), bench_batch(trap_malloc, trap_free));
+
+    // 申请1M再释放,堆顶空闲超过阈值后应该缩回去
+    uint32_t before = (uint32_t)sbrk(0);
+    void *big       = malloc(1024 * 1024);
+    uint32_t grown  = (uint32_t)sbrk(0);
+    free(big);
+    uint32_t after  = (uint32_t)sbrk(0);
+
+    printf("heap end: %x, after 1M malloc %x, after free %x\n", before, grown, after);
+
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "../lib/user/syscall.h"
+#include "../lib/stdio.h"
+#include "../lib/string.h"
+
+/**
+ * @brief
+ * 查看任务的内存占用,以及在子进程中验证页数上限:
+ * memctl stat [pid]     打印进程pid(不给时是自己)的驻留页数、页表页数、堆字节数和上限
+ * memctl limit pages    fork一个子进程,子进程把页数上限设为pages后不停地写新页,
+ *                       超过上限时缺页处理会结束它,父进程打印它的退出状态(应为-1)
+ */
+
+#define TOUCH_REPORT 16       // 子进程每写这么多页打印一次内存占用
+
+// 把十进制数字串转换为整数,不是数字串时返回-1
+static int32_t str2num(const char *str)
+{
+    int32_t num = 0;
+
+    if (*str == 0)
+    {
+        return -1;
+    }
+
+    while (*str)
+    {
+        if (*str < '0' || *str > '9')
+        {
+            return -1;
+        }
+
+        num = num * 10 + (*str - '0');
+        str++;
+    }
+
+    return num;
+}
+
+// 打印上限,不限制时打印unlimited
+static void print_limit(const char *name, uint32_t limit)
+{
+    if (limit == MEM_UNLIMITED)
+    {
+        printf("  %s limit: unlimited\n", name);
+    }
+    else
+    {
+        printf("  %s limit: %d\n", name, limit);
+    }
+
+    return;
+}
+
+// 打印进程pid的内存占用,成功返回0
+static int32_t mem_show(int32_t pid)
+{
+    struct mem_usage usage;
+
+    if (memstat(pid, &usage) == -1)
+    {
+        printf("memctl: no process %d\n", pid);
+        return -1;
+    }
+
+    printf("pid %d: rss %d pages (peak %d), page tables %d pages, heap %d bytes, limit hits %d\n",
+           pid == 0 ? getpid() : pid, usage.rss, usage.rss_peak, usage.pt_pages, usage.heap_bytes, usage.limit_hits);
+    print_limit("pages", usage.limit[MEM_RES_PAGES]);
+    print_limit("heap bytes", usage.limit[MEM_RES_HEAP]);
+
+    return 0;
+}
+
+// 子进程:设置页数上限后一页一页地写新内存,直到被缺页处理结束
+static void limit_child(uint32_t pages)
+{
+    if (memlimit(MEM_RES_PAGES, pages) == -1)
+    {
+        printf("memctl: memlimit failed\n");
+        exit(-2);
+    }
+
+    mem_show(0);
+
+    uint32_t touched = 0;
+    while (1)
+    {
+        char *page = malloc(4096);
+
+        if (page == NULL)
+        {
+            printf("memctl: malloc failed after %d pages\n", touched);
+            exit(-3);
+        }
+
+        page[4095] = 1;       // 第一次写才分配页框,超过上限时在这里被结束
+        touched++;
+
+        if (touched % TOUCH_REPORT == 0)
+        {
+            printf("touched %d pages\n", touched);
+            mem_show(0);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && !strcmp(argv[1], "stat") && argc <= 3)
+    {
+        int32_t pid = argc == 3 ? str2num(argv[2]) : 0;
+
+        if (pid < 0)
+        {
+            printf("memctl: bad pid %s\n", argv[2]);
+            return -1;
+        }
+
+        return mem_show(pid);
+    }
+
+    if (argc == 3 && !strcmp(argv[1], "limit"))
+    {
+        int32_t pages = str2num(argv[2]);
+
+        if (pages <= 0)
+        {
+            printf("memctl: bad page count %s\n", argv[2]);
+            return -1;
+        }
+
+        int32_t pid = fork();
+
+        if (pid == -1)
+        {
+            printf("memctl: fork failed\n");
+            return -1;
+        }
+
+        if (pid == 0)
+        {
+            limit_child(pages);
+        }
+
+        int32_t status;
+        wait(&status);
+
+        // 被缺页处理结束的进程退出状态是-1
+        printf("memctl: child %d exited with status %d, %s\n", pid, status,
+               status == -1 ? "killed at the page limit" : "unexpected");
+
+        return status == -1 ? 0 : -1;
+    }
+
+    printf("usage: memctl stat [pid]\n       memctl limit pages\n");
+
+    return -1;
+}
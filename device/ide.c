@@ -469,7 +469,7 @@ void intr_hd_handler(uint8_t irq_no)
 void ide_init(void)
 {
     printk("ide_init start\n");
-    uint8_t hd_cnt = *((uint8_t *)(0x475));        // 获取硬盘的数量
+    uint8_t hd_cnt = *((uint8_t *)(0xc0000475));        // 获取硬盘的数量,低端1M只映射在0xc0000000以上
 
     ASSERT(hd_cnt > 0);
     list_init(&partition_list);
@@ -9,10 +9,21 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
 #include "../kernel/interrupt.h"
 
 
 struct dir root_dir;        // 根目录
+struct kmem_cache *dir_cache;   // 打开的目录都从此cache分配
+
+// 创建dir的对象cache
+void dir_cache_init(void)
+{
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), NULL);
+    ASSERT(dir_cache != NULL);
+
+    return;
+}
 
 // 打开分区part根目录
 void open_root_dir(struct partition *part)
@@ -26,7 +37,7 @@ void open_root_dir(struct partition *part)
 // 在分区part上打开i结点为inode_no的目录并返回目录指针
 struct dir *dir_open(struct partition *part, uint32_t inode_no)
 {
-    struct dir *pdir = (struct dir *)sys_malloc(sizeof(struct dir));
+    struct dir *pdir = (struct dir *)kmem_cache_alloc(dir_cache);
 
     pdir->inode      = inode_open(part, inode_no);
     pdir->dir_pos    = 0;
@@ -121,7 +132,7 @@ void dir_close(struct dir *dir)
     /**
      * @brief 根目录不能关闭
      * 1 根目录自打开后就不应该关闭,否则还需要再次open_root_dir();
-     * 2 root_dir所在的内存是低端1M之内,并非在堆中,free会出问题
+     * 2 root_dir所在的内存是低端1M之内,并非从dir_cache分配,free会出问题
      * 
      */
 
@@ -131,7 +142,7 @@ void dir_close(struct dir *dir)
     }
 
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(dir_cache, dir);
 
     return;
 }
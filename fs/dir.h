@@ -26,7 +26,10 @@ struct dir_entry
 };
 
 extern struct dir root_dir;            // 根目录
+extern struct kmem_cache *dir_cache;   // 打开的目录都从此cache分配
 
+// 创建dir的对象cache
+void dir_cache_init(void);
 
 // 打开分区part根目录
 void open_root_dir(struct partition *part);
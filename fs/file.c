@@ -2,13 +2,16 @@
 #include "fs.h"
 #include "super-block.h"
 #include "inode.h"
+#include "page-cache.h"
 #include "../thread/thread.h"
 #include "../lib/string.h"
 #include "../lib/kernel/stdio-kernel.h"
 #include "../kernel/global.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
 #include "../kernel/debug.h"
 #include "../kernel/interrupt.h"
+#include "../kernel/fault.h"
 
 #define DEFAULT_SECS 1
 
@@ -156,13 +159,13 @@ int32_t file_create(struct dir *parent_dir, char *filename, uint8_t flag)
         return -1;
     }
 
-    // 此inode要从堆中申请内存,不可生成局部变量(函数退出时会释放)
+    // 此inode要从inode_cache申请内存,不可生成局部变量(函数退出时会释放)
     // 因为file_table数组中的文件描述符的inode指针要指向它.
-    struct inode *new_file_inode = (struct inode *)sys_malloc(sizeof(struct inode));
+    struct inode *new_file_inode = (struct inode *)kmem_cache_alloc(inode_cache);
 
     if (new_file_inode == NULL)
     {
-        printk("file_create: sys_malloc for inode failded\n");
+        printk("file_create: kmem_cache_alloc for inode failded\n");
         rollback_step = 1;
         goto rollback;
     }
@@ -227,7 +230,7 @@ rollback:
         memset(&file_table[fd_idx], 0, sizeof(struct file));
 
     case 2:
-        sys_free(new_file_inode);
+        kmem_cache_free(inode_cache, new_file_inode);
 
     // 如果新文件的i结点创建失败,之前位图中分配的inode_no也要恢复
     case 1:
@@ -330,12 +333,9 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
     uint32_t size_left        = count;   // 用来记录未写入数据大小
     int32_t  block_lba        = -1;      // 块地址
     uint32_t block_bitmap_idx = 0;       // 用来记录block对应于block_bitmap中的索引,做为参数传给bitmap_sync
+    bool     bad_buf          = false;   // buf的地址非法时置为true
 
-    uint32_t sec_idx;                    // 用来索引扇区
-    uint32_t sec_lba;                    // 扇区地址
-    uint32_t sec_off_bytes;              // 扇区内字节偏移量
-    uint32_t sec_left_bytes;             // 扇区内剩余字节量
-    uint32_t chunk_size;                 // 每次写入硬盘的数据块大小
+    uint32_t chunk_size;                 // 每次写入页缓存的数据块大小
     int32_t  indirect_block_table;       // 用来获取一级间接表地址
     uint32_t block_idx;                  // 块索引
 
@@ -533,33 +533,37 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
 
     } // end if
 
-    bool first_write_block = true;     // 含有剩余空间的扇区标识
-
-    // 块地址已经收集到all_blocks中,下面开始写数据
+    // 块地址已经分配好并记录在inode中,下面把数据写到页缓存并标记为脏页,文件关闭时才写回硬盘
     // 置fd_pos为文件大小-1,下面在写数据时随时更新
     file->fd_pos = file->fd_inode->i_size - 1;
 
+    uint32_t pg_off_bytes, pg_left_bytes;
+
     while (bytes_written < count)     // 直到写完所有数据
     {
-        memset(io_buf, 0, BLOCK_SIZE);
+        struct cache_page *cp = page_cache_get(file->fd_inode, file->fd_inode->i_size / PG_SIZE);
+        if (cp == NULL)
+        {
+            printk("file_write: page_cache_get failed\n");
+            break;
+        }
 
-        sec_idx        = file->fd_inode->i_size / BLOCK_SIZE;
-        sec_lba        = all_blocks[sec_idx];
-        sec_off_bytes  = file->fd_inode->i_size % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
+        pg_off_bytes  = file->fd_inode->i_size % PG_SIZE;
+        pg_left_bytes = PG_SIZE - pg_off_bytes;
 
-        // 判断此次写入硬盘的数据大小
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
+        // 判断此次写入的数据大小
+        chunk_size = size_left < pg_left_bytes ? size_left : pg_left_bytes;
 
-        if (first_write_block)
+        // src是用户的缓冲区,地址非法时停止写入,已经写入的部分保留
+        if (copy_from_user((uint8_t *)cp->kaddr + pg_off_bytes, src, chunk_size) != 0)
         {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-            first_write_block = false;
+            page_cache_put(cp);
+            bad_buf = true;
+            break;
         }
 
-        memcpy(io_buf + sec_off_bytes, src, chunk_size);
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-        printk("file write at lba 0x%x\n", sec_lba);     //调试,完成后去掉
+        page_cache_mark_dirty(cp, file->fd_inode);
+        page_cache_put(cp);
 
         src           += chunk_size;                     // 将指针推移到下个新数据
         file->fd_inode->i_size += chunk_size;            // 更新文件大小
@@ -572,7 +576,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
     sys_free(all_blocks);
     sys_free(io_buf);
 
-    return bytes_written;
+    return bad_buf && bytes_written == 0 ? -1 : (int32_t)bytes_written;
 }
 
 // 从文件file中读取count个字节写入buf, 返回读出的字节数,若到文件尾则返回-1
@@ -593,130 +597,92 @@ int32_t file_read(struct file *file, void *buf, uint32_t count)
         }
     }
 
-    uint8_t *io_buf = sys_malloc(BLOCK_SIZE);
-    if (io_buf == NULL)
-    {
-        printk("file_read: sys_malloc for io_buf failed\n");
-    }
-
-    // 用来记录文件所有的块地址
-    uint32_t *all_blocks = (uint32_t *)sys_malloc(BLOCK_SIZE + 48);
-    if (all_blocks == NULL)
-    {
-        printk("file_read: sys_malloc for all_blocks failed\n");
-        return -1;
-    }
-
-    // 数据所在块的起始地址
-    uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE;
-
-    // 数据所在块的终止地址
-    uint32_t block_read_end_idx   = (file->fd_pos + size) / BLOCK_SIZE;
-
-    // 如增量为0,表示数据在同一扇区
-    uint32_t read_blocks = block_read_start_idx - block_read_end_idx;
-    ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-
-    int32_t indirect_block_table;     // 用来获取一级间接表地址
-    uint32_t block_idx;               // 获取待读的块地址
+    // 按页从页缓存中复制,不在缓存中的页由page_cache_get从硬盘读入
+    uint32_t pg_off_bytes, pg_left_bytes, chunk_size;
+    uint32_t bytes_read = 0;
 
-    // 以下开始构建all_blocks块地址数组,专门存储用到的块地址(本程序中块大小同扇区大小)
-    // 在同一扇区内读数据,不涉及到跨扇区读取
-    if (read_blocks == 0)             
+    while (bytes_read < size) // 直到读完为止
     {
-        ASSERT(block_read_end_idx == block_read_start_idx);
-
-        if (block_read_end_idx < 12)  // 待读的数据在12个直接块之内
+        struct cache_page *cp = page_cache_get(file->fd_inode, file->fd_pos / PG_SIZE);
+        if (cp == NULL)
         {
-            block_idx = block_read_end_idx;
-            all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
+            printk("file_read: page_cache_get failed\n");
+            break;
         }
-        else
-        {
 
-            indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-        }
-    }
-    else
-    { // 若要读多个块
+        pg_off_bytes  = file->fd_pos % PG_SIZE;
+        pg_left_bytes = PG_SIZE - pg_off_bytes;
 
-        // 第一种情况: 起始块和终止块属于直接块
-        // 数据结束所在的块属于直接块
-        if (block_read_end_idx < 12)       
-        {
-            block_idx = block_read_start_idx;
+        // 待读入的数据大小
+        chunk_size    = size_left < pg_left_bytes ? size_left : pg_left_bytes;
 
-            while (block_idx <= block_read_end_idx)
-            {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-        }
-        else if (block_read_start_idx < 12 && block_read_end_idx >= 12)
+        // buf可能是还没有映射的用户页,复制时会缺页,所以页要钉住到复制完,地址非法时停止读取
+        if (copy_to_user(buf_dst, (uint8_t *)cp->kaddr + pg_off_bytes, chunk_size) != 0)
         {
-
-            // 第二种情况: 待读入的数据跨越直接块和间接块两类
-            // 先将直接块地址写入all_blocks
-            block_idx = block_read_start_idx;
-
-            while (block_idx < 12)
-            {
-                all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-                block_idx++;
-            }
-
-            // 确保已经分配了一级间接块表
-            ASSERT(file->fd_inode->i_sectors[12] != 0);
-
-            // 再将间接块地址写入all_blocks
-            indirect_block_table = file->fd_inode->i_sectors[12];
-
-            // 将一级间接块表读进来写入到第13个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            page_cache_put(cp);
+            break;
         }
-        else
-        {
 
-            // 第三种情况: 数据在间接块中
-            ASSERT(file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
+        page_cache_put(cp);
 
-            // 获取一级间接表地址
-            indirect_block_table = file->fd_inode->i_sectors[12];
+        buf_dst      += chunk_size;
+        file->fd_pos += chunk_size;
+        bytes_read   += chunk_size;
+        size_left    -= chunk_size;
+    }
 
-            // 将一级间接块表读进来写入到第13个块的位置之后
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+    return bytes_read == 0 ? -1 : (int32_t)bytes_read;
+}
 
-        } // end if
+// 把buf中的count个字节写到文件inode的pos处,只覆盖文件已有的内容,不分配新块也不改变文件大小,返回写入的字节数,失败返回-1
+int32_t file_overwrite(struct inode *inode, uint32_t pos, const void *buf, uint32_t count)
+{
+    const uint8_t *src = (const uint8_t *)buf;
 
-    } // end if
+    // 超出文件大小的部分丢弃
+    if (pos >= inode->i_size)
+    {
+        return 0;
+    }
 
-    // 用到的块地址已经收集到all_blocks中,下面开始读数据
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-    uint32_t bytes_read = 0;
+    if (pos + count > inode->i_size)
+    {
+        count = inode->i_size - pos;
+    }
 
-    while (bytes_read < size) // 直到读完为止
+    uint32_t pg_off_bytes, pg_left_bytes, chunk_size;
+    uint32_t bytes_written = 0;
+
+    while (bytes_written < count)
     {
-        sec_idx        = file->fd_pos / BLOCK_SIZE;
-        sec_lba        = all_blocks[sec_idx];
-        sec_off_bytes  = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
+        struct cache_page *cp = page_cache_get(inode, pos / PG_SIZE);
+        if (cp == NULL)
+        {
+            printk("file_overwrite: page_cache_get failed\n");
+            return -1;
+        }
 
-        // 待读入的数据大小
-        chunk_size     = size_left < sec_left_bytes ? size_left : sec_left_bytes;
+        pg_off_bytes  = pos % PG_SIZE;
+        pg_left_bytes = PG_SIZE - pg_off_bytes;
+        chunk_size    = count - bytes_written < pg_left_bytes ? count - bytes_written : pg_left_bytes;
+
+        // 共享映射的页就是页缓存的页框,这时src和目的地址指向同一个页框,复制一遍也没有关系
+        if (copy_from_user((uint8_t *)cp->kaddr + pg_off_bytes, src, chunk_size) != 0)
+        {
+            page_cache_put(cp);
+            return -1;
+        }
 
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+        page_cache_mark_dirty(cp, inode);
+        page_cache_put(cp);
 
-        buf_dst      += chunk_size;
-        file->fd_pos += chunk_size;
-        bytes_read   += chunk_size;
-        size_left    -= chunk_size;
+        src           += chunk_size;
+        pos           += chunk_size;
+        bytes_written += chunk_size;
     }
 
-    sys_free(all_blocks);
-    sys_free(io_buf);
+    // msync要求写到硬盘上
+    page_cache_sync_inode(inode);
 
-    return bytes_read;
+    return bytes_written;
 }
@@ -64,4 +64,7 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count);
 // 读文件
 int32_t file_read(struct file *file, void *buf, uint32_t count);
 
+// 把buf中的count个字节写到文件inode的pos处,只覆盖文件已有的内容,不改变文件大小,返回写入的字节数,失败返回-1
+int32_t file_overwrite(struct inode *inode, uint32_t pos, const void *buf, uint32_t count);
+
 #endif // __FS_FILE_H
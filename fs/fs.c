@@ -4,6 +4,7 @@
 #include "dir.h"
 #include "stdint.h"
 #include "file.h"
+#include "page-cache.h"
 #include "../device/ide.h"
 #include "../device/console.h"
 #include "../device/keyboard.h"
@@ -11,6 +12,8 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/swap.h"
+#include "../kernel/fault.h"
 #include "../lib/string.h"
 #include "../lib/kernel/stdio-kernel.h"
 #include "../lib/kernel/list.h"
@@ -385,8 +388,33 @@ static int search_file(const char *pathname, struct path_search_record *searched
     return dir_e.i_no;
 }
 
-// 打开或创建文件成功后,返回文件描述符,否则返回-1
-int32_t sys_open(const char *pathname, uint8_t flags)
+/**
+ * @brief
+ * 系统调用中的路径都来自用户进程,先复制到内核分配的缓冲区中再使用,地址非法时系统调用返回失败,
+ * 不会在查找路径的途中因缺页而出错。内核自己调用时传入的路径也一样复制,复制不会失败
+ */
+
+// 把路径pathname复制到新分配的缓冲区中,地址非法、路径为空或太长时返回NULL,用完要sys_free
+static char *path_from_user(const char *pathname)
+{
+    char *path = sys_malloc(MAX_PATH_LEN);
+
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    if (strncpy_from_user(path, pathname, MAX_PATH_LEN) <= 0)
+    {
+        sys_free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+// 打开或创建文件pathname,pathname已在内核缓冲区中,成功后返回文件描述符,否则返回-1
+static int32_t open_path(const char *pathname, uint8_t flags)
 {
     // 对目录要用dir_open,这里只有open文件
     if (pathname[strlen(pathname) - 1] == '/')
@@ -469,6 +497,22 @@ int32_t sys_open(const char *pathname, uint8_t flags)
     return fd;
 }
 
+// 打开或创建文件成功后,返回文件描述符,否则返回-1
+int32_t sys_open(const char *pathname, uint8_t flags)
+{
+    char *path = path_from_user(pathname);
+
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    int32_t fd = open_path(path, flags);
+    sys_free(path);
+
+    return fd;
+}
+
 // 将文件描述符转化为文件表的下标
 uint32_t fd_local2global(uint32_t local_fd)
 {
@@ -492,11 +536,7 @@ int32_t sys_close(int32_t fd)
         if (is_pipe(fd))
         {
             // 如果此管道上的描述符都被关闭,释放管道的环形缓冲区
-            if (--file_table[global_fd].fd_pos == 0)
-            {
-                mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-                file_table[global_fd].fd_inode = NULL;
-            }
+            pipe_release(global_fd);
 
             ret = 0;
         }
@@ -523,7 +563,18 @@ int32_t sys_write(int32_t fd, const void *buf, uint32_t count)
     if (fd == stdout_no)
     {
         char tmp_buf[1024] = {0};
-        memcpy(tmp_buf, buf, count);
+
+        // 留一个字节给结束符,多出的部分不输出
+        if (count > sizeof(tmp_buf) - 1)
+        {
+            count = sizeof(tmp_buf) - 1;
+        }
+
+        if (copy_from_user(tmp_buf, buf, count) != 0)
+        {
+            return -1;
+        }
+
         console_put_str(tmp_buf);
         return count;
     }
@@ -562,7 +613,13 @@ int32_t sys_read(int32_t fd, void *buf, uint32_t count)
 
         while (bytes_read < count)
         {
-            *buffer = ioq_getchar(&kbd_buf);
+            char c = ioq_getchar(&kbd_buf);
+
+            if (copy_to_user(buffer, &c, 1) != 0)
+            {
+                break;
+            }
+
             bytes_read++;
             buffer++;
         }
@@ -627,8 +684,8 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence)
     return pf->fd_pos;
 }
 
-// 删除文件(非目录),成功返回0,失败返回
-int32_t sys_unlink(const char *pathname)
+// 删除文件(非目录)pathname,pathname已在内核缓冲区中,成功返回0,失败返回-1
+static int32_t unlink_path(const char *pathname)
 {
     ASSERT(strlen(pathname) < MAX_PATH_LEN);
 
@@ -655,29 +712,25 @@ int32_t sys_unlink(const char *pathname)
         return -1;
     }
 
-    // 检查是否在已打开文件列表(文件表)中
-    uint32_t file_idx = 0;
+    // 检查inode是否还打开着。文件关闭后,exec和mmap的区域通过vma->file仍打开着inode,
+    // 缺页时还要从它读入,所以不能只查文件表,要查已打开inode链表
+    struct list_elem *elem = cur_part->open_inodes.head.next;
 
-    while (file_idx < MAX_FILE_OPEN)
+    while (elem != &cur_part->open_inodes.tail)
     {
-        if (file_table[file_idx].fd_inode != NULL && (uint32_t)inode_no == file_table[file_idx].fd_inode->i_no)
-        {
-            break;
-        }
+        struct inode *inode = elem2entry(struct inode, inode_tag, elem);
 
-        file_idx++;
-    }
+        if (inode->i_no == (uint32_t)inode_no && inode->i_open_cnts > 0)
+        {
+            dir_close(searched_record.parent_dir);
+            printk("file %s is in use, not allow to delete!\n", pathname);
 
-    if (file_idx < MAX_FILE_OPEN)
-    {
-        dir_close(searched_record.parent_dir);
-        printk("file %s is in use, not allow to delete!\n", pathname);
+            return -1;
+        }
 
-        return -1;
+        elem = elem->next;
     }
 
-    ASSERT(file_idx == MAX_FILE_OPEN);
-
     // 为delete_dir_entry申请缓冲区
     void *io_buf = sys_malloc(SECTOR_SIZE + SECTOR_SIZE);
     if (io_buf == NULL)
@@ -698,8 +751,24 @@ int32_t sys_unlink(const char *pathname)
     return 0; // 成功删除文件
 }
 
-// 创建目录pathname,成功返回0,失败返回-1
-int32_t sys_mkdir(const char *pathname)
+// 删除文件(非目录),成功返回0,失败返回-1
+int32_t sys_unlink(const char *pathname)
+{
+    char *path = path_from_user(pathname);
+
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    int32_t ret = unlink_path(path);
+    sys_free(path);
+
+    return ret;
+}
+
+// 创建目录pathname,pathname已在内核缓冲区中,成功返回0,失败返回-1
+static int32_t mkdir_path(const char *pathname)
 {
     // 用于操作失败时回滚各资源状态
     uint8_t rollback_step = 0;
@@ -845,8 +914,24 @@ rollback:     // 因为某步骤操作失败而回滚
     return -1;
 }
 
-// 目录打开成功后返回目录指针,失败返回NULL
-struct dir *sys_opendir(const char *name)
+// 创建目录pathname,成功返回0,失败返回-1
+int32_t sys_mkdir(const char *pathname)
+{
+    char *path = path_from_user(pathname);
+
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    int32_t ret = mkdir_path(path);
+    sys_free(path);
+
+    return ret;
+}
+
+// 打开目录name,name已在内核缓冲区中,成功后返回目录指针,失败返回NULL
+static struct dir *opendir_path(const char *name)
 {
     ASSERT(strlen(name) < MAX_PATH_LEN);
 
@@ -886,6 +971,22 @@ struct dir *sys_opendir(const char *name)
     return ret;
 }
 
+// 目录打开成功后返回目录指针,失败返回NULL
+struct dir *sys_opendir(const char *name)
+{
+    char *path = path_from_user(name);
+
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    struct dir *dir = opendir_path(path);
+    sys_free(path);
+
+    return dir;
+}
+
 // 成功关闭目录dir返回0,失败返回-1
 int32_t sys_closedir(struct dir *dir)
 {
@@ -914,8 +1015,8 @@ void sys_rewinddir(struct dir *dir)
     return;
 }
 
-// 删除空目录,成功时返回0,失败时返回-1
-int32_t sys_rmdir(const char *pathname)
+// 删除空目录pathname,pathname已在内核缓冲区中,成功时返回0,失败时返回-1
+static int32_t rmdir_path(const char *pathname)
 {
     // 先检查待删除的文件是否存在
     struct path_search_record searched_record;
@@ -964,6 +1065,22 @@ int32_t sys_rmdir(const char *pathname)
     return retval;
 }
 
+// 删除空目录,成功时返回0,失败时返回-1
+int32_t sys_rmdir(const char *pathname)
+{
+    char *path = path_from_user(pathname);
+
+    if (path == NULL)
+    {
+        return -1;
+    }
+
+    int32_t ret = rmdir_path(path);
+    sys_free(path);
+
+    return ret;
+}
+
 // 获得父目录的inode编号
 static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void *io_buf)
 {
@@ -1078,6 +1195,17 @@ char *sys_getcwd(char *buf, uint32_t size)
         return NULL;
     }
 
+    // 路径先拼在内核缓冲区cwd中,最后再复制到用户的buf
+    char *cwd = sys_malloc(MAX_PATH_LEN);
+
+    if (cwd == NULL)
+    {
+        sys_free(io_buf);
+        return NULL;
+    }
+
+    memset(cwd, 0, MAX_PATH_LEN);
+
     struct task_struct *cur_thread = running_thread();
     int32_t parent_inode_nr = 0;
     int32_t child_inode_nr  = cur_thread->cwd_inode_nr;
@@ -1085,17 +1213,12 @@ char *sys_getcwd(char *buf, uint32_t size)
     // 最大支持4096个inode
     ASSERT(child_inode_nr >= 0 && child_inode_nr < 4096);
 
-    // 若当前目录是根目录,直接返回'/'
+    // 若当前目录是根目录,路径就是'/'
     if (child_inode_nr == 0)
     {
-        buf[0] = '/';
-        buf[1] = 0;
-
-        return buf;
+        cwd[0] = '/';
     }
 
-    memset(buf, 0, size);
-
     // 用来做全路径缓冲区
     char full_path_reverse[MAX_PATH_LEN] = {0};
 
@@ -1114,6 +1237,7 @@ char *sys_getcwd(char *buf, uint32_t size)
         // 或未找到名字,失败退出
         if (get_child_dir_name(parent_inode_nr, child_inode_nr, full_path_reverse, io_buf) == -1)
         {
+            sys_free(cwd);
             sys_free(io_buf);
             return NULL;
         }
@@ -1121,8 +1245,6 @@ char *sys_getcwd(char *buf, uint32_t size)
         child_inode_nr = parent_inode_nr;
     }
 
-    ASSERT(strlen(full_path_reverse) <= size);
-
     /**
      * @brief Construct a new while object
      * 至此full_path_reverse中的路径是反着的,即子目录在前(左),父目录在后(右) ,
@@ -1133,8 +1255,8 @@ char *sys_getcwd(char *buf, uint32_t size)
     char *last_slash;     // 用于记录字符串中最后一个斜杠地址
     while ((last_slash = strrchr(full_path_reverse, '/')))
     {
-        uint16_t len = strlen(buf);
-        strcpy(buf + len, last_slash);
+        uint16_t len = strlen(cwd);
+        strcpy(cwd + len, last_slash);
 
         // 在full_path_reverse中添加结束字符,做为下一次执行strcpy中last_slash的边界
         *last_slash = 0;
@@ -1142,11 +1264,21 @@ char *sys_getcwd(char *buf, uint32_t size)
 
     sys_free(io_buf);
 
+    // buf放不下路径或地址非法时失败
+    uint32_t cwd_len = strlen(cwd);
+
+    if (cwd_len >= size || copy_to_user(buf, cwd, cwd_len + 1) != 0)
+    {
+        buf = NULL;
+    }
+
+    sys_free(cwd);
+
     return buf;
 }
 
-// 更改当前工作目录为绝对路径path,成功则返回0,失败返回-1
-int32_t sys_chdir(const char *path)
+// 更改当前工作目录为绝对路径path,path已在内核缓冲区中,成功则返回0,失败返回-1
+static int32_t chdir_path(const char *path)
 {
     int32_t ret = -1;
     struct path_search_record searched_record;
@@ -1173,8 +1305,24 @@ int32_t sys_chdir(const char *path)
     return ret;
 }
 
-// 在buf中填充文件结构相关信息,成功时返回0,失败返回-1
-int32_t sys_stat(const char *path, struct stat *buf)
+// 更改当前工作目录为绝对路径path,成功则返回0,失败返回-1
+int32_t sys_chdir(const char *path)
+{
+    char *kpath = path_from_user(path);
+
+    if (kpath == NULL)
+    {
+        return -1;
+    }
+
+    int32_t ret = chdir_path(kpath);
+    sys_free(kpath);
+
+    return ret;
+}
+
+// 在内核缓冲区buf中填充文件path的信息,path已在内核缓冲区中,成功时返回0,失败返回-1
+static int32_t stat_path(const char *path, struct stat *buf)
 {
     // 若直接查看根目录'/'
     if (!strcmp(path, "/") || !strcmp(path, "/.") || !strcmp(path, "/.."))
@@ -1213,6 +1361,28 @@ int32_t sys_stat(const char *path, struct stat *buf)
     return ret;
 }
 
+// 在buf中填充文件结构相关信息,成功时返回0,失败返回-1
+int32_t sys_stat(const char *path, struct stat *buf)
+{
+    char *kpath = path_from_user(path);
+
+    if (kpath == NULL)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    int32_t ret = stat_path(kpath, &st);
+    sys_free(kpath);
+
+    if (ret == 0 && copy_to_user(buf, &st, sizeof(struct stat)) != 0)
+    {
+        ret = -1;
+    }
+
+    return ret;
+}
+
 // 向屏幕输出一个字符
 void sys_putchar(char char_asci)
 {
@@ -1232,6 +1402,8 @@ buildin commands:\n\
     rm:    remove a regular file\n\
     pwd:   show current work directory\n\
     ps:    show process information\n\
+    meminfo: show memory pool and slab usage\n\
+    kmprof: show top kernel heap users and fragmentation\n\
     clear: clear screen\n \
 \n\n\
 shortcut key:\n\
@@ -1289,7 +1461,12 @@ void filesys_init(void)
                  * 
                  */
 
-                if (part->sec_cnt != 0)     // 如果分区存在
+                // 交换分区由kernel/swap.c按页直接读写,不建文件系统
+                if (part->sec_cnt != 0 && !strcmp(part->name, SWAP_PART_NAME))
+                {
+                    printk("%s is reserved for swap\n", part->name);
+                }
+                else if (part->sec_cnt != 0)     // 如果分区存在
                 {
                     memset(sb_buf, 0, SECTOR_SIZE);
 
@@ -1330,6 +1507,12 @@ void filesys_init(void)
     // 挂载分区
     list_traversal(&partition_list, mount_partition, (int)default_part);
 
+    // 创建页缓存和inode、目录、管道缓冲区的对象cache,打开根目录前必须完成
+    page_cache_init();
+    inode_cache_init();
+    dir_cache_init();
+    pipe_init();
+
     // 将当前分区的根目录打开
     open_root_dir(cur_part);
 
@@ -2,14 +2,27 @@
 #include "fs.h"
 #include "file.h"
 #include "super-block.h"
+#include "page-cache.h"
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
 #include "../kernel/interrupt.h"
 #include "../lib/string.h"
 #include "../lib/kernel/list.h"
 #include "../lib/kernel/stdio-kernel.h"
 
+struct kmem_cache *inode_cache;    // 内存中的inode都从此cache分配
+
+// 创建inode的对象cache
+void inode_cache_init(void)
+{
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), NULL);
+    ASSERT(inode_cache != NULL);
+
+    return;
+}
+
 // 用来存储inode位置,
 struct inode_position
 {
@@ -124,18 +137,8 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
     // inode位置信息会存入inode_pos, 包括inode所在扇区地址和扇区内的字节偏移量
     inode_locate(part, inode_no, &inode_pos);
 
-    // 为使通过sys_malloc创建的新inode被所有任务共享,需要将inode置于内核空间,故需要临时
-    // 将cur_pbc->pgdir置为NULL
-    struct task_struct *cur   = running_thread();
-    uint32_t *cur_pagedir_bak = cur->pgdir;
-    cur->pgdir = NULL;
-
-    // 完成后下面分配的内存将位于内核区
-
-    inode_found = (struct inode *)sys_malloc(sizeof(struct inode));
-
-    // 恢复pgdir
-    cur->pgdir  = cur_pagedir_bak;
+    // inode要被所有任务共享,inode_cache的slab都在内核空间
+    inode_found = (struct inode *)kmem_cache_alloc(inode_cache);
 
     char *inode_buf;
 
@@ -168,26 +171,21 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
 // 关闭inode或减少inode的打开数
 void inode_close(struct inode *inode)
 {
+    // 最后一次关闭前先把页缓存中的脏页写回,写硬盘会阻塞,不能在关中断之后做
+    if (inode->i_open_cnts == 1)
+    {
+        page_cache_sync_inode(inode);
+    }
+
     // 若没有进程再打开此文件,将此inode去掉并释放空间
     enum intr_status old_status = intr_disable();
 
     if (--inode->i_open_cnts == 0)
     {
-        /**
-         * @brief 
-         * inode_open时为实现inode被所有进程共享,
-         * 已经在sys_malloc为inode分配了内核空间,
-         * 释放inode时也要确保释放的是内核内存池
-         */
-
         list_remove(&inode->inode_tag);          // 将I结点从part->open_inodes中去掉
 
-        struct task_struct *cur   = running_thread();
-        uint32_t *cur_pagedir_bak = cur->pgdir;
-
-        cur->pgdir = NULL;
-        sys_free(inode);
-        cur->pgdir = cur_pagedir_bak;
+        // inode是从内核空间的inode_cache分配的,归还cache即可
+        kmem_cache_free(inode_cache, inode);
     }
 
     intr_set_status(old_status);
@@ -247,6 +245,9 @@ void inode_release(struct partition *part, uint32_t inode_no)
      * 4. 一级间接索引表本身的扇区地址
      */
 
+    // 文件的内容不再需要了,页缓存中的页直接丢弃
+    page_cache_drop_inode(inode_no);
+
     struct inode *inode_to_del = inode_open(part, inode_no);
 
     ASSERT(inode_to_del->i_no == inode_no);
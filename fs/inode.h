@@ -20,6 +20,11 @@ struct inode
     struct list_elem inode_tag;
 };
 
+extern struct kmem_cache *inode_cache;  // 内存中的inode都从此cache分配
+
+// 创建inode的对象cache
+void inode_cache_init(void);
+
 // 根据i结点号返回相应的i结点
 struct inode *inode_open(struct partition *part, uint32_t inode_no);
 
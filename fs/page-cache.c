@@ -0,0 +1,429 @@
+#include "page-cache.h"
+#include "fs.h"
+#include "inode.h"
+#include "super-block.h"
+#include "../device/ide.h"
+#include "../thread/sync.h"
+#include "../kernel/memory.h"
+#include "../kernel/slab.h"
+#include "../kernel/debug.h"
+#include "../lib/string.h"
+#include "../lib/kernel/stdio-kernel.h"
+
+/**
+ * @brief
+ * 文件内容的页缓存
+ *
+ * 原来file_read和file_write每次都直接一个扇区一个扇区地读写硬盘,同一个文件读多少遍就要读多少遍硬盘。
+ * 现在普通文件的内容都按4K一页缓存在内核页中,以(inode编号, 文件中的页号)为键放在哈希表里:
+ *   read: 从缓存页复制,不在缓存中时才读硬盘,一页的扇区连续时合成一次ide_read
+ *   write: 写到缓存页并标记为脏页,文件最后一次关闭或者页被淘汰时才写回硬盘
+ *   exec和mmap: 缺页时把缓存页的页框直接映射给进程,不再复制一份(见kernel/vma.c)
+ *
+ * 缓存的页数超过PCACHE_MAX_PAGES后,按lru淘汰最久没用过的页。
+ * 被钉住的页和被进程映射着的页(页框的引用计数大于1)不淘汰。
+ * 目录的内容仍由dir.c直接读写硬盘,不经过页缓存
+ */
+
+static struct list        page_hash[PCACHE_HASH_SIZE];  // 哈希桶
+static struct list        page_lru;                     // 所有缓存页,链表头是最久没用过的
+static struct lock        pcache_lock;                  // 保护上面的结构,读写硬盘时也持有
+static struct kmem_cache *cache_page_cache;             // struct cache_page的slab cache
+static uint32_t           indirect_buf[BLOCK_SIZE / 4]; // 一级间接块表的缓冲区,持有pcache_lock时使用
+
+// 统计信息
+static uint32_t nr_pages;          // 缓存的页数
+static uint32_t nr_dirty;          // 脏页数
+static uint32_t hit_cnt;           // 累计命中次数
+static uint32_t miss_cnt;          // 累计未命中次数,即从硬盘读入的页数
+static uint32_t evict_cnt;         // 累计淘汰的页数
+static uint32_t writeback_cnt;     // 累计写回硬盘的页数
+
+// 返回(i_no, pg_idx)所在的哈希桶
+static struct list *page_hash_bucket(uint32_t i_no, uint32_t pg_idx)
+{
+    return &page_hash[(i_no * 31 + pg_idx) % PCACHE_HASH_SIZE];
+}
+
+// 在哈希表中查找文件i_no的第pg_idx页,没有则返回NULL
+static struct cache_page *page_cache_lookup(uint32_t i_no, uint32_t pg_idx)
+{
+    struct list *bucket   = page_hash_bucket(i_no, pg_idx);
+    struct list_elem *elem = bucket->head.next;
+
+    while (elem != &bucket->tail)
+    {
+        struct cache_page *cp = elem2entry(struct cache_page, hash_tag, elem);
+
+        if (cp->i_no == i_no && cp->pg_idx == pg_idx)
+        {
+            return cp;
+        }
+
+        elem = elem->next;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief
+ * 把文件inode第pg_idx页的各扇区地址收集到lbas中,返回这一页中文件实际占用的扇区数,
+ * 超出文件大小的扇区不读也不写
+ */
+static uint32_t page_sectors(struct inode *inode, uint32_t pg_idx, uint32_t *lbas)
+{
+    uint32_t first_sec = pg_idx * SECS_PER_PAGE;
+    uint32_t file_secs = DIV_ROUND_UP(inode->i_size, BLOCK_SIZE);
+
+    if (first_sec >= file_secs)
+    {
+        return 0;
+    }
+
+    uint32_t sec_cnt = file_secs - first_sec < SECS_PER_PAGE ? file_secs - first_sec : SECS_PER_PAGE;
+
+    // 用到间接块时先把一级间接块表读进来
+    if (first_sec + sec_cnt > 12)
+    {
+        ASSERT(inode->i_sectors[12] != 0);
+        ide_read(cur_part->my_disk, inode->i_sectors[12], indirect_buf, 1);
+    }
+
+    uint32_t sec_idx = 0;
+
+    while (sec_idx < sec_cnt)
+    {
+        uint32_t block_idx = first_sec + sec_idx;
+        ASSERT(block_idx < 140);
+
+        lbas[sec_idx] = block_idx < 12 ? inode->i_sectors[block_idx] : indirect_buf[block_idx - 12];
+        sec_idx++;
+    }
+
+    return sec_cnt;
+}
+
+// 读写页中的sec_cnt个扇区,扇区地址连续的合成一次读写,地址为0的扇区跳过
+static void page_io(void *kaddr, uint32_t *lbas, uint32_t sec_cnt, bool write)
+{
+    uint32_t sec_idx = 0;
+
+    while (sec_idx < sec_cnt)
+    {
+        uint32_t run = 1;
+
+        if (lbas[sec_idx] == 0)
+        {
+            sec_idx++;
+            continue;
+        }
+
+        while (sec_idx + run < sec_cnt && lbas[sec_idx + run] == lbas[sec_idx] + run)
+        {
+            run++;
+        }
+
+        void *buf = (uint8_t *)kaddr + sec_idx * BLOCK_SIZE;
+
+        if (write)
+        {
+            ide_write(cur_part->my_disk, lbas[sec_idx], buf, run);
+        }
+        else
+        {
+            ide_read(cur_part->my_disk, lbas[sec_idx], buf, run);
+        }
+
+        sec_idx += run;
+    }
+
+    return;
+}
+
+// 把脏页cp写回硬盘
+static void page_writeback(struct cache_page *cp)
+{
+    uint32_t lbas[SECS_PER_PAGE];
+    uint32_t sec_cnt = page_sectors(cp->inode, cp->pg_idx, lbas);
+
+    page_io(cp->kaddr, lbas, sec_cnt, true);
+
+    cp->dirty = false;
+    cp->inode = NULL;
+    nr_dirty--;
+    writeback_cnt++;
+
+    return;
+}
+
+// 把页cp从缓存中去掉并释放,cp必须是干净的
+static void page_cache_free(struct cache_page *cp)
+{
+    ASSERT(!cp->dirty && cp->pin_cnt == 0);
+
+    list_remove(&cp->hash_tag);
+    list_remove(&cp->lru_tag);
+    nr_pages--;
+
+    // 页框还被进程映射着时只减少引用计数,进程解除映射时才真正释放
+    mfree_page(PF_KERNEL, cp->kaddr, 1);
+    kmem_cache_free(cache_page_cache, cp);
+
+    return;
+}
+
+// 从lru链表头开始淘汰一页,成功返回true
+static bool page_cache_evict(void)
+{
+    struct list_elem *elem = page_lru.head.next;
+
+    while (elem != &page_lru.tail)
+    {
+        struct cache_page *cp = elem2entry(struct cache_page, lru_tag, elem);
+
+        if (cp->pin_cnt == 0 && page_ref_count(addr_v2p((uint32_t)cp->kaddr)) == 1)
+        {
+            if (cp->dirty)
+            {
+                page_writeback(cp);
+            }
+
+            page_cache_free(cp);
+            evict_cnt++;
+
+            return true;
+        }
+
+        elem = elem->next;
+    }
+
+    return false;
+}
+
+// 初始化页缓存,在inode_cache_init之前调用
+void page_cache_init(void)
+{
+    uint32_t bucket_idx = 0;
+
+    while (bucket_idx < PCACHE_HASH_SIZE)
+    {
+        list_init(&page_hash[bucket_idx++]);
+    }
+
+    list_init(&page_lru);
+    lock_init(&pcache_lock);
+
+    cache_page_cache = kmem_cache_create("page_cache", sizeof(struct cache_page), NULL);
+    ASSERT(cache_page_cache != NULL);
+
+    return;
+}
+
+// 返回文件inode第pg_idx页的缓存,不在缓存中就从硬盘读入,返回的页已被钉住,用完要page_cache_put,失败返回NULL
+struct cache_page *page_cache_get(struct inode *inode, uint32_t pg_idx)
+{
+    lock_acquire(&pcache_lock);
+
+    // 1 命中,移到lru链表尾
+    struct cache_page *cp = page_cache_lookup(inode->i_no, pg_idx);
+
+    if (cp != NULL)
+    {
+        list_remove(&cp->lru_tag);
+        list_append(&page_lru, &cp->lru_tag);
+        cp->pin_cnt++;
+        hit_cnt++;
+
+        lock_release(&pcache_lock);
+        return cp;
+    }
+
+    // 2 未命中,缓存满了先淘汰一页,申请不到内存时也淘汰一页再试
+    if (nr_pages >= PCACHE_MAX_PAGES)
+    {
+        page_cache_evict();
+    }
+
+    cp = kmem_cache_alloc(cache_page_cache);
+    void *kaddr = get_kernel_direct_pages(1);
+
+    while (kaddr == NULL && page_cache_evict())
+    {
+        kaddr = get_kernel_direct_pages(1);
+    }
+
+    if (cp == NULL || kaddr == NULL)
+    {
+        if (cp != NULL)
+        {
+            kmem_cache_free(cache_page_cache, cp);
+        }
+
+        if (kaddr != NULL)
+        {
+            mfree_page(PF_KERNEL, kaddr, 1);
+        }
+
+        lock_release(&pcache_lock);
+        return NULL;
+    }
+
+    cp->i_no    = inode->i_no;
+    cp->pg_idx  = pg_idx;
+    cp->kaddr   = kaddr;
+    cp->inode   = NULL;
+    cp->dirty   = false;
+    cp->pin_cnt = 1;
+
+    // 3 从硬盘读入,超出文件大小的部分保持为0(get_kernel_direct_pages已经清0)
+    uint32_t lbas[SECS_PER_PAGE];
+    uint32_t sec_cnt = page_sectors(inode, pg_idx, lbas);
+    page_io(kaddr, lbas, sec_cnt, false);
+
+    list_append(page_hash_bucket(cp->i_no, pg_idx), &cp->hash_tag);
+    list_append(&page_lru, &cp->lru_tag);
+    nr_pages++;
+    miss_cnt++;
+
+    lock_release(&pcache_lock);
+
+    return cp;
+}
+
+// 文件inode第pg_idx页已经在缓存中时返回它并钉住,用完要page_cache_put,不在缓存中返回NULL,不读硬盘
+struct cache_page *page_cache_find(struct inode *inode, uint32_t pg_idx)
+{
+    lock_acquire(&pcache_lock);
+
+    struct cache_page *cp = page_cache_lookup(inode->i_no, pg_idx);
+
+    if (cp != NULL)
+    {
+        list_remove(&cp->lru_tag);
+        list_append(&page_lru, &cp->lru_tag);
+        cp->pin_cnt++;
+        hit_cnt++;
+    }
+
+    lock_release(&pcache_lock);
+
+    return cp;
+}
+
+// 用完page_cache_get返回的页
+void page_cache_put(struct cache_page *cp)
+{
+    lock_acquire(&pcache_lock);
+
+    ASSERT(cp->pin_cnt > 0);
+    cp->pin_cnt--;
+
+    lock_release(&pcache_lock);
+
+    return;
+}
+
+// 页的内容被修改了,标记为脏页,调用者要钉住这一页并且打开着inode
+void page_cache_mark_dirty(struct cache_page *cp, struct inode *inode)
+{
+    lock_acquire(&pcache_lock);
+
+    ASSERT(cp->pin_cnt > 0 && cp->i_no == inode->i_no);
+
+    if (!cp->dirty)
+    {
+        cp->dirty = true;
+        cp->inode = inode;
+        nr_dirty++;
+    }
+
+    lock_release(&pcache_lock);
+
+    return;
+}
+
+// 把文件inode的脏页都写回硬盘
+void page_cache_sync_inode(struct inode *inode)
+{
+    lock_acquire(&pcache_lock);
+
+    struct list_elem *elem = page_lru.head.next;
+
+    while (nr_dirty > 0 && elem != &page_lru.tail)
+    {
+        struct cache_page *cp = elem2entry(struct cache_page, lru_tag, elem);
+
+        if (cp->dirty && cp->i_no == inode->i_no)
+        {
+            page_writeback(cp);
+        }
+
+        elem = elem->next;
+    }
+
+    lock_release(&pcache_lock);
+
+    return;
+}
+
+// 丢弃编号为i_no的文件的所有缓存页,文件删除时调用
+void page_cache_drop_inode(uint32_t i_no)
+{
+    lock_acquire(&pcache_lock);
+
+    struct list_elem *elem = page_lru.head.next;
+
+    while (elem != &page_lru.tail)
+    {
+        struct cache_page *cp = elem2entry(struct cache_page, lru_tag, elem);
+        elem                  = elem->next;
+
+        if (cp->i_no == i_no)
+        {
+            // 文件已经删除了,脏的内容也不必写回
+            if (cp->dirty)
+            {
+                cp->dirty = false;
+                cp->inode = NULL;
+                nr_dirty--;
+            }
+
+            page_cache_free(cp);
+        }
+    }
+
+    lock_release(&pcache_lock);
+
+    return;
+}
+
+// 打印页缓存的统计信息
+void page_cache_info(void)
+{
+    // 页框引用计数大于1的页还被进程映射着,多是几个进程共用的代码
+    uint32_t nr_mapped = 0;
+
+    lock_acquire(&pcache_lock);
+
+    struct list_elem *elem = page_lru.head.next;
+
+    while (elem != &page_lru.tail)
+    {
+        struct cache_page *cp = elem2entry(struct cache_page, lru_tag, elem);
+
+        if (page_ref_count(addr_v2p((uint32_t)cp->kaddr)) > 1)
+        {
+            nr_mapped++;
+        }
+
+        elem = elem->next;
+    }
+
+    lock_release(&pcache_lock);
+
+    printk("page cache: pages %d/%d, mapped %d, dirty %d, hit %d, miss %d, evict %d, writeback %d\n",
+           nr_pages, PCACHE_MAX_PAGES, nr_mapped, nr_dirty, hit_cnt, miss_cnt, evict_cnt, writeback_cnt);
+
+    return;
+}
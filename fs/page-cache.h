@@ -0,0 +1,51 @@
+#ifndef __FS_PAGE_CACHE_H
+#define __FS_PAGE_CACHE_H
+#include "stdint.h"
+#include "../kernel/global.h"
+#include "../lib/kernel/list.h"
+
+#define PCACHE_MAX_PAGES 256                       // 最多缓存的页数,即1M,超过后淘汰最久没用过的页
+#define PCACHE_HASH_SIZE 64                        // 哈希桶的个数
+#define SECS_PER_PAGE    (PG_SIZE / BLOCK_SIZE)    // 一页包含的扇区数
+
+struct inode;
+
+// 页缓存中的一页,缓存文件i_no从pg_idx * PG_SIZE开始的4K内容
+struct cache_page
+{
+    uint32_t      i_no;            // 所属文件的inode编号
+    uint32_t      pg_idx;          // 在文件中是第几页
+    void         *kaddr;           // 存放内容的内核页
+    struct inode *inode;           // 脏页所属的inode,写回时要用它找扇区,干净的页不使用
+    bool          dirty;           // 内容比硬盘上的新,淘汰前要写回
+    uint16_t      pin_cnt;         // 正在使用它的次数,不为0时不能淘汰
+
+    struct list_elem hash_tag;     // 挂在哈希桶上
+    struct list_elem lru_tag;      // 挂在lru链表上,越靠近链表头越久没用过
+};
+
+// 初始化页缓存,在inode_cache_init之前调用
+void page_cache_init(void);
+
+// 返回文件inode第pg_idx页的缓存,不在缓存中就从硬盘读入,返回的页已被钉住,用完要page_cache_put,失败返回NULL
+struct cache_page *page_cache_get(struct inode *inode, uint32_t pg_idx);
+
+// 文件inode第pg_idx页已经在缓存中时返回它并钉住,用完要page_cache_put,不在缓存中返回NULL,不读硬盘
+struct cache_page *page_cache_find(struct inode *inode, uint32_t pg_idx);
+
+// 用完page_cache_get返回的页
+void page_cache_put(struct cache_page *cp);
+
+// 页的内容被修改了,标记为脏页,调用者要钉住这一页并且打开着inode
+void page_cache_mark_dirty(struct cache_page *cp, struct inode *inode);
+
+// 把文件inode的脏页都写回硬盘
+void page_cache_sync_inode(struct inode *inode);
+
+// 丢弃编号为i_no的文件的所有缓存页,文件删除时调用
+void page_cache_drop_inode(uint32_t i_no);
+
+// 打印页缓存的统计信息
+void page_cache_info(void);
+
+#endif // __FS_PAGE_CACHE_H
@@ -0,0 +1,418 @@
+#include "buddy.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "print.h"
+#include "../lib/string.h"
+#include "../lib/kernel/list.h"
+#ifdef BUDDY_BENCH
+#include "../lib/kernel/io.h"
+#include "../lib/kernel/stdio-kernel.h"
+#endif
+
+/**
+ * @brief
+ * 伙伴系统(binary buddy allocator)
+ *
+ * 把物理页框按2^order个一组组织成块,同一阶的空闲块挂在同一个链表中,
+ * 分配时从最小的够用的阶开始找,找到的大块对半拆分,后一半作为伙伴挂回低一阶;
+ * 释放时检查伙伴(块下标异或2^order)是否空闲且阶数相同,是的话就合并成高一阶的块,
+ * 直到伙伴不空闲或到达最高阶。分配和释放最多遍历BUDDY_MAX_ORDER次,都是O(log n)
+ *
+ *      order 2:  [0 1 2 3]                  [8 9 10 11]
+ *      order 1:            [4 5]
+ *      order 0:                  [6]
+ *
+ * 页框下标是相对于zone->phy_addr_start的,因此区域起始地址不需要按大块对齐
+ */
+
+// 将一个阶数为order的空闲块挂到空闲链表上
+static void free_area_add(struct buddy_zone *zone, struct page *pg, uint32_t order)
+{
+    pg->flags |= PG_BUDDY;
+    pg->order  = order;
+
+    list_push(&zone->free_area[order].free_list, &pg->free_elem);
+    zone->free_area[order].nr_free++;
+
+    return;
+}
+
+// 将一个空闲块从空闲链表上摘下
+static void free_area_del(struct buddy_zone *zone, struct page *pg, uint32_t order)
+{
+    list_remove(&pg->free_elem);
+    zone->free_area[order].nr_free--;
+
+    pg->flags &= ~PG_BUDDY;
+    pg->order  = 0;
+
+    return;
+}
+
+// 初始化伙伴系统区域,区域内的页框开始时都不空闲,之后用buddy_add_range加入可用的部分
+void buddy_init_empty(struct buddy_zone *zone, struct page *pages, uint32_t phy_addr_start, uint32_t page_cnt)
+{
+    zone->pages          = pages;
+    zone->phy_addr_start = phy_addr_start;
+    zone->page_cnt       = page_cnt;
+    zone->free_pages     = 0;
+
+    memset(pages, 0, page_cnt * sizeof(struct page));
+
+    uint32_t order = 0;
+    while (order < BUDDY_MAX_ORDER)
+    {
+        list_init(&zone->free_area[order].free_list);
+        zone->free_area[order].nr_free = 0;
+        order++;
+    }
+
+    return;
+}
+
+/**
+ * @brief
+ * 把下标从pg_idx开始的cnt个页框作为空闲块加入zone,只在初始化时使用。
+ * 按下标对齐的最大块切分,结尾不足一个大块的部分用低阶的块补齐。
+ * 区域中间的空洞(BIOS保留的内存等)不加入,空洞里的页框永远不是空闲块,
+ * 释放时不会和它们合并
+ */
+void buddy_add_range(struct buddy_zone *zone, uint32_t pg_idx, uint32_t cnt)
+{
+    ASSERT(pg_idx + cnt <= zone->page_cnt);
+
+    uint32_t end = pg_idx + cnt;
+    while (pg_idx < end)
+    {
+        uint32_t order = BUDDY_MAX_ORDER - 1;
+        while ((pg_idx & ((1 << order) - 1)) || (pg_idx + (1 << order) > end))
+        {
+            order--;
+        }
+
+        // 初始化时按下标从小到大加入,用list_append使低地址的块排在前面
+        struct page *pg = zone->pages + pg_idx;
+        pg->flags |= PG_BUDDY;
+        pg->order  = order;
+        list_append(&zone->free_area[order].free_list, &pg->free_elem);
+        zone->free_area[order].nr_free++;
+
+        zone->free_pages += 1 << order;
+        pg_idx           += 1 << order;
+    }
+
+    return;
+}
+
+// 初始化伙伴系统区域,区域内所有页框开始时都是空闲的
+void buddy_init(struct buddy_zone *zone, struct page *pages, uint32_t phy_addr_start, uint32_t page_cnt)
+{
+    buddy_init_empty(zone, pages, phy_addr_start, page_cnt);
+    buddy_add_range(zone, 0, page_cnt);
+
+    return;
+}
+
+// 在zone中分配2^order个连续的页框,成功返回首页的描述符,失败返回NULL
+struct page *buddy_alloc(struct buddy_zone *zone, uint32_t order)
+{
+    ASSERT(order < BUDDY_MAX_ORDER);
+
+    enum intr_status old_status = intr_disable();
+
+    // 从order阶开始向上找第一个非空的空闲链表
+    uint32_t cur_order = order;
+    while (cur_order < BUDDY_MAX_ORDER && zone->free_area[cur_order].nr_free == 0)
+    {
+        cur_order++;
+    }
+
+    if (cur_order == BUDDY_MAX_ORDER)
+    {
+        intr_set_status(old_status);
+        return NULL;
+    }
+
+    struct page *pg = elem2entry(struct page, free_elem, zone->free_area[cur_order].free_list.head.next);
+    free_area_del(zone, pg, cur_order);
+
+    // 块比需要的大就对半拆分,后一半作为伙伴挂回低一阶的链表
+    while (cur_order > order)
+    {
+        cur_order--;
+        free_area_add(zone, pg + (1 << cur_order), cur_order);
+    }
+
+    // 块中每一页以后都可能被单独释放,引用计数都从1开始
+    uint32_t pg_idx = 0;
+    while (pg_idx < (1U << order))
+    {
+        pg[pg_idx].ref_count = 1;
+        pg_idx++;
+    }
+
+    zone->free_pages -= 1 << order;
+    intr_set_status(old_status);
+
+    return pg;
+}
+
+// 将以pg为首页的2^order个页框归还zone,并与空闲的伙伴合并
+void buddy_free(struct buddy_zone *zone, struct page *pg, uint32_t order)
+{
+    uint32_t pg_idx = pg - zone->pages;
+
+    ASSERT(order < BUDDY_MAX_ORDER && pg_idx < zone->page_cnt);
+    ASSERT(!(pg_idx & ((1 << order) - 1)) && !(pg->flags & PG_BUDDY));
+
+    enum intr_status old_status = intr_disable();
+    zone->free_pages += 1 << order;
+
+    while (order < BUDDY_MAX_ORDER - 1)
+    {
+        // 伙伴块的下标只在第order位上与自己不同
+        uint32_t buddy_idx  = pg_idx ^ (1 << order);
+        struct page *buddy  = zone->pages + buddy_idx;
+
+        // 伙伴不在本区域内,或者伙伴不是同阶的空闲块,不能再合并
+        if (buddy_idx >= zone->page_cnt || !(buddy->flags & PG_BUDDY) || buddy->order != order)
+        {
+            break;
+        }
+
+        free_area_del(zone, buddy, order);
+
+        // 合并后的块以两者中下标较小的为首页
+        pg_idx &= ~(1 << order);
+        order++;
+    }
+
+    free_area_add(zone, zone->pages + pg_idx, order);
+    intr_set_status(old_status);
+
+    return;
+}
+
+/**
+ * @brief
+ * 从zone中取出指定的页框pg,pg必须在某个空闲块中,否则返回false。
+ * 找到包含pg的空闲块后逐阶对半拆分,不含pg的一半挂回空闲链表,最后剩下的就是pg。
+ * 用于原地扩大物理上连续的内存,要的是紧挨着已有内存的那一页,不能随便分一页
+ */
+bool buddy_claim(struct buddy_zone *zone, struct page *pg)
+{
+    uint32_t pg_idx = pg - zone->pages;
+
+    ASSERT(pg_idx < zone->page_cnt);
+
+    enum intr_status old_status = intr_disable();
+
+    // 从0阶向上找以pg所在的对齐位置为首页的空闲块
+    uint32_t order = 0;
+    while (order < BUDDY_MAX_ORDER)
+    {
+        struct page *head = zone->pages + (pg_idx & ~((1U << order) - 1));
+
+        if ((head->flags & PG_BUDDY) && head->order == order)
+        {
+            break;
+        }
+
+        order++;
+    }
+
+    if (order == BUDDY_MAX_ORDER)
+    {
+        intr_set_status(old_status);
+        return false;
+    }
+
+    uint32_t head_idx = pg_idx & ~((1U << order) - 1);
+    free_area_del(zone, zone->pages + head_idx, order);
+
+    while (order > 0)
+    {
+        order--;
+
+        // pg在后一半就把前一半挂回去,否则挂后一半
+        if (pg_idx & (1U << order))
+        {
+            free_area_add(zone, zone->pages + head_idx, order);
+            head_idx += 1U << order;
+        }
+        else
+        {
+            free_area_add(zone, zone->pages + head_idx + (1U << order), order);
+        }
+    }
+
+    pg->ref_count     = 1;
+    zone->free_pages -= 1;
+    intr_set_status(old_status);
+
+    return true;
+}
+
+// 页框描述符转物理地址
+uint32_t page2phy(struct buddy_zone *zone, struct page *pg)
+{
+    return zone->phy_addr_start + (pg - zone->pages) * PG_SIZE;
+}
+
+// 物理地址转页框描述符
+struct page *phy2page(struct buddy_zone *zone, uint32_t phy_addr)
+{
+    ASSERT(phy_addr >= zone->phy_addr_start);
+    ASSERT((phy_addr - zone->phy_addr_start) / PG_SIZE < zone->page_cnt);
+
+    return zone->pages + (phy_addr - zone->phy_addr_start) / PG_SIZE;
+}
+
+// 返回能容纳pg_cnt个页框的最小阶数
+uint32_t buddy_order(uint32_t pg_cnt)
+{
+    uint32_t order = 0;
+
+    while ((1U << order) < pg_cnt)
+    {
+        order++;
+    }
+
+    return order;
+}
+
+#define SELF_TEST_ORDERS 6         // 自检时分配0~5阶的块各一个
+
+// 启动时的自检,检查分裂、对齐和合并是否正确
+void buddy_self_test(struct buddy_zone *zone)
+{
+    uint32_t nr_free_before[BUDDY_MAX_ORDER];
+    uint32_t free_pages_before = zone->free_pages;
+    struct page *blocks[SELF_TEST_ORDERS];
+    uint32_t order, other;
+
+    for (order = 0; order < BUDDY_MAX_ORDER; order++)
+    {
+        nr_free_before[order] = zone->free_area[order].nr_free;
+    }
+
+    // 1 分配,检查块首页按自身大小对齐
+    for (order = 0; order < SELF_TEST_ORDERS; order++)
+    {
+        blocks[order] = buddy_alloc(zone, order);
+        ASSERT(blocks[order] != NULL);
+        ASSERT(!((blocks[order] - zone->pages) & ((1 << order) - 1)));
+    }
+
+    ASSERT(zone->free_pages == free_pages_before - ((1 << SELF_TEST_ORDERS) - 1));
+
+    // 2 检查各块之间互不重叠
+    for (order = 0; order < SELF_TEST_ORDERS; order++)
+    {
+        for (other = order + 1; other < SELF_TEST_ORDERS; other++)
+        {
+            ASSERT(blocks[order] + (1 << order) <= blocks[other] || blocks[other] + (1 << other) <= blocks[order]);
+        }
+    }
+
+    // 3 先释放奇数阶再释放偶数阶,打乱释放顺序
+    for (order = 1; order < SELF_TEST_ORDERS; order += 2)
+    {
+        buddy_free(zone, blocks[order], order);
+    }
+
+    for (order = 0; order < SELF_TEST_ORDERS; order += 2)
+    {
+        buddy_free(zone, blocks[order], order);
+    }
+
+    /**
+     * @brief
+     * 一组空闲页框完全合并后的分块方式是唯一的,
+     * 全部释放后各阶空闲块的数目必须和自检前一模一样,否则说明有没合并回去的伙伴
+     */
+
+    ASSERT(zone->free_pages == free_pages_before);
+    for (order = 0; order < BUDDY_MAX_ORDER; order++)
+    {
+        ASSERT(zone->free_area[order].nr_free == nr_free_before[order]);
+    }
+
+    return;
+}
+
+#ifdef BUDDY_BENCH
+
+#define BENCH_ROUNDS 512           // 每种占用率下测量的分配/释放次数
+
+static struct page *bench_pages[BENCH_ROUNDS];
+
+// 先把zone填充到percent的占用率,再测量分配和释放1页的平均周期数
+static void bench_at(struct buddy_zone *zone, char *name, uint32_t percent)
+{
+    struct list filler;
+    list_init(&filler);
+
+    // 已分配出去的页框不在空闲链表上,借用其free_elem把填充用的页串起来
+    uint32_t target_used = zone->page_cnt / 100 * percent;
+    while (zone->page_cnt - zone->free_pages < target_used)
+    {
+        struct page *pg = buddy_alloc(zone, 0);
+        if (pg == NULL)
+        {
+            break;
+        }
+
+        list_append(&filler, &pg->free_elem);
+    }
+
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+
+    while (round < BENCH_ROUNDS)
+    {
+        bench_pages[round] = buddy_alloc(zone, 0);
+        round++;
+    }
+
+    uint32_t alloc_cycles = (uint32_t)(rdtsc() - start);
+
+    round = 0;
+    start = rdtsc();
+
+    while (round < BENCH_ROUNDS)
+    {
+        if (bench_pages[round] != NULL)
+        {
+            buddy_free(zone, bench_pages[round], 0);
+        }
+
+        round++;
+    }
+
+    uint32_t free_cycles = (uint32_t)(rdtsc() - start);
+
+    printk("  %s occupancy %d%c: alloc %d cycles, free %d cycles\n",
+           name, percent, '%', alloc_cycles / BENCH_ROUNDS, free_cycles / BENCH_ROUNDS);
+
+    // 归还填充用的页框
+    while (!list_empty(&filler))
+    {
+        buddy_free(zone, elem2entry(struct page, free_elem, list_pop(&filler)), 0);
+    }
+
+    return;
+}
+
+// 测量不同占用率下分配/释放1页的平均时钟周期数
+void buddy_bench(struct buddy_zone *zone, char *name)
+{
+    bench_at(zone, name, 10);
+    bench_at(zone, name, 50);
+    bench_at(zone, name, 90);
+
+    return;
+}
+
+#endif // BUDDY_BENCH
@@ -0,0 +1,74 @@
+#ifndef __KERNEL_BUDDY_H
+#define __KERNEL_BUDDY_H
+#include "stdint.h"
+#include "global.h"
+#include "../lib/kernel/list.h"
+
+#define BUDDY_MAX_ORDER 11         // 阶数0~10, 最大的块为2^10页,即4MB
+#define PG_BUDDY        1          // 该页框是空闲块的首页,挂在free_area的链表上
+#define PG_USER         2          // 该页框分给了用户,可能是从内核内存池借来的,由memory.c设置和清除
+#define PG_PINNED       4          // 该页框常驻,映射时不计引用计数也不会被释放,如全局的零页
+
+// 物理页框描述符,每个物理页框对应一个,用来取代原来内存池中的位图
+struct page
+{
+    struct list_elem free_elem;    // 空闲时通过此结点挂到free_area[order]的链表上
+    uint8_t          flags;        // 页框标志,PG_BUDDY等
+    uint8_t          order;        // 若为空闲块首页,记录该空闲块的阶数
+    uint16_t         ref_count;    // 映射到此页框的页表项个数,写时复制时大于1
+};
+
+// 同一阶数的空闲块链表
+struct free_area
+{
+    struct list free_list;         // 空闲块链表,链表中元素为空闲块首页的free_elem
+    uint32_t    nr_free;           // 该阶空闲块的个数
+};
+
+// 伙伴系统管理的一段连续物理内存
+struct buddy_zone
+{
+    struct page      *pages;       // 本区域的页框描述符数组,pages[0]对应phy_addr_start处的页框
+    uint32_t         phy_addr_start;
+    uint32_t         page_cnt;     // 本区域管理的页框数
+    uint32_t         free_pages;   // 当前空闲的页框数
+
+    struct free_area free_area[BUDDY_MAX_ORDER];
+};
+
+// 初始化伙伴系统区域,区域内所有页框开始时都是空闲的
+void buddy_init(struct buddy_zone *zone, struct page *pages, uint32_t phy_addr_start, uint32_t page_cnt);
+
+// 初始化伙伴系统区域,区域内的页框开始时都不空闲,之后用buddy_add_range加入可用的部分
+void buddy_init_empty(struct buddy_zone *zone, struct page *pages, uint32_t phy_addr_start, uint32_t page_cnt);
+
+// 把下标从pg_idx开始的cnt个页框作为空闲块加入zone,只在初始化时使用
+void buddy_add_range(struct buddy_zone *zone, uint32_t pg_idx, uint32_t cnt);
+
+// 在zone中分配2^order个连续的页框,成功返回首页的描述符,失败返回NULL
+struct page *buddy_alloc(struct buddy_zone *zone, uint32_t order);
+
+// 将以pg为首页的2^order个页框归还zone,并与空闲的伙伴合并
+void buddy_free(struct buddy_zone *zone, struct page *pg, uint32_t order);
+
+// 从zone中取出指定的空闲页框pg,pg不空闲时返回false
+bool buddy_claim(struct buddy_zone *zone, struct page *pg);
+
+// 页框描述符转物理地址
+uint32_t page2phy(struct buddy_zone *zone, struct page *pg);
+
+// 物理地址转页框描述符
+struct page *phy2page(struct buddy_zone *zone, uint32_t phy_addr);
+
+// 返回能容纳pg_cnt个页框的最小阶数
+uint32_t buddy_order(uint32_t pg_cnt);
+
+// 启动时的自检,检查分裂、对齐和合并是否正确
+void buddy_self_test(struct buddy_zone *zone);
+
+#ifdef BUDDY_BENCH
+// 测量不同占用率下分配/释放1页的平均时钟周期数
+void buddy_bench(struct buddy_zone *zone, char *name);
+#endif
+
+#endif // __KERNEL_BUDDY_H
@@ -0,0 +1,472 @@
+#include "fault.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "print.h"
+#include "../lib/string.h"
+#include "../thread/thread.h"
+#include "../userprog/process.h"
+#include "../userprog/wait_exit.h"
+#include "vma.h"
+#include "swap.h"
+
+/**
+ * @brief
+ * 缺页异常处理
+ *
+ * fork时父子进程共享用户空间的物理页框,可写的页表项都改为只读并打上PG_COW标记,
+ * 页框的引用计数记录有多少个页表项映射着它。任何一方第一次写这一页时触发缺页异常,
+ * 这时才为写的一方复制一页;若引用计数已经是1,说明其它进程都已经复制走或退出了,直接恢复可写即可。
+ *
+ * 内核在系统调用中也会写用户空间(比如sys_read的缓冲区),所以要打开CR0.WP,
+ * 否则特权级0写只读页不会产生异常,会直接写坏共享的页框
+ *
+ * 用户空间的页也是按需分配的:落在进程某个区域中但还没有映射的页(进程体、bss、堆),
+ * 以及用户栈往下增长时压栈碰到的页,第一次访问时才分配一个清0的物理页框,
+ * 文件映射区域中的页则从文件读入(见kernel/vma.c),换出到交换分区的页从交换分区读回(见kernel/swap.c)。
+ * 匿名内存第一次是读时先只读映射全局的零页,可写的区域打上PG_COW标记,第一次写时才按写时复制分配页框,
+ * 只读不写的大数组就不占页框
+ */
+
+#define CR0_WP 0x00010000    // CR0的第16位,为1时特权级0也要遵守页的只读属性
+
+static void *cow_buf;        // 复制页时的内核中转缓冲区,只在关中断时使用
+
+/**
+ * @brief
+ * 系统调用访问用户给的缓冲区和字符串
+ *
+ * 用户给的地址可能非法,合法的页也可能因为超过页数上限或内存不够而分配不到页框。
+ * 这时不能在缺页异常中结束进程:系统调用可能正持有锁、钉住了页缓存的页或分配了缓冲区,
+ * 直接退出就都泄漏了。所以复制只用下面两段汇编,缺页处理不了时异常处理程序把返回地址改到
+ * 各自的修复代码,复制函数返回失败,由系统调用释放资源后返回-1。
+ * 内核自己访问进程的内存(比如用户arena的块头)时不经过这里,这种缺页不受页数上限的限制
+ *
+ * uaccess_copy(dst, src, cnt):      返回没有复制的字节数
+ * uaccess_strncpy(dst, src, max):   返回字符串长度,超过max-1个字符或地址非法返回-1
+ */
+asm(".text\n"
+    ".globl uaccess_copy\n"
+    "uaccess_copy:\n"
+    "    pushl %esi\n"
+    "    pushl %edi\n"
+    "    movl  12(%esp), %edi\n"
+    "    movl  16(%esp), %esi\n"
+    "    movl  20(%esp), %ecx\n"
+    "    cld\n"
+    "uaccess_copy_start:\n"
+    "    rep movsb\n"
+    "uaccess_copy_end:\n"
+    "    movl  %ecx, %eax\n"
+    "    popl  %edi\n"
+    "    popl  %esi\n"
+    "    ret\n"
+    "\n"
+    ".globl uaccess_strncpy\n"
+    "uaccess_strncpy:\n"
+    "    pushl %esi\n"
+    "    pushl %edi\n"
+    "    movl  12(%esp), %edi\n"
+    "    movl  16(%esp), %esi\n"
+    "    movl  20(%esp), %ecx\n"
+    "    xorl  %edx, %edx\n"
+    "uaccess_strncpy_start:\n"
+    "1:  cmpl  %ecx, %edx\n"
+    "    je    uaccess_strncpy_end\n"
+    "    movb  (%esi,%edx), %al\n"
+    "    movb  %al, (%edi,%edx)\n"
+    "    incl  %edx\n"
+    "    testb %al, %al\n"
+    "    jnz   1b\n"
+    "    leal  -1(%edx), %eax\n"
+    "    jmp   2f\n"
+    "uaccess_strncpy_end:\n"
+    "    movl  $-1, %eax\n"
+    "2:  popl  %edi\n"
+    "    popl  %esi\n"
+    "    ret\n");
+
+uint32_t uaccess_copy(void *dst, const void *src, uint32_t cnt);
+int32_t  uaccess_strncpy(char *dst, const char *src, uint32_t max);
+
+extern char uaccess_copy_start[], uaccess_copy_end[];
+extern char uaccess_strncpy_start[], uaccess_strncpy_end[];
+
+// 可能访问用户地址的指令范围[start, end),缺页处理不了时跳到end,end处的代码返回失败
+static const struct
+{
+    char *start;
+    char *end;
+} uaccess_ranges[] =
+{
+    { uaccess_copy_start,    uaccess_copy_end    },
+    { uaccess_strncpy_start, uaccess_strncpy_end },
+};
+
+// 返回异常发生处所在的访问用户地址的指令范围下标,不在其中时返回-1
+static int32_t uaccess_range(struct intr_stack *frame)
+{
+    char *eip    = (char *)frame->eip;
+    uint32_t idx = 0;
+
+    while (idx < sizeof(uaccess_ranges) / sizeof(uaccess_ranges[0]))
+    {
+        if (eip >= uaccess_ranges[idx].start && eip < uaccess_ranges[idx].end)
+        {
+            return idx;
+        }
+
+        idx++;
+    }
+
+    return -1;
+}
+
+// 缺页分配不到页框时能否让访问失败:特权级3的访问结束进程,系统调用复制用户缓冲区时让复制失败,
+// 其余是内核自己访问进程的内存,无法回退,不检查页数上限
+static bool fault_may_fail(struct intr_stack *frame)
+{
+    return (frame->err_code & PF_ERR_U) || uaccess_range(frame) != -1;
+}
+
+// 从用户地址src复制cnt个字节到dst,返回没有复制的字节数,0表示全部复制完
+uint32_t copy_from_user(void *dst, const void *src, uint32_t cnt)
+{
+    return uaccess_copy(dst, src, cnt);
+}
+
+// 从src复制cnt个字节到用户地址dst,返回没有复制的字节数,0表示全部复制完
+uint32_t copy_to_user(void *dst, const void *src, uint32_t cnt)
+{
+    return uaccess_copy(dst, src, cnt);
+}
+
+// 从用户地址src复制以0结尾的字符串到dst,连同0最多max个字节,返回字符串长度,地址非法或太长返回-1
+int32_t strncpy_from_user(char *dst, const char *src, uint32_t max)
+{
+    return uaccess_strncpy(dst, src, max);
+}
+
+// 使虚拟地址vaddr在tlb中的缓存失效
+static void tlb_flush_one(uint32_t vaddr)
+{
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory");
+
+    return ;
+}
+
+// 解除用户页vaddr的写时复制共享,copy为false时不复制原来的内容而是清0,成功返回true。
+// 分配页框时页表项被改了的话不做处理也返回true,重新访问时再缺页
+bool cow_break(uint32_t vaddr, bool copy)
+{
+    vaddr &= 0xfffff000;
+
+    uint32_t *pte = pte_ptr(vaddr);
+    ASSERT((*pde_ptr(vaddr) & PG_P_1) && (*pte & PG_P_1) && (*pte & PG_COW));
+
+    // 分配页框时可能要换出页而睡眠,所以要在关中断之前分配。看起来要复制时先备好一个新页框,
+    // 关中断后再重新判断,用不上就还回去
+    uint32_t old_phy_addr = *pte & 0xfffff000;
+    bool from_zero        = old_phy_addr == zero_page_phy();
+    bool zeroed           = false;
+    uint32_t new_phy_addr = 0;
+
+    if (from_zero || page_ref_count(old_phy_addr) != 1)
+    {
+        new_phy_addr = from_zero ? (uint32_t)get_a_zeroed_phy_page(PF_USER, &zeroed) :
+                                   (uint32_t)get_a_phy_page(PF_USER);
+
+        if (new_phy_addr == 0)
+        {
+            return false;
+        }
+    }
+
+    // 引用计数的判断和页表项的修改要一起完成,防止中途换下cpu
+    enum intr_status old_status = intr_disable();
+
+    // 分配时睡眠过的话,这一页可能已被换出,或者页框变了,这时什么也不做,返回后重新访问会再次缺页
+    if (!(*pte & PG_P_1) || !(*pte & PG_COW) || (*pte & 0xfffff000) != old_phy_addr)
+    {
+        intr_set_status(old_status);
+
+        if (new_phy_addr != 0)
+        {
+            pfree(new_phy_addr);
+        }
+
+        return true;
+    }
+
+    // 1 只剩自己映射着这个页框,不必复制,零页不计引用计数,总是要换成新页框
+    if (!from_zero && page_ref_count(old_phy_addr) == 1)
+    {
+        *pte = (*pte & ~PG_COW) | PG_RW_W;
+        tlb_flush_one(vaddr);
+
+        if (!copy)
+        {
+            memset((void *)vaddr, 0, PG_SIZE);
+        }
+
+        intr_set_status(old_status);
+
+        // 睡眠时共享的进程退出了,备好的页框用不上了
+        if (new_phy_addr != 0)
+        {
+            pfree(new_phy_addr);
+        }
+
+        return true;
+    }
+
+    // 2 还有别的进程共享,复制一份新的页框,零页不用复制,能拿到预先清0的页框就连清0也省了。
+    // 先前看到的引用计数为1,之后又被共享了的话还没有备好页框,不在关中断时分配,返回后重新缺页再来
+    if (new_phy_addr == 0)
+    {
+        intr_set_status(old_status);
+        return true;
+    }
+
+    copy = copy && !from_zero;
+
+    // 先经cow_buf中转,页表项改写之后vaddr就指向新的页框了
+    if (copy)
+    {
+        memcpy(cow_buf, (void *)vaddr, PG_SIZE);
+    }
+
+    *pte = new_phy_addr | ((*pte & 0xfff & ~PG_COW) | PG_RW_W);
+    tlb_flush_one(vaddr);
+
+    if (copy)
+    {
+        memcpy((void *)vaddr, cow_buf, PG_SIZE);
+    }
+    else if (!zeroed)
+    {
+        memset((void *)vaddr, 0, PG_SIZE);
+    }
+
+    // 旧页框少了一个映射,零页不计入驻留页数,换成自己的页框后才算
+    pfree(old_phy_addr);
+
+    if (from_zero)
+    {
+        mem_rss_add(running_thread(), 1);
+    }
+
+    intr_set_status(old_status);
+
+    return true;
+}
+
+// 为用户页vaddr分配一个清0的物理页框,成功返回true
+static bool anon_page_fault(uint32_t vaddr)
+{
+    bool zeroed         = false;
+    uint32_t pg_phyaddr = (uint32_t)get_a_zeroed_phy_page(PF_USER, &zeroed);
+
+    if (pg_phyaddr == 0)
+    {
+        return false;
+    }
+
+    vaddr &= 0xfffff000;
+    page_map(vaddr, pg_phyaddr);
+
+    if (!zeroed)
+    {
+        memset((void *)vaddr, 0, PG_SIZE);
+    }
+
+    running_thread()->min_flt++;
+
+    return true;
+}
+
+// 读还没写过的匿名页vaddr时只读映射零页,writable为true时打上写时复制标记,第一次写时再分配页框
+static void zero_page_fault(uint32_t vaddr, bool writable)
+{
+    vaddr &= 0xfffff000;
+    page_map_shared(vaddr, zero_page_phy(), writable);
+
+    if (!writable)
+    {
+        page_set_writable(vaddr, false);
+    }
+
+    running_thread()->min_flt++;
+
+    return ;
+}
+
+// 处理用户空间vaddr处页不存在的缺页,frame为异常的栈帧,是合法访问就分配页框并返回true
+static bool user_page_fault(uint32_t vaddr, struct intr_stack *frame)
+{
+    struct task_struct *cur = running_thread();
+
+    if (cur->pgdir == NULL || vaddr < USER_VADDR_START || vaddr >= 0xc0000000)
+    {
+        return false;
+    }
+
+    bool read           = !(frame->err_code & PF_ERR_W);
+    bool swapped        = (*pde_ptr(vaddr) & PG_P_1) && PTE_IS_SWAP(*pte_ptr(vaddr));
+    struct vm_area *vma = swapped ? NULL : vma_find(&cur->vmas, vaddr);
+
+    // 匿名内存的读缺页映射零页,文件映射区域中整页都在文件内容之后的是bss,和匿名内存一样
+    bool zero = vma != NULL && read &&
+                (vma->type != VMA_FILE || (!(vma->prot & VM_SHARED) && (vaddr & 0xfffff000) >= vma->file_end));
+
+    // 超过了自己的页数上限就不再分配,和非法访问一样结束进程或让系统调用失败,不去挤占别的进程的页框,
+    // 映射零页不占新页框,不受上限限制
+    if (!zero && fault_may_fail(frame) && !mem_limit_check(MEM_RES_PAGES, 1))
+    {
+        put_str("\nmemory limit exceeded");
+        return false;
+    }
+
+    // 0 页已经换出到交换分区,读回来
+    if (swapped)
+    {
+        return swap_in(vaddr);
+    }
+
+    // 1 地址落在某个区域中,只是还没有物理页框,文件映射的区域要从文件读入
+    if (vma != NULL)
+    {
+        if (zero)
+        {
+            zero_page_fault(vaddr, vma->prot & VM_WRITE);
+            return true;
+        }
+
+        if (vma->type == VMA_FILE)
+        {
+            return vma_file_fault(vma, vaddr);
+        }
+
+        if (!anon_page_fault(vaddr))
+        {
+            return false;
+        }
+
+        if (!(vma->prot & VM_WRITE))
+        {
+            page_set_writable(vaddr & 0xfffff000, false);
+        }
+
+        return true;
+    }
+
+    // 2 用户栈向下增长,异常来自特权级0时(系统调用中访问用户栈)用进入系统调用时保存的用户esp
+    uint32_t user_esp = (uint32_t)frame->esp;
+
+    if (!(frame->err_code & PF_ERR_U))
+    {
+        struct intr_stack *syscall_frame = (struct intr_stack *)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
+        user_esp = (uint32_t)syscall_frame->esp;
+    }
+
+    // pushad一次最多压入32字节,访问esp下方32字节以内的地址也算压栈
+    if (vaddr >= 0xc0000000 - USER_STACK3_LIMIT && vaddr + 32 >= user_esp)
+    {
+        return vma_grow_stack(&cur->vmas, vaddr) && anon_page_fault(vaddr);
+    }
+
+    return false;
+}
+
+// 缺页异常处理程序,进入时已经关中断
+static void page_fault_handler(uint32_t vec_nr)
+{
+    // kernel.S中压入的中断号就是intr_stack的第一个成员
+    struct intr_stack *frame = (struct intr_stack *)&vec_nr;
+
+    uint32_t fault_vaddr = 0;
+    asm("movl %%cr2, %0"
+        : "=r"(fault_vaddr));      // cr2是存放造成page_fault的地址
+
+    // 对写时复制页的写操作:页存在、写引起、用户空间地址、页表项有PG_COW标记
+    if ((frame->err_code & (PF_ERR_P | PF_ERR_W)) == (PF_ERR_P | PF_ERR_W) &&
+        fault_vaddr < 0xc0000000 && (*pde_ptr(fault_vaddr) & PG_P_1))
+    {
+        uint32_t *pte = pte_ptr(fault_vaddr);
+
+        if ((*pte & PG_P_1) && (*pte & PG_COW))
+        {
+            uint32_t pg_phy_addr = *pte & 0xfffff000;
+
+            // 要复制出新页框时先看页数上限,只剩自己映射时cow_break只是去掉PG_COW,不用检查
+            if ((pg_phy_addr == zero_page_phy() || page_ref_count(pg_phy_addr) != 1) &&
+                fault_may_fail(frame) && !mem_limit_check(MEM_RES_PAGES, 1))
+            {
+                put_str("\nmemory limit exceeded");
+            }
+            else if (cow_break(fault_vaddr, true))
+            {
+                running_thread()->min_flt++;
+                return ;
+            }
+            else
+            {
+                // 内存不够复制,和非法访问一样处理
+                put_str("\nout of memory when copy on write");
+            }
+        }
+    }
+
+    // 页不存在:按需分配
+    if (!(frame->err_code & PF_ERR_P) && user_page_fault(fault_vaddr, frame))
+    {
+        return ;
+    }
+
+    // 系统调用复制用户缓冲区时访问失败,跳到修复代码,复制函数返回失败,系统调用自己释放资源后返回
+    int32_t range = uaccess_range(frame);
+
+    if (!(frame->err_code & PF_ERR_U) && range != -1)
+    {
+        frame->eip = (void (*)(void))uaccess_ranges[range].end;
+        return ;
+    }
+
+    put_str("\npage fault addr is ");
+    put_int(fault_vaddr);
+    put_str(", err_code is ");
+    put_int(frame->err_code);
+    put_str(", eip is ");
+    put_int((uint32_t)frame->eip);
+    put_char('\n');
+
+    // 用户进程在特权级3的非法访问只结束这个进程,内核中的访问不能在这里退出,否则持有的资源都无法释放
+    if ((frame->err_code & PF_ERR_U) && running_thread()->pgdir != NULL)
+    {
+        put_str("segmentation fault, process killed\n");
+        sys_exit(-1);
+    }
+
+    PANIC("page_fault_handler: invalid memory access");
+}
+
+// 注册缺页异常处理程序并打开CR0.WP,使内核写只读的用户页也会触发缺页异常
+void page_fault_init(void)
+{
+    put_str("  page_fault_init start\n");
+
+    cow_buf = get_kernel_pages(1);
+    ASSERT(cow_buf != NULL);
+
+    register_handler(0x0e, page_fault_handler);
+
+    uint32_t cr0 = 0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_WP;
+    asm volatile("movl %0, %%cr0" ::"r"(cr0) : "memory");
+
+    put_str("  page_fault_init done\n");
+
+    return ;
+}
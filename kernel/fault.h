@@ -0,0 +1,26 @@
+#ifndef __KERNEL_FAULT_H
+#define __KERNEL_FAULT_H
+#include "stdint.h"
+#include "global.h"
+
+// 缺页异常错误码的各位
+#define PF_ERR_P 1           // 为1表示页存在而访问权限不符,为0表示页不存在
+#define PF_ERR_W 2           // 为1表示写操作引起的异常
+#define PF_ERR_U 4           // 为1表示特权级3引起的异常
+
+// 注册缺页异常处理程序并打开CR0.WP,使内核写只读的用户页也会触发缺页异常
+void page_fault_init(void);
+
+// 解除用户页vaddr的写时复制共享,copy为false时不复制原来的内容而是清0,成功返回true
+bool cow_break(uint32_t vaddr, bool copy);
+
+// 从用户地址src复制cnt个字节到dst,返回没有复制的字节数,0表示全部复制完
+uint32_t copy_from_user(void *dst, const void *src, uint32_t cnt);
+
+// 从src复制cnt个字节到用户地址dst,返回没有复制的字节数,0表示全部复制完
+uint32_t copy_to_user(void *dst, const void *src, uint32_t cnt);
+
+// 从用户地址src复制以0结尾的字符串到dst,连同0最多max个字节,返回字符串长度,地址非法或太长返回-1
+int32_t strncpy_from_user(char *dst, const char *src, uint32_t max);
+
+#endif // __KERNEL_FAULT_H
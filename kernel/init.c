@@ -10,6 +10,7 @@
 #include "../userprog/syscall-init.h"
 #include "../device/ide.h"
 #include "../fs/fs.h"
+#include "swap.h"
 
 // 负责初始化所有模块
 void init_all()
@@ -35,6 +36,7 @@ void init_all()
     intr_enable();   // 后面的ide_init需要打开中断
     ide_init();      // 初始化硬盘
     filesys_init();  // 初始化文件系统
+    swap_init();     // 初始化交换分区,要在filesys_init之后
 
     return ;
 }
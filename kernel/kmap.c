@@ -0,0 +1,91 @@
+#include "kmap.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "../lib/kernel/print.h"
+
+/**
+ * @brief
+ * 临时映射窗口(kmap)
+ *
+ * 内核访问物理页框时,直接映射区之内的页框用DIRECT_MAP_BASE + 物理地址就能访问,
+ * 超出直接映射区的页框,或者别的进程页表中的页框,要临时映射到内核的某个虚拟页上。
+ * 这里预留KMAP_SLOT_CNT个内核虚拟页作为固定窗口,每种用途独占一个,
+ * 映射和取消映射都只改这一个页表项再用invlpg刷掉这一项,不用切换cr3,也不会刷掉整个tlb。
+ * 所有页目录的内核部分共用同一组页表,所以在任何进程中映射的窗口都一样能访问。
+ * 窗口不加锁,由使用者按enum kmap_slot中的约定保证同一时刻只有一个地方在用
+ */
+
+static uint32_t kmap_base;         // 第一个窗口的虚拟地址,窗口slot在kmap_base + slot * PG_SIZE
+
+// 使当前tlb中vaddr的缓存失效
+static void kmap_tlb_flush(uint32_t vaddr)
+{
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory");
+
+    return;
+}
+
+// 预留各窗口的内核虚拟地址,在内存池初始化之后调用
+void kmap_init(void)
+{
+    put_str("  kmap_init start\n");
+
+    // 借get_kernel_pages占下虚拟地址并建好页表,再把页框还回去,窗口平时不映射任何页框
+    kmap_base = (uint32_t)get_kernel_pages(KMAP_SLOT_CNT);
+    ASSERT(kmap_base != 0);
+
+    uint32_t slot = 0;
+    while (slot < KMAP_SLOT_CNT)
+    {
+        uint32_t vaddr = kmap_base + slot * PG_SIZE;
+
+        pfree(addr_v2p(vaddr));
+        *pte_ptr(vaddr) = 0;
+        kmap_tlb_flush(vaddr);
+
+        slot++;
+    }
+
+    put_str("  kmap_init done\n");
+
+    return;
+}
+
+// 返回能访问物理页框pg_phyaddr的内核地址,在直接映射区中就直接用,否则映射到窗口slot上
+void *kmap(enum kmap_slot slot, uint32_t pg_phyaddr)
+{
+    ASSERT(slot < KMAP_SLOT_CNT && pg_phyaddr % PG_SIZE == 0);
+
+    void *kaddr = phy2kaddr(pg_phyaddr);
+
+    if (kaddr != NULL)
+    {
+        return kaddr;
+    }
+
+    uint32_t vaddr = kmap_base + slot * PG_SIZE;
+    ASSERT(!(*pte_ptr(vaddr) & PG_P_1));
+
+    *pte_ptr(vaddr) = pg_phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+    kmap_tlb_flush(vaddr);
+
+    return (void *)vaddr;
+}
+
+// 用完kmap返回的地址kaddr,用的是窗口时去掉窗口的映射
+void kunmap(enum kmap_slot slot, void *kaddr)
+{
+    uint32_t vaddr = kmap_base + slot * PG_SIZE;
+
+    if ((uint32_t)kaddr != vaddr)
+    {
+        return;
+    }
+
+    *pte_ptr(vaddr) = 0;
+    kmap_tlb_flush(vaddr);
+
+    return;
+}
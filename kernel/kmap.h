@@ -0,0 +1,33 @@
+#ifndef __KERNEL_KMAP_H
+#define __KERNEL_KMAP_H
+#include "stdint.h"
+
+/**
+ * @brief
+ * 临时映射任意物理页框用的固定窗口,每种用途一个,同一时刻只能有一个地方使用同一个窗口:
+ * KMAP_ZERO      idle线程预先清0页框
+ * KMAP_SWAP_PT   换页时扫描别的进程的页表,关中断时使用
+ * KMAP_SWAP_DATA 换出换入时读写页框,持有swap_lock时使用,期间可以睡眠
+ * KMAP_COPY      跨地址空间复制,如fork时填子进程的页表,关中断时使用
+ * KMAP_MIGRATE   内存规整时迁移页框的目标页,和KMAP_COPY(源页)、KMAP_SWAP_PT(页表)一起在关中断时使用
+ */
+enum kmap_slot
+{
+    KMAP_ZERO,
+    KMAP_SWAP_PT,
+    KMAP_SWAP_DATA,
+    KMAP_COPY,
+    KMAP_MIGRATE,
+    KMAP_SLOT_CNT
+};
+
+// 预留各窗口的内核虚拟地址,在内存池初始化之后调用
+void kmap_init(void);
+
+// 返回能访问物理页框pg_phyaddr的内核地址,在直接映射区中就直接用,否则映射到窗口slot上
+void *kmap(enum kmap_slot slot, uint32_t pg_phyaddr);
+
+// 用完kmap返回的地址kaddr,用的是窗口时去掉窗口的映射
+void kunmap(enum kmap_slot slot, void *kaddr);
+
+#endif // __KERNEL_KMAP_H
@@ -0,0 +1,390 @@
+#include "kmprof.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "../lib/string.h"
+#include "../lib/kernel/list.h"
+#include "../lib/kernel/stdio-kernel.h"
+#include "../thread/thread.h"
+#include "../thread/sync.h"
+
+/**
+ * @brief
+ * 内核堆分配剖析(kmprof)
+ *
+ * 每个还活着的内核堆分配对应一条记录,按地址散列到KMPROF_HASH_SIZE个桶中,sys_free时按地址找到删掉。
+ * 记录从初始化时一次分配好的记录表中取,不再走sys_malloc,避免剖析自己的分配。
+ * 记录表用完后新的分配不再记录,只计数,kmprof命令中显示为untracked。
+ * 记录表的增删都在关中断下进行,sys_malloc和sys_free可能在任意内核线程中被调用
+ */
+#ifdef KMALLOC_PROF
+
+#define KMPROF_REC_MAX   2048     // 最多同时记录的分配数
+#define KMPROF_HASH_SIZE 256      // 散列桶数,必须是2的幂
+#define KMPROF_SUM_MAX   64       // 汇总时最多区分的调用点数和任务数,多出来的算作其他
+#define KMPROF_TOP       10       // 打印占用最多的前几个调用点和任务
+
+// 一次还活着的内核堆分配
+struct kmprof_rec
+{
+    void              *ptr;          // sys_malloc返回的地址
+    uint32_t           size;         // 请求的字节数
+    uint32_t           block_size;   // 实际占用的字节数,小块是规格大小,大块是整个arena
+    void              *site;         // 调用者的返回地址
+    pid_t              pid;          // 申请时的任务
+    struct kmprof_rec *next;         // 同一散列桶或空闲记录链表中的下一条
+};
+
+// 按调用点或任务汇总的结果
+struct kmprof_sum
+{
+    uint32_t key;                    // 调用点地址或pid
+    uint32_t cnt;                    // 分配数
+    uint32_t bytes;                  // 实际占用的字节数
+};
+
+static struct kmprof_rec *rec_table;                       // 记录表,kmprof_init之前为NULL
+static struct kmprof_rec *rec_free;                        // 空闲记录链表
+static struct kmprof_rec *rec_hash[KMPROF_HASH_SIZE];
+static uint32_t           rec_dropped;                     // 没有记录下来的分配数
+
+static struct lock        dump_lock;                       // 同一时刻只有一个任务在汇总和打印
+static struct kmprof_sum  site_sums[KMPROF_SUM_MAX];
+static struct kmprof_sum  task_sums[KMPROF_SUM_MAX];
+
+// 地址ptr所在的散列桶,内存块至少16字节对齐,去掉低4位
+static struct kmprof_rec **rec_bucket(void *ptr)
+{
+    return &rec_hash[((uint32_t)ptr >> 4) & (KMPROF_HASH_SIZE - 1)];
+}
+
+// 返回指向ptr记录的指针的地址,便于删除,没有记录时返回NULL,调用时已关中断
+static struct kmprof_rec **rec_find(void *ptr)
+{
+    struct kmprof_rec **link = rec_bucket(ptr);
+
+    while (*link != NULL)
+    {
+        if ((*link)->ptr == ptr)
+        {
+            return link;
+        }
+
+        link = &(*link)->next;
+    }
+
+    return NULL;
+}
+
+// 分配记录表,在内存池初始化之后调用,之前的分配不记录
+void kmprof_init(void)
+{
+    uint32_t pg_cnt = DIV_ROUND_UP(KMPROF_REC_MAX * sizeof(struct kmprof_rec), PG_SIZE);
+    struct kmprof_rec *table = get_kernel_pages(pg_cnt);
+
+    ASSERT(table != NULL);
+    lock_init(&dump_lock);
+
+    uint32_t idx = KMPROF_REC_MAX;
+    while (idx > 0)
+    {
+        idx--;
+        table[idx].next = rec_free;
+        rec_free        = &table[idx];
+    }
+
+    rec_table = table;
+
+    return;
+}
+
+// 记录一次内核堆分配,size是请求的字节数,block_size是实际占用的字节数
+void kmprof_alloc(void *ptr, uint32_t size, uint32_t block_size, void *site)
+{
+    enum intr_status old_status = intr_disable();
+
+    if (rec_table == NULL || rec_free == NULL)
+    {
+        rec_dropped++;
+        intr_set_status(old_status);
+        return;
+    }
+
+    struct kmprof_rec *rec   = rec_free;
+    struct kmprof_rec **link = rec_bucket(ptr);
+
+    rec_free        = rec->next;
+    rec->ptr        = ptr;
+    rec->size       = size;
+    rec->block_size = block_size;
+    rec->site       = site;
+    rec->pid        = running_thread()->pid;
+    rec->next       = *link;
+    *link           = rec;
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 删掉ptr的记录,没有记录的是记录表满时或初始化之前分配的
+void kmprof_free(void *ptr)
+{
+    enum intr_status old_status = intr_disable();
+    struct kmprof_rec **link    = rec_find(ptr);
+
+    if (link != NULL)
+    {
+        struct kmprof_rec *rec = *link;
+
+        *link     = rec->next;
+        rec->next = rec_free;
+        rec_free  = rec;
+    }
+    else if (rec_dropped > 0)
+    {
+        rec_dropped--;
+    }
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// ptr被原地调整了大小,更新记录中的请求大小和占用大小
+void kmprof_resize(void *ptr, uint32_t size, uint32_t block_size)
+{
+    enum intr_status old_status = intr_disable();
+    struct kmprof_rec **link    = rec_find(ptr);
+
+    if (link != NULL)
+    {
+        (*link)->size       = size;
+        (*link)->block_size = block_size;
+    }
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 把ptr的调用点改为site
+void kmprof_retag(void *ptr, void *site)
+{
+    enum intr_status old_status = intr_disable();
+    struct kmprof_rec **link    = rec_find(ptr);
+
+    if (link != NULL)
+    {
+        (*link)->site = site;
+    }
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 把一次分配计入sums中key的汇总,sums满了就计入最后一项,最后一项的key为0表示其他
+static void sum_add(struct kmprof_sum *sums, uint32_t key, uint32_t bytes)
+{
+    uint32_t idx = 0;
+
+    while (idx < KMPROF_SUM_MAX - 1 && sums[idx].cnt > 0 && sums[idx].key != key)
+    {
+        idx++;
+    }
+
+    if (idx == KMPROF_SUM_MAX - 1)
+    {
+        key = 0;
+    }
+
+    sums[idx].key    = key;
+    sums[idx].cnt   += 1;
+    sums[idx].bytes += bytes;
+
+    return;
+}
+
+// 取出sums中占用字节最多的一项,取出后清掉,没有了返回NULL
+static struct kmprof_sum *sum_pop_max(struct kmprof_sum *sums, struct kmprof_sum *out)
+{
+    struct kmprof_sum *max = NULL;
+    uint32_t idx           = 0;
+
+    while (idx < KMPROF_SUM_MAX)
+    {
+        if (sums[idx].cnt > 0 && (max == NULL || sums[idx].bytes > max->bytes))
+        {
+            max = &sums[idx];
+        }
+
+        idx++;
+    }
+
+    if (max == NULL)
+    {
+        return NULL;
+    }
+
+    *out     = *max;
+    max->cnt = 0;
+
+    return out;
+}
+
+// 打印内核堆中占用最多的调用点和任务,以及各规格内存块的碎片情况
+void sys_kmprof(void)
+{
+    uint32_t live[DESC_CNT + 1];        // 最后一项是大块
+    uint32_t requested[DESC_CNT + 1];
+    uint32_t held[DESC_CNT + 1];
+    uint32_t free_cnt[DESC_CNT];
+    uint32_t total_live = 0, total_requested = 0, total_held = 0, dropped;
+
+    if (rec_table == NULL)
+    {
+        printk("kmprof: record table not initialized\n");
+        return;
+    }
+
+    lock_acquire(&dump_lock);
+
+    memset(site_sums, 0, sizeof(site_sums));
+    memset(task_sums, 0, sizeof(task_sums));
+    memset(live, 0, sizeof(live));
+    memset(requested, 0, sizeof(requested));
+    memset(held, 0, sizeof(held));
+    memset(free_cnt, 0, sizeof(free_cnt));
+
+    // 1 关中断遍历记录表,汇总到静态数组中,之后再打印
+    enum intr_status old_status = intr_disable();
+
+    uint32_t bucket = 0;
+    while (bucket < KMPROF_HASH_SIZE)
+    {
+        struct kmprof_rec *rec = rec_hash[bucket];
+
+        while (rec != NULL)
+        {
+            uint32_t desc_idx = 0;
+            while (desc_idx < DESC_CNT && rec->block_size != k_block_descs[desc_idx].block_size)
+            {
+                desc_idx++;
+            }
+
+            live[desc_idx]++;
+            requested[desc_idx] += rec->size;
+            held[desc_idx]      += rec->block_size;
+
+            sum_add(site_sums, (uint32_t)rec->site, rec->block_size);
+            sum_add(task_sums, rec->pid, rec->block_size);
+
+            rec = rec->next;
+        }
+
+        bucket++;
+    }
+
+    // 2 空闲的小块有的在各规格的free_list中,有的在内核线程自己的缓存中
+    uint32_t desc_idx = 0;
+    while (desc_idx < DESC_CNT)
+    {
+        free_cnt[desc_idx] = list_len(&k_block_descs[desc_idx].free_list);
+        desc_idx++;
+    }
+
+    struct list_elem *elem = thread_all_list.head.next;
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *t = elem2entry(struct task_struct, all_list_tag, elem);
+
+        if (t->pgdir == NULL)
+        {
+            desc_idx = 0;
+            while (desc_idx < DESC_CNT)
+            {
+                free_cnt[desc_idx] += t->mags[desc_idx].cnt;
+                desc_idx++;
+            }
+        }
+
+        elem = elem->next;
+    }
+
+    dropped = rec_dropped;
+
+    intr_set_status(old_status);
+
+    // 3 打印
+    desc_idx = 0;
+    while (desc_idx <= DESC_CNT)
+    {
+        total_live      += live[desc_idx];
+        total_requested += requested[desc_idx];
+        total_held      += held[desc_idx];
+        desc_idx++;
+    }
+
+    printk("kmprof: %d live allocations, %d bytes requested, %d bytes held, %d untracked\n",
+           total_live, total_requested, total_held, dropped);
+
+    struct kmprof_sum top;
+    uint32_t rank = 0;
+
+    printk("top call sites:\n");
+    while (rank < KMPROF_TOP && sum_pop_max(site_sums, &top) != NULL)
+    {
+        if (top.key == 0)
+        {
+            printk("  other   : %d allocs, %d bytes\n", top.cnt, top.bytes);
+        }
+        else
+        {
+            printk("  %x: %d allocs, %d bytes\n", top.key, top.cnt, top.bytes);
+        }
+
+        rank++;
+    }
+
+    rank = 0;
+    printk("top tasks:\n");
+    while (rank < KMPROF_TOP && sum_pop_max(task_sums, &top) != NULL)
+    {
+        struct task_struct *t = pid2thread(top.key);
+
+        printk("  pid %d %s: %d allocs, %d bytes\n", top.key, t != NULL ? t->name : "(exited)", top.cnt, top.bytes);
+        rank++;
+    }
+
+    // 浪费是已分配块中没用到的部分,空闲块占比高说明arena被零散占用而还不回去
+    printk("size classes:\n");
+    desc_idx = 0;
+    while (desc_idx < DESC_CNT)
+    {
+        printk("  %d: live %d, free %d/%d, requested %d, wasted %d\n",
+               k_block_descs[desc_idx].block_size, live[desc_idx], free_cnt[desc_idx],
+               live[desc_idx] + free_cnt[desc_idx], requested[desc_idx], held[desc_idx] - requested[desc_idx]);
+        desc_idx++;
+    }
+
+    printk("  large: live %d, pages %d, requested %d, wasted %d\n",
+           live[DESC_CNT], held[DESC_CNT] / PG_SIZE, requested[DESC_CNT], held[DESC_CNT] - requested[DESC_CNT]);
+
+    lock_release(&dump_lock);
+
+    return;
+}
+
+#else
+
+// 打印内核堆中占用最多的调用点和任务,以及各规格内存块的碎片情况
+void sys_kmprof(void)
+{
+    printk("kmprof: not compiled in, build the kernel with -D KMALLOC_PROF\n");
+
+    return;
+}
+
+#endif // KMALLOC_PROF
@@ -0,0 +1,46 @@
+#ifndef __KERNEL_KMPROF_H
+#define __KERNEL_KMPROF_H
+#include "stdint.h"
+
+/**
+ * @brief
+ * 内核堆分配剖析,编译时加-D KMALLOC_PROF才打开。
+ * 打开后内核线程每次sys_malloc成功都记下请求的大小、实际占用的大小、调用者的返回地址和所属任务,
+ * sys_free时删掉记录,kmprof命令按调用点和任务汇总还活着的分配,并打印各规格内存块的碎片情况。
+ * 没打开时下面的钩子都是空宏,sys_malloc和sys_free中不会多出任何代码
+ */
+#ifdef KMALLOC_PROF
+
+// 调用当前函数的返回地址,作为分配的调用点
+#define KMPROF_SITE() __builtin_return_address(0)
+
+// 分配记录表,在内存池初始化之后调用,之前的分配不记录
+void kmprof_init(void);
+
+// 记录一次内核堆分配,size是请求的字节数,block_size是实际占用的字节数
+void kmprof_alloc(void *ptr, uint32_t size, uint32_t block_size, void *site);
+
+// 删掉ptr的记录
+void kmprof_free(void *ptr);
+
+// ptr被原地调整了大小,更新记录中的请求大小和占用大小
+void kmprof_resize(void *ptr, uint32_t size, uint32_t block_size);
+
+// 把ptr的调用点改为site,sys_calloc和sys_realloc内部调用sys_malloc后用来记到真正的调用者上
+void kmprof_retag(void *ptr, void *site);
+
+#else
+
+#define KMPROF_SITE()                              NULL
+#define kmprof_init()                              ((void)0)
+#define kmprof_alloc(ptr, size, block_size, site)  ((void)0)
+#define kmprof_free(ptr)                           ((void)0)
+#define kmprof_resize(ptr, size, block_size)       ((void)0)
+#define kmprof_retag(ptr, site)                    ((void)0)
+
+#endif // KMALLOC_PROF
+
+// 打印内核堆中占用最多的调用点和任务,以及各规格内存块的碎片情况
+void sys_kmprof(void);
+
+#endif // __KERNEL_KMPROF_H
@@ -24,6 +24,18 @@ int main(void)
 
     init_all();
 
+#ifdef BUDDY_BENCH
+    mem_bench();        // 编译时加上-D BUDDY_BENCH才会运行伙伴系统的基准测试
+#endif
+
+#ifdef SWITCH_BENCH
+    switch_bench();     // 编译时加上-D SWITCH_BENCH才会运行任务切换的基准测试
+#endif
+
+#ifdef MALLOC_BENCH
+    malloc_bench();     // 编译时加上-D MALLOC_BENCH才会运行sys_malloc的基准测试
+#endif
+
 //------------------------------------------------------------------------------------------
 /**
  * @brief 
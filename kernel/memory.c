@@ -1,4 +1,13 @@
 #include "../kernel/memory.h"
+#include "../kernel/buddy.h"
+#include "../kernel/slab.h"
+#include "../kernel/fault.h"
+#include "../kernel/vma.h"
+#include "../kernel/swap.h"
+#include "../kernel/kmap.h"
+#include "../kernel/kmprof.h"
+#include "../userprog/process.h"
+#include "../fs/page-cache.h"
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../lib/stdint.h"
@@ -7,28 +16,39 @@
 #include "../lib/kernel/bitmap.h"
 #include "../thread/sync.h"             // 保证进程空间的互斥性
 #include "interrupt.h"
+#include "../lib/kernel/stdio-kernel.h"
+#ifdef MALLOC_BENCH
+#include "../lib/kernel/io.h"
+#endif
   
 
-#define MEM_BITMAP_BASE 0xc009a000      // 位图地址
+#define MEM_BITMAP_BASE 0xc009a000      // 内核虚拟地址位图的地址
+#define CPUID_PGE       0x00002000      // cpuid 1号功能edx的第13位,为1表示支持全局页
+#define CR4_PGE         0x00000080      // CR4的第7位,为1时页表项的G位才生效
+#define CPUID_PSE       0x00000008      // cpuid 1号功能edx的第3位,为1表示支持4M的大页
+#define CR4_PSE         0x00000010      // CR4的第4位,为1时页目录项的PS位才生效
+#define ARDS_BUF        0xc0000b0a      // loader保存e820内存布局的缓冲区ards_buf,经高端映射访问
+#define ARDS_NR         0xc0000bfe      // loader保存的ARDS个数ards_nr,2字节
+#define ARDS_MAX        12              // ards_buf共244字节,最多放12个20字节的ARDS
+#define ARDS_USABLE     1               // type为1的内存可以给操作系统使用,其余的是保留区
+#define KERNEL_POOL_MAX 0x10000000      // 内核内存池最多跨256M,要落在内核堆和直接映射区之内
 
 /**
- * 
- * #define  PG_SIZE 4096
- * #define  K_HEAP_START 0x009a000  中0x009a00
- * 
- * 这两个东西的解释
- * 因为0xc009f000是内核主线程栈顶，0xc009e000是内核主线程的pcb,一个页框大小的位图可表示128M内存, 位图位置安排在地址0xc009a000,
- * 这样本系统最大支持4个页框的位图,即512M
- * 
- * 说白了就是为main预留了PCB空间
- * 
- * 内核预计在70KB左右，转载到0xc009f000以下是绰绰有余的，所以主线程的栈地址0xc009f000是我们在低端1MB中所用的最高地址
- * 
- * 当前虚拟机配置了32MB的物理内存，这32MB物理内存需要1024字节的位图，也就是仅占四分之1页，
- * 1页大小的位图可管理 128MB的内存 对于目前的 32MB 内存来说，用一页内存来存储位图还浪费呢，
- * 不过为了扩展，在此打算支持4页内存的位图，即最大可管理512MB的物理内存
- * 
- * 0xc009e000 - 0x1000*4 = 0xc009a000
+ * @brief
+ * 内存布局
+ *
+ * 低端1M:    loader把kernel.bin读到0x70000,再按程序头把各段放到0xc0001500起;
+ *            0xc009a000起的4页是内核虚拟地址池的位图(MEM_BITMAP_BASE),
+ *            0xc009e000是主线程的pcb,0xc009f000是主线程的栈顶,内核映像不能碰到位图
+ * 1M起:      loader建好的页目录表和页表,共256个页框
+ * 页表之后:  每个物理页框一个struct page描述符,个数按e820给出的最高可用地址算,
+ *            空洞中的页框也有描述符,映射在内核堆的起始处K_HEAP_START
+ * 其余:      可用页框对半分给内核和用户两个内存池,由伙伴系统管理,
+ *            内核内存池最多跨KERNEL_POOL_MAX,两个池可以按水位互相借页框
+ *
+ * 内核堆从K_HEAP_START开始,覆盖描述符数组和内核内存池,不能伸到直接映射区DIRECT_MAP_BASE。
+ * 4页的位图可以表示512M的内核堆,足够覆盖这个范围。物理内存本身从0开始直接映射到DIRECT_MAP_BASE,
+ * slab、页缓存等只需要页框的内核对象从直接映射区取,不占内核堆的虚拟地址
  */
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)     // 用于返回虚拟地址的高10位，即pde索引部分
@@ -41,12 +61,40 @@
 // 内存池结构,生成两个实例用于管理内核内存池和用户内存池
 struct pool
 {
-    struct bitmap pool_bitmap;     // 本内存池用到的位图结构,用于管理物理内存
+    struct buddy_zone zone;        // 本内存池用到的伙伴系统,用于管理物理内存
 
     uint32_t phy_addr_start;       // 本内存池所管理物理内存的起始地址
     uint32_t pool_size;            // 本内存池字节容量
 
     struct lock lock;              // 申请内存的时候保持互斥
+
+    // 预先清0的页框,由idle线程在空闲时补充,需要清0的页优先从这里拿
+    struct list zero_list;         // 页框描述符的free_elem挂在这里
+    uint32_t    zero_cnt;          // zero_list中的页框数
+    uint32_t    zero_hit;          // 需要清0的页从zero_list拿到的次数
+    uint32_t    zero_miss;         // zero_list为空,只能现场清0的次数
+
+    // 两个内存池之间互相借页框,页框所属的内存池按物理地址区分,用途看PG_USER
+    uint32_t wmark_min;            // 最低水位,空闲页框不多于它时不再借给另一方
+    uint32_t borrow_max;           // 本方最多向另一方借的页框数
+    uint32_t borrowed;             // 本方当前从另一方借来的页框数
+};
+
+// BIOS 0x15中断0xe820子功能返回的地址范围描述符(ARDS)
+struct ards
+{
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t len_low;
+    uint32_t len_high;
+    uint32_t type;
+};
+
+// 一段可用的物理内存[start, end),两端都按页对齐
+struct mem_range
+{
+    uint32_t start;
+    uint32_t end;
 };
 
 // 内存仓库arena元信息
@@ -68,6 +116,19 @@ struct mem_block_desc k_block_descs[DESC_CNT];     // 内核内存块描述符
 struct pool kernel_pool, user_pool;                // 生成内核内存池和用户内存池
 struct virtual_addr kernel_vaddr;                  // 此结构是用来给内核分配虚拟地址
 
+static bool     pge_supported;                     // cpu是否支持全局页
+static uint32_t direct_map_size;                   // 从物理地址0开始直接映射了多少字节
+static bool     mag_enabled = true;                // sys_malloc和sys_free是否使用线程自己的内存块缓存
+static uint32_t zero_page_phyaddr;                 // 全局零页的物理地址
+
+// 内存规整的统计
+static uint32_t compact_runs;                      // 规整的次数
+static uint32_t compact_success;                   // 规整出连续块的次数
+static uint32_t compact_migrated;                  // 迁移过的页框数
+
+static struct mem_range mem_ranges[ARDS_MAX];      // 4G以下的可用物理内存,按地址排序且互不相邻
+static uint32_t         mem_range_cnt;
+
 // 在pf表示的虚拟内存池中申请pg_cnt个虚拟页,成功则返回虚拟页的起始地址, 失败则返回NULL
 static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
 {
@@ -75,8 +136,6 @@ static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
     int vaddr_start   = 0;   
     // 用于存储位图扫描函数bitmap_scan的返回值，默认值位-1
     int bit_idx_start = -1;
-    
-    uint32_t cnt = 0;
 
     if (pf == PF_KERNEL) // 如果其值等于PF_KERNEL,便认为是在内核虚拟地址池申请地址
     {
@@ -88,34 +147,22 @@ static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
             return NULL;
         }
 
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        }
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 1);
 
         vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
     }
     else // 用户态进程内存池
     { 
 
+        // 用户进程的地址空间由区域树管理,找一段空隙加为匿名区域
         struct task_struct *cur = running_thread();
-        bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
+        vaddr_start = vma_get_unmapped(&cur->vmas, pg_cnt);
 
-        if (bit_idx_start == -1)
+        if (vaddr_start == 0 || !vma_map(&cur->vmas, vaddr_start, pg_cnt, VM_READ | VM_WRITE, VMA_ANON))
         {
             return NULL;
         }
 
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 1);
-        }
-
-        vaddr_start = cur->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-
-        // (0xc0000000 - PG_SIZE)做为用户3级栈已经在start_process被分配
-        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
-
     } // end if
 
     return (void *)vaddr_start;
@@ -159,21 +206,162 @@ uint32_t *pde_ptr(uint32_t vaddr)
     return pde;
 }
 
-// 在m_pool指向的物理内存池中分配1个物理页,成功则返回页框的物理地址,失败则返回NULL
+// 从m_pool的预清0页框中取出一页,没有则返回NULL
+static struct page *zero_list_pop(struct pool *m_pool)
+{
+    struct page *pg             = NULL;
+    enum intr_status old_status = intr_disable();
+
+    if (!list_empty(&m_pool->zero_list))
+    {
+        pg = elem2entry(struct page, free_elem, list_pop(&m_pool->zero_list));
+        m_pool->zero_cnt--;
+    }
+
+    intr_set_status(old_status);
+
+    return pg;
+}
+
+/**
+ * @brief
+ * m_pool自己的页框用完时向另一个内存池借一页,*owner返回页框所属的内存池。
+ * 借完后对方的空闲页框不能低于它的最低水位,留给对方自己用,本方借的总数也不超过borrow_max。
+ * 内核缓存多的时候内核可以用一部分空闲的用户内存,大程序也可以用一部分空闲的内核内存
+ */
+static struct page *pool_borrow(struct pool *m_pool, struct pool **owner)
+{
+    struct pool *other          = m_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    struct page *pg             = NULL;
+    enum intr_status old_status = intr_disable();
+
+    if (m_pool->borrowed < m_pool->borrow_max && other->zone.free_pages > other->wmark_min)
+    {
+        pg = buddy_alloc(&other->zone, 0);
+
+        if (pg != NULL)
+        {
+            m_pool->borrowed++;
+        }
+    }
+
+    intr_set_status(old_status);
+    *owner = other;
+
+    return pg;
+}
+
+// 从owner中分到的页框pg记下是分给m_pool一方的,返回页框的物理地址
+static void *page_take(struct pool *m_pool, struct pool *owner, struct page *pg)
+{
+    if (m_pool == &user_pool)
+    {
+        pg->flags |= PG_USER;
+    }
+
+    return (void *)page2phy(&owner->zone, pg);
+}
+
+/**
+ * @brief
+ * 为m_pool一方分配1个物理页,成功则返回页框的物理地址,失败则返回NULL。
+ * 依次尝试:自己的伙伴系统、自己预先清0的页框、向另一个内存池借,
+ * 用户一方最后还可以把不常用的用户页换出到交换分区再试
+ */
 static void *palloc(struct pool *m_pool)
 {
-    // 扫描或设置位图要保证原子操作
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1);     // 找一个物理页面
+    struct pool *owner = m_pool;
+
+    // 伙伴系统内部关中断保证原子操作
+    struct page *pg = buddy_alloc(&m_pool->zone, 0);     // 找一个物理页面
+
+    // 伙伴系统分不出来时,预先清0的页框也能用
+    if (pg == NULL)
+    {
+        pg = zero_list_pop(m_pool);
+    }
+
+    // 另一方还有空闲的页框时先借,比换页快得多
+    if (pg == NULL)
+    {
+        pg = pool_borrow(m_pool, &owner);
+    }
+
+    // 用户内存池用完了,把不常用的用户页换出到交换分区再试
+    while (pg == NULL && m_pool == &user_pool && swap_reclaim(SWAP_BATCH) > 0)
+    {
+        owner = m_pool;
+        pg    = buddy_alloc(&m_pool->zone, 0);
+    }
+
+    if (pg == NULL)
+    {
+        return NULL;
+    }
+
+    return page_take(m_pool, owner, pg);
+}
+
+// 在m_pool中分配1个要清0的物理页,优先用预先清0的页框,*zeroed返回页框是否已经清0,失败返回NULL
+static void *palloc_zeroed(struct pool *m_pool, bool *zeroed)
+{
+    struct page *pg = zero_list_pop(m_pool);
+
+    if (pg != NULL)
+    {
+        m_pool->zero_hit++;
+        *zeroed = true;
+
+        return page_take(m_pool, m_pool, pg);
+    }
+
+    m_pool->zero_miss++;
+    *zeroed = false;
+
+    return palloc(m_pool);
+}
+
+// 为vaddr所在的页目录项创建一个空页表,返回vaddr对应的pte指针,失败返回NULL
+uint32_t *page_table_create(uint32_t vaddr)
+{
+    uint32_t *pde = pde_ptr(vaddr);
+    uint32_t *pte = pte_ptr(vaddr);
+
+    ASSERT(!(*pde & 0x00000001));
 
-    if (bit_idx == -1)
+    // 页表中用到的页框一律从内核空间分配
+    bool zeroed          = false;
+    uint32_t pde_phyaddr = (uint32_t)palloc_zeroed(&kernel_pool, &zeroed);
+
+    if (pde_phyaddr == 0)
     {
         return NULL;
     }
 
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1);          // 将此位bit_idx置1
-    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
+    *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+
+    // 用户空间的页表算在当前进程的页数中
+    if (vaddr < 0xc0000000)
+    {
+        running_thread()->mem.pt_pages++;
+    }
+
+    /**
+     * @brief 
+     * 
+     * 分配到的物理页地址pde_phyaddr对应的物理内存清0, 避免里面的陈旧数据变成了页表项,从而让页表混乱.
+     * 访问到pde对应的物理地址,用pte取高20位便可, 因为pte是基于该pde对应的物理地址内再寻址,
+     * 把低12位置0便是该pde对应的物理页的起始
+     * 
+     */
+
+    // 对刚刚申请的物理页初始化为0,预先清0的页框就不用了
+    if (!zeroed)
+    {
+        memset((void *)((int)pte & 0xfffff000), 0, PG_SIZE);
+    }
 
-    return (void *)page_phyaddr;
+    return pte;
 }
 
 // 页表中添加虚拟地址_vaddr与物理地址_page_phyaddr的映射
@@ -182,6 +370,7 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
     uint32_t vaddr        = (uint32_t)_vaddr;
     uint32_t page_phyaddr = (uint32_t)_page_phyaddr;
     uint32_t *pde         = pde_ptr(vaddr);      // 获取虚拟地址addr所在的pde的的虚拟地址
+    uint32_t global       = vaddr >= 0xc0000000 ? PG_GLOBAL : 0;   // 内核部分的映射所有进程都一样,设为全局页
 
     // 虚拟地址和物理地址的映射关系是在页表中完成的，本质上在页表中添加次虚拟地址对应的页表项pte
     // 并将物理页的物理地址写入此页表项pte中
@@ -203,47 +392,105 @@ static void page_table_add(void *_vaddr, void *_page_phyaddr)
         // 只要是创建页表,pte就应该不存在
         if (!(*pte & 0x00000001))
         {
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1,RW=1,P=1
+            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1 | global); // US=1,RW=1,P=1
         }
         else
         {
 
             //应该不会执行到这，因为上面的ASSERT会先执行。
             PANIC("pte repeat");
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1,RW=1,P=1
+            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1 | global); // US=1,RW=1,P=1
         }
 
     }
     else
     {   // 页目录项不存在,所以要先创建页目录再创建页表项.
 
-        // 页表中用到的页框一律从内核空间分配
-        uint32_t pde_phyaddr = (uint32_t)palloc(&kernel_pool);
-
-        *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
-
-        /**
-         * @brief 
-         * 
-         * 分配到的物理页地址pde_phyaddr对应的物理内存清0, 避免里面的陈旧数据变成了页表项,从而让页表混乱.
-         * 访问到pde对应的物理地址,用pte取高20位便可, 因为pte是基于该pde对应的物理地址内再寻址,
-         * 把低12位置0便是该pde对应的物理页的起始
-         * 
-         */
-
-        // 对刚刚申请的物理页初始化为0
-        memset((void *)((int)pte & 0xfffff000), 0, PG_SIZE);
+        page_table_create(vaddr);
 
         ASSERT(!(*pte & 0x00000001));
 
         // 为vaddr所在的pte进行赋值
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1); // US=1,RW=1,P=1
+        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1 | global); // US=1,RW=1,P=1
 
     } // end if
 
+    // 共享的零页不计入驻留页数
+    if (vaddr < 0xc0000000 && page_phyaddr != zero_page_phyaddr)
+    {
+        mem_rss_add(running_thread(), 1);
+    }
+
+    return ;
+}
+
+// 将虚拟地址vaddr映射到物理页框pg_phyaddr,vaddr原来必须没有映射
+void page_map(uint32_t vaddr, uint32_t pg_phyaddr)
+{
+    page_table_add((void *)vaddr, (void *)pg_phyaddr);
+
+    return ;
+}
+
+// 虚拟地址vaddr所在的页是否已经映射了物理页框
+bool page_present(uint32_t vaddr)
+{
+    // pde不存在时不能访问pte,否则会引发缺页异常
+    return (*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_P_1);
+}
+
+// 把别处还持有着的页框pg_phyaddr也映射到用户页vaddr,页框的引用计数加1,cow为true时写这一页会先复制一份
+void page_map_shared(uint32_t vaddr, uint32_t pg_phyaddr, bool cow)
+{
+    page_ref_inc(pg_phyaddr);
+    page_map(vaddr, pg_phyaddr);
+
+    if (cow)
+    {
+        uint32_t *pte = pte_ptr(vaddr);
+        *pte          = (*pte & ~PG_RW_W) | PG_COW;
+    }
+
+    return ;
+}
+
+// 设置已映射的用户页vaddr是否可写,写时复制的页保持只读,由缺页异常处理
+void page_set_writable(uint32_t vaddr, bool writable)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    ASSERT(page_present(vaddr));
+
+    if (*pte & PG_COW)
+    {
+        return ;
+    }
+
+    *pte = writable ? (*pte | PG_RW_W) : (*pte & ~PG_RW_W);
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory");
+
     return ;
 }
 
+// 已映射的页vaddr自上次调用以来是否被写过,返回前清除页表项的D位
+bool page_test_clean(uint32_t vaddr)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    ASSERT(page_present(vaddr));
+
+    if (!(*pte & PG_DIRTY))
+    {
+        return false;
+    }
+
+    // D位由cpu在写的时候置1,tlb中缓存的页表项也要失效,下次写才会重新置位
+    *pte &= ~PG_DIRTY;
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory");
+
+    return true;
+}
+
 // 分配pg_cnt个页空间,成功则返回起始虚拟地址,失败时返回NULL
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
 {
@@ -270,6 +517,36 @@ void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
     uint32_t vaddr        = (uint32_t)vaddr_start, cnt = pg_cnt;
     struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
 
+    // 多页申请先尝试从伙伴系统拿一整块物理上连续的页框,避免把大块拆成零散的单页
+    uint32_t order = buddy_order(pg_cnt);
+    struct page *block = NULL;
+
+    if (pg_cnt > 1 && order < BUDDY_MAX_ORDER)
+    {
+        block = buddy_alloc(&mem_pool->zone, order);
+    }
+
+    if (block != NULL)
+    {
+        // 块中多出来的尾部页框逐个还回伙伴系统,这样每一页之后都能单独用pfree释放
+        uint32_t pg_idx = pg_cnt;
+        while (pg_idx < (1U << order))
+        {
+            buddy_free(&mem_pool->zone, block + pg_idx, 0);
+            pg_idx++;
+        }
+
+        pg_idx = 0;
+        while (pg_idx < pg_cnt)
+        {
+            page_table_add((void *)vaddr, (void *)page2phy(&mem_pool->zone, block + pg_idx));
+            vaddr += PG_SIZE;
+            pg_idx++;
+        }
+
+        return vaddr_start;
+    }
+
     // 因为虚拟地址是连续的,但物理地址可以是不连续的,所以逐个做映射
     while (cnt-- > 0)
     {
@@ -292,103 +569,163 @@ void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
     return vaddr_start;
 }
 
-// 从内核物理内存池中申请pg_cnt页内存,成功则返回其虚拟地址,失败则返回NULL
-void *get_kernel_pages(uint32_t pg_cnt)
-{
-    lock_acquire(&kernel_pool.lock);
-    void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
+static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
+static struct page *compact_alloc(uint32_t order);
 
-    if (vaddr != NULL)
+// 返回物理地址pg_phy_addr在直接映射区中的虚拟地址,超出直接映射区时返回NULL
+void *phy2kaddr(uint32_t pg_phy_addr)
+{
+    if (pg_phy_addr >= direct_map_size)
     {
-        // 若分配的地址不为空,将页框清0后返回
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
-
+        return NULL;
     }
 
-    lock_release(&kernel_pool.lock);
-
-    return vaddr;
+    return (void *)(DIRECT_MAP_BASE + pg_phy_addr);
 }
 
-// 在用户空间中申请4k内存，并返回虚地址
-void *get_user_pages(uint32_t pg_cnt)
+/**
+ * @brief
+ * 从内核物理内存池中申请物理上连续的pg_cnt页,返回其在直接映射区中的地址,页已清0,用mfree_page释放。
+ * 直接映射区用4M的大页映射,不用修改页表也不用分配内核虚拟地址,访问时占用的tlb表项也少得多,
+ * 页缓存、slab和内核的malloc这些用内存多的地方用它。
+ * 分不出连续的页框时先规整内核内存池,还不行或页框超出直接映射区时退回get_kernel_pages
+ */
+void *get_kernel_direct_pages(uint32_t pg_cnt)
 {
-    lock_acquire(&user_pool.lock);
+    ASSERT(pg_cnt > 0);
 
-    void *vaddr = malloc_page(PF_USER, pg_cnt);
-    memset(vaddr, 0, pg_cnt * PG_SIZE);
+    // 1 单页优先用预先清0的页框
+    if (pg_cnt == 1)
+    {
+        bool zeroed     = false;
+        uint32_t phy    = (uint32_t)palloc_zeroed(&kernel_pool, &zeroed);
+        void *kaddr     = phy == 0 ? NULL : phy2kaddr(phy);
 
-    lock_release(&user_pool.lock);
+        if (kaddr == NULL)
+        {
+            if (phy != 0)
+            {
+                pfree(phy);
+            }
 
-    return vaddr;
-}
+            return get_kernel_pages(1);
+        }
 
-// 将地址vaddr与pf池中的物理地址关联,仅支持一页空间分配
-void *get_a_page(enum pool_flags pf, uint32_t vaddr)
-{
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-    lock_acquire(&mem_pool->lock);
+        if (!zeroed)
+        {
+            memset(kaddr, 0, PG_SIZE);
+        }
 
-    // 先将虚拟地址对应的位图置1
-    struct task_struct *cur = running_thread();
-    int32_t bit_idx         = -1;
+        return kaddr;
+    }
+
+    // 2 多页要物理上连续,从伙伴系统拿一整块,多出来的尾部页框还回去
+    uint32_t order     = buddy_order(pg_cnt);
+    struct page *block = order < BUDDY_MAX_ORDER ? buddy_alloc(&kernel_pool.zone, order) : NULL;
 
-    // 若当前是用户进程申请用户内存,就修改用户进程自己的虚拟地址位图
-    if (cur->pgdir != NULL && pf == PF_USER)
+    // 没有够大的空闲块时,把借给用户的页框迁移走,规整出一块
+    if (block == NULL && order < BUDDY_MAX_ORDER)
     {
-        bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+        block = compact_alloc(order);
     }
-    else if (cur->pgdir == NULL && pf == PF_KERNEL)
+
+    if (block == NULL)
     {
-        // 如果是内核线程申请内核内存,就修改kernel_vaddr. 
-        bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
-        
+        return get_kernel_pages(pg_cnt);
     }
-    else
+
+    uint32_t pg_idx = pg_cnt;
+    while (pg_idx < (1U << order))
     {
-        PANIC("get_a_page:not allow kernel alloc userspace or user alloc kernelspace by get_a_page");
+        buddy_free(&kernel_pool.zone, block + pg_idx, 0);
+        pg_idx++;
     }
 
-    void *page_phyaddr = palloc(mem_pool);
+    uint32_t phy = page2phy(&kernel_pool.zone, block);
 
-    if (page_phyaddr == NULL)
+    if (phy + pg_cnt * PG_SIZE > direct_map_size)
     {
-        return NULL;
+        pg_idx = 0;
+        while (pg_idx < pg_cnt)
+        {
+            buddy_free(&kernel_pool.zone, block + pg_idx, 0);
+            pg_idx++;
+        }
+
+        return get_kernel_pages(pg_cnt);
     }
 
-    page_table_add((void *)vaddr, page_phyaddr);
-    lock_release(&mem_pool->lock);
+    memset(phy2kaddr(phy), 0, pg_cnt * PG_SIZE);
 
-    return (void *)vaddr;
+    return phy2kaddr(phy);
 }
 
-// 安装1页大小的vaddr,专门针对fork时虚拟地址位图无须操作的情况
-void *get_a_page_without_op_vaddrbitmap(enum pool_flags pf, uint32_t vaddr)
+// 在pf池中分配1页并映射,返回的页已经清0,失败时返回NULL
+static void *malloc_zeroed_page(enum pool_flags pf)
 {
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    void *vaddr = vaddr_get(pf, 1);
+
+    if (vaddr == NULL)
+    {
+        return NULL;
+    }
 
-    lock_acquire(&mem_pool->lock);
-    void *page_phyaddr = palloc(mem_pool);
+    bool zeroed        = false;
+    void *page_phyaddr = palloc_zeroed(pf & PF_KERNEL ? &kernel_pool : &user_pool, &zeroed);
 
     if (page_phyaddr == NULL)
     {
-        lock_release(&mem_pool->lock);
+        vaddr_remove(pf, vaddr, 1);
         return NULL;
     }
 
-    page_table_add((void *)vaddr, page_phyaddr);
-    lock_release(&mem_pool->lock);
+    page_table_add(vaddr, page_phyaddr);
 
-    return (void *)vaddr;
+    if (!zeroed)
+    {
+        memset(vaddr, 0, PG_SIZE);
+    }
+
+    return vaddr;
+}
+
+// 从内核物理内存池中申请pg_cnt页内存,成功则返回其虚拟地址,失败则返回NULL
+void *get_kernel_pages(uint32_t pg_cnt)
+{
+    // 单页是最常见的情况,优先用预先清0的页框
+    if (pg_cnt == 1)
+    {
+        lock_acquire(&kernel_pool.lock);
+        void *page = malloc_zeroed_page(PF_KERNEL);
+        lock_release(&kernel_pool.lock);
+
+        return page;
+    }
+
+    lock_acquire(&kernel_pool.lock);
+    void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
+
+    if (vaddr != NULL)
+    {
+        // 若分配的地址不为空,将页框清0后返回
+        memset(vaddr, 0, pg_cnt * PG_SIZE);
+
+    }
+
+    lock_release(&kernel_pool.lock);
+
+    return vaddr;
 }
 
 // 得到虚拟地址映射到的物理地址
 uint32_t addr_v2p(uint32_t vaddr)
 {
+    // 直接映射区可能是4M的大页,没有页表项,直接减去起始地址
+    if (vaddr >= DIRECT_MAP_BASE && vaddr - DIRECT_MAP_BASE < direct_map_size)
+    {
+        return vaddr - DIRECT_MAP_BASE;
+    }
+
     uint32_t *pte = pte_ptr(vaddr);
 
     // (*pte)的值是页表所在的物理页框地址,去掉其低12位的页表项属性+虚拟地址vaddr的低12位
@@ -408,54 +745,196 @@ static struct arena *block2arena(struct mem_block *b)
     return (struct arena *)((uint32_t)b & 0xfffff000);
 }
 
-// 在堆中申请size字节内存
-void *sys_malloc(uint32_t size)
+// 从desc的free_list中取一个内存块,没有空闲块时新建一个arena,调用者持有内存池的锁,失败返回NULL
+static struct mem_block *block_get(enum pool_flags PF, struct mem_block_desc *desc)
 {
-    enum pool_flags PF;
-    uint32_t pool_size;
-
-    struct pool           *mem_pool;
-    struct mem_block_desc *descs;
-    struct task_struct    *cur_thread = running_thread();
+    struct arena     *a;
+    struct mem_block *b;
 
-    // 判断用哪个内存池
-    if (cur_thread->pgdir == NULL) // 若为内核线程
+    // 若mem_block_desc的free_list中已经没有可用的mem_block,就创建新的arena提供mem_block
+    if (list_empty(&desc->free_list))
     {
-        PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
-        mem_pool = &kernel_pool;
-        descs = k_block_descs;
-    }
-    else
-    {   // 用户进程pcb中的pgdir会在为其分配页表时创建
-        PF = PF_USER;
-        pool_size = user_pool.pool_size;
-        mem_pool = &user_pool;
-        descs = cur_thread->u_block_desc;
+        // 分配1页清0的页框做为arena,内核的arena放在直接映射区
+        a = PF == PF_KERNEL ? get_kernel_direct_pages(1) : malloc_zeroed_page(PF); 
 
-    }
+        if (a == NULL)
+        {
+            return NULL;
+        }
 
-    // 若申请的内存不在内存池容量范围内则直接返回NULL
-    if (!(size > 0 && size < pool_size))
-    {
-        return NULL;
-    }
+        // 为新的arena初始化信息，这次的arena用于小内存块分配
 
-    struct arena     *a;
-    struct mem_block *b;
-    lock_acquire(&mem_pool->lock);
+        // 对于分配的小块内存,将desc置为相应内存块描述符, cnt置为此arena可用的内存块数,large置为false
+        a->desc  = desc;                         // 使desc指向上面找到的内存块描述符
+        a->large = false;
+        a->cnt   = desc->blocks_per_arena;
 
-    // 超过最大内存块1024, 就分配页框
+        uint32_t block_idx;
+
+        enum intr_status old_status = intr_disable();
+
+        //  开始将arena拆分成内存块,并添加到内存块描述符的free_list中
+        for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+        {
+            b = arena2block(a, block_idx);
+            ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
+            list_append(&a->desc->free_list, &b->free_elem);
+        }
+
+        intr_set_status(old_status);
+
+    } // end if
+
+    // 开始分配内存块
+    b = elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list));
+
+    a = block2arena(b);             // 获取内存块b所在的arena
+    a->cnt--;                       // 将此arena中的空闲内存块数减1
+
+    return b;
+}
+
+// 把内存块b还给它所在的arena,arena中的块都空闲时释放arena,调用者持有内存池的锁
+static void block_put(enum pool_flags PF, struct mem_block *b)
+{
+    struct arena *a = block2arena(b);
+
+    // 先将内存块回收到free_list
+    list_append(&a->desc->free_list, &b->free_elem);
+
+    // 再判断此arena中的内存块是否都是空闲,如果是就释放arena
+    if (++a->cnt == a->desc->blocks_per_arena)
+    {
+        uint32_t block_idx;
+        for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++)
+        {
+            struct mem_block *b = arena2block(a, block_idx);
+            ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
+            list_remove(&b->free_elem);
+        }
+
+        mfree_page(PF, a, 1);
+    }
+
+    return ;
+}
+
+// 把缓存mag中最早放进去的cnt个内存块还给arena,调用者持有内存池的锁
+static void magazine_flush(enum pool_flags PF, struct mem_magazine *mag, uint32_t cnt)
+{
+    while (cnt > 0 && mag->cnt > 0)
+    {
+        // 新放进来的块在链表头,最近用过还在cache里,从链表尾开始还
+        struct list_elem *elem = mag->blocks.tail.prev;
+        list_remove(elem);
+        mag->cnt--;
+
+        block_put(PF, elem2entry(struct mem_block, free_elem, elem));
+        cnt--;
+    }
+
+    return ;
+}
+
+// 初始化任务pthread的内存块缓存,创建任务和fork时调用
+void mem_magazine_init(struct task_struct *pthread)
+{
+    uint32_t desc_idx = 0;
+    while (desc_idx < DESC_CNT)
+    {
+        list_init(&pthread->mags[desc_idx].blocks);
+        pthread->mags[desc_idx].cnt = 0;
+        desc_idx++;
+    }
+
+    return ;
+}
+
+// 把内核线程pthread缓存的内存块都还给arena,线程退出时调用
+void mem_magazine_drain(struct task_struct *pthread)
+{
+    ASSERT(pthread->pgdir == NULL);
+
+    lock_acquire(&kernel_pool.lock);
+
+    uint32_t desc_idx = 0;
+    while (desc_idx < DESC_CNT)
+    {
+        magazine_flush(PF_KERNEL, &pthread->mags[desc_idx], MAG_SIZE);
+        desc_idx++;
+    }
+
+    lock_release(&kernel_pool.lock);
+
+    return ;
+}
+
+// 在堆中申请size字节内存
+void *sys_malloc(uint32_t size)
+{
+    enum pool_flags PF;
+    uint32_t pool_size;
+
+    struct pool           *mem_pool;
+    struct mem_block_desc *descs;
+    struct task_struct    *cur_thread = running_thread();
+
+    // 判断用哪个内存池
+    if (cur_thread->pgdir == NULL) // 若为内核线程
+    {
+        PF = PF_KERNEL;
+        pool_size = kernel_pool.pool_size;
+        mem_pool = &kernel_pool;
+        descs = k_block_descs;
+    }
+    else
+    {   // 用户进程pcb中的pgdir会在为其分配页表时创建
+        PF = PF_USER;
+        pool_size = user_pool.pool_size;
+        mem_pool = &user_pool;
+        descs = cur_thread->u_block_desc;
+
+    }
+
+    // 若申请的内存不在内存池容量范围内则直接返回NULL
+    if (!(size > 0 && size < pool_size))
+    {
+        return NULL;
+    }
+
+    struct arena     *a;
+    struct mem_block *b;
+
+    // 超过最大内存块1024, 就分配页框
     if (size > 1024)
     {
         // 向上取整需要的页框数
         uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE); 
 
-        a = malloc_page(PF, page_cnt); // 从堆中创建arena
+        if (!mem_limit_check(MEM_RES_HEAP, page_cnt * PG_SIZE))
+        {
+            return NULL;
+        }
+
+        lock_acquire(&mem_pool->lock);
+
+        if (PF == PF_USER)
+        {
+            // 用户进程只申请虚拟地址,物理页框等第一次访问时由缺页异常分配,分配到的页框已经清0
+            a = vaddr_get(PF_USER, page_cnt);
+
+            if (a != NULL)
+            {
+                memset(a, 0, sizeof(struct arena));
+            }
+        }
+        else
+        {
+            a = get_kernel_direct_pages(page_cnt); // 从直接映射区创建arena,分配的内存已经清0
+        }
 
         if (a != NULL)
         {
-            memset(a, 0, page_cnt * PG_SIZE); // 将分配的内存清0
 
             // 对于分配的大块页框,将desc置为NULL, cnt置为页框数,large置为true
             a->desc  = NULL;
@@ -464,6 +943,13 @@ void *sys_malloc(uint32_t size)
 
             lock_release(&mem_pool->lock);
 
+            cur_thread->mem.heap_bytes += page_cnt * PG_SIZE;
+
+            if (PF == PF_KERNEL)
+            {
+                kmprof_alloc(a + 1, size, page_cnt * PG_SIZE, KMPROF_SITE());
+            }
+
             // 此地址便是用户分配的内存地址
             // 跨过arena大小，把剩下的内存返回
             return (void *)(a + 1); 
@@ -489,414 +975,1796 @@ void *sys_malloc(uint32_t size)
             }
         }
 
-        // 若mem_block_desc的free_list中已经没有可用的mem_block,就创建新的arena提供mem_block
-        if (list_empty(&descs[desc_idx].free_list))
+        struct mem_magazine *mag = &cur_thread->mags[desc_idx];
+
+        if (!mem_limit_check(MEM_RES_HEAP, descs[desc_idx].block_size))
+        {
+            return NULL;
+        }
+
+        if (mag_enabled && mag->cnt > 0)
+        {
+            // 1 线程自己缓存的块只有自己用,不用拿内存池的锁
+            b = elem2entry(struct mem_block, free_elem, list_pop(&mag->blocks));
+            mag->cnt--;
+        }
+        else
+        {
+            // 2 缓存空了,拿锁取一块,再从free_list中顺便带一批回来,不为填缓存新建arena
+            lock_acquire(&mem_pool->lock);
+
+            b = block_get(PF, &descs[desc_idx]);
+
+            while (b != NULL && mag_enabled && mag->cnt < MAG_BATCH && !list_empty(&descs[desc_idx].free_list))
+            {
+                list_push(&mag->blocks, &block_get(PF, &descs[desc_idx])->free_elem);
+                mag->cnt++;
+            }
+
+            lock_release(&mem_pool->lock);
+
+            if (b == NULL)
+            {
+                return NULL;
+            }
+        }
+
+        memset(b, 0, descs[desc_idx].block_size);
+        cur_thread->mem.heap_bytes += descs[desc_idx].block_size;
+
+        if (PF == PF_KERNEL)
+        {
+            kmprof_alloc(b, size, descs[desc_idx].block_size, KMPROF_SITE());
+        }
+
+        return (void *)b;
+
+    } // end if
+
+}
+
+// 返回物理页框pg_phy_addr所属的内存池
+static struct pool *phy2pool(uint32_t pg_phy_addr)
+{
+    if (pg_phy_addr >= user_pool.phy_addr_start)             // 用户物理内存池
+    {
+        return &user_pool;
+    }
+
+    // 内核物理内存池
+    return &kernel_pool;
+}
+
+// 返回物理页框pg_phy_addr的描述符
+static struct page *phy_addr2page(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool = phy2pool(pg_phy_addr);
+
+    return phy2page(&mem_pool->zone, pg_phy_addr);
+}
+
+// 物理页框pg_phy_addr是否分给了用户,页框可能在内核内存池中
+bool phy_is_user_page(uint32_t pg_phy_addr)
+{
+    return (phy_addr2page(pg_phy_addr)->flags & PG_USER) != 0;
+}
+
+// 页框pg的引用计数减1,降到0时清掉分给用户的标志并结清借用的计数,返回页框是否该还给伙伴系统了,调用时关中断
+static bool page_put(struct pool *mem_pool, struct page *pg)
+{
+    if (pg->flags & PG_PINNED)
+    {
+        return false;
+    }
+
+    ASSERT(pg->ref_count > 0);
+
+    if (--pg->ref_count != 0)
+    {
+        return false;
+    }
+
+    // 借来的页框还回去,借方的计数减1
+    struct pool *user = pg->flags & PG_USER ? &user_pool : &kernel_pool;
+
+    if (user != mem_pool)
+    {
+        user->borrowed--;
+    }
+
+    pg->flags &= ~PG_USER;
+
+    return true;
+}
+
+// 将物理地址pg_phy_addr回收到物理内存池,页框被多个页表项共享时只减少引用计数
+void pfree(uint32_t pg_phy_addr)
+{
+    struct pool *mem_pool = phy2pool(pg_phy_addr);
+    struct page *pg       = phy2page(&mem_pool->zone, pg_phy_addr);
+
+    // fork和缺页处理会在其它任务中修改引用计数,要保证原子操作
+    enum intr_status old_status = intr_disable();
+
+    if (page_put(mem_pool, pg))
+    {
+        // 归还伙伴系统,能合并的话会和伙伴合并成更大的块
+        buddy_free(&mem_pool->zone, pg, 0);
+    }
+
+    intr_set_status(old_status);
+
+    return ;
+}
+
+// 把物理上连续的cnt个空闲页框[phy, phy + cnt页)还给m_pool的伙伴系统,按下标对齐的最大块整块归还
+static void pfree_run(struct pool *m_pool, uint32_t phy, uint32_t cnt)
+{
+    uint32_t pg_idx = phy2page(&m_pool->zone, phy) - m_pool->zone.pages;
+    uint32_t end    = pg_idx + cnt;
+
+    while (pg_idx < end)
+    {
+        uint32_t order = 0;
+        while (order + 1 < BUDDY_MAX_ORDER && !(pg_idx & ((2U << order) - 1)) && pg_idx + (2U << order) <= end)
+        {
+            order++;
+        }
+
+        buddy_free(&m_pool->zone, m_pool->zone.pages + pg_idx, order);
+        pg_idx += 1U << order;
+    }
+
+    return ;
+}
+
+/**
+ * @brief
+ * 批量释放phys中的cnt个物理页框,效果和逐个pfree相同,进程退出时用。
+ * 只关一次中断;引用计数降到0的页框若物理上紧挨着前一个,就攒成一段,
+ * 整段按对齐的大块还给伙伴系统,省掉逐页归还时一阶一阶的合并。
+ * 缺页时按顺序分配的页框大多是连续的,所以大部分页框能整块归还
+ */
+void pfree_batch(uint32_t *phys, uint32_t cnt)
+{
+    struct pool *run_pool = NULL;
+    uint32_t run_start    = 0;
+    uint32_t run_cnt      = 0;
+    uint32_t idx          = 0;
+
+    enum intr_status old_status = intr_disable();
+
+    while (idx < cnt)
+    {
+        uint32_t phy          = phys[idx++];
+        struct pool *mem_pool = phy2pool(phy);
+
+        if (!page_put(mem_pool, phy2page(&mem_pool->zone, phy)))
+        {
+            continue;
+        }
+
+        if (run_cnt > 0 && mem_pool == run_pool && phy == run_start + run_cnt * PG_SIZE)
+        {
+            run_cnt++;
+            continue;
+        }
+
+        if (run_cnt > 0)
+        {
+            pfree_run(run_pool, run_start, run_cnt);
+        }
+
+        run_pool  = mem_pool;
+        run_start = phy;
+        run_cnt   = 1;
+    }
+
+    if (run_cnt > 0)
+    {
+        pfree_run(run_pool, run_start, run_cnt);
+    }
+
+    intr_set_status(old_status);
+
+    return ;
+}
+
+// 物理页框pg_phy_addr又被一个页表项映射,引用计数加1,常驻的页框不计数,免得16位的计数溢出
+void page_ref_inc(uint32_t pg_phy_addr)
+{
+    struct page *pg = phy_addr2page(pg_phy_addr);
+
+    if (pg->flags & PG_PINNED)
+    {
+        return ;
+    }
+
+    enum intr_status old_status = intr_disable();
+    pg->ref_count++;
+    intr_set_status(old_status);
+
+    return ;
+}
+
+// 返回物理页框pg_phy_addr的引用计数
+uint32_t page_ref_count(uint32_t pg_phy_addr)
+{
+    return phy_addr2page(pg_phy_addr)->ref_count;
+}
+
+// 返回全局零页的物理地址,零页内容全为0,只读映射给还没写过的匿名页
+uint32_t zero_page_phy(void)
+{
+    return zero_page_phyaddr;
+}
+
+/**
+ * @brief
+ * 内存规整(compaction)
+ *
+ * 内核要物理上连续的多页时(get_kernel_direct_pages),内核内存池中空闲的页框可能够数,
+ * 却被借给用户的页框隔开,没有够大的空闲块。借给用户的页框只被一个用户页表项映射着,
+ * 把内容复制到别处的页框再改页表项,进程察觉不到,这样的页框是可移动的。
+ * 规整时找一个按2^order对齐、只由空闲页框和可移动页框组成、可移动页框最少的块,
+ * 先从伙伴系统中取下块中的空闲页框,再遍历所有进程的页表,把块中的页框迁出去,优先迁回用户内存池。
+ * 块中的页框全部到手就直接作为分配的结果,有页框没迁走(比如正在换出,页表项中已经不是它)就全部还回去。
+ * 整个过程关中断,页表项和引用计数不会在中途被缺页、换页和fork改动。
+ * 内核自己的页框(slab、页表、页缓存等)不移动,含有它们的块不选
+ */
+
+// 页框pg是否可移动:分给了用户且只被一个页表项映射着
+static bool page_movable(struct page *pg)
+{
+    return (pg->flags & (PG_USER | PG_PINNED)) == PG_USER && pg->ref_count == 1;
+}
+
+/**
+ * @brief
+ * 在内核内存池中找规整代价最小的2^order页的块,返回首页下标,没有合适的块返回-1,关中断时调用。
+ * 块内的空闲块都比2^order小且按自己的大小对齐,所以从块首开始跳过一个个空闲块,
+ * 遇到的不是空闲块的首页就是已分配的页框
+ */
+static int32_t compact_pick_block(uint32_t order)
+{
+    struct buddy_zone *zone = &kernel_pool.zone;
+    uint32_t size           = 1U << order;
+    uint32_t best_movable   = 0xffffffff;
+    int32_t  best           = -1;
+    uint32_t head           = 0;
+
+    // 规整出来的块要能通过直接映射区访问
+    while (head + size <= zone->page_cnt && page2phy(zone, zone->pages + head) + size * PG_SIZE <= direct_map_size)
+    {
+        uint32_t movable = 0;
+        uint32_t idx     = 0;
+
+        while (idx < size)
+        {
+            struct page *pg = zone->pages + head + idx;
+
+            if (pg->flags & PG_BUDDY)
+            {
+                idx += 1U << pg->order;
+                continue;
+            }
+
+            if (!page_movable(pg))
+            {
+                break;
+            }
+
+            movable++;
+            idx++;
+        }
+
+        if (idx >= size && movable < best_movable)
         {
-            // 分配1页框做为arena
-            a = malloc_page(PF, 1); 
+            best         = head;
+            best_movable = movable;
+        }
+
+        head += size;
+    }
+
+    return best;
+}
+
+// 把页表项*pte映射的页框复制到新页框上并改写页表项,旧页框留给调用者,成功返回true,关中断时调用
+static bool compact_migrate(uint32_t *pte)
+{
+    uint32_t old_phy   = *pte & 0xfffff000;
+    struct pool *owner = &user_pool;
+    struct page *pg    = buddy_alloc(&user_pool.zone, 0);
+
+    // 用户内存池也没有空闲的,只好换到内核内存池中块以外的地方
+    if (pg == NULL)
+    {
+        owner = &kernel_pool;
+        pg    = buddy_alloc(&kernel_pool.zone, 0);
+    }
+
+    if (pg == NULL)
+    {
+        return false;
+    }
+
+    uint32_t new_phy = page2phy(&owner->zone, pg);
+    void *src        = kmap(KMAP_COPY, old_phy);
+    void *dst        = kmap(KMAP_MIGRATE, new_phy);
+
+    memcpy(dst, src, PG_SIZE);
+
+    kunmap(KMAP_MIGRATE, dst);
+    kunmap(KMAP_COPY, src);
+
+    *pte = new_phy | (*pte & 0x00000fff);
+
+    // 旧页框是从内核内存池借的,迁回用户内存池就不再算借的
+    pg->flags |= PG_USER;
+    phy_addr2page(old_phy)->flags &= ~PG_USER;
+
+    if (owner == &user_pool)
+    {
+        user_pool.borrowed--;
+    }
+
+    compact_migrated++;
+
+    return true;
+}
+
+// 把所有进程页表中映射到物理地址[start, end)中可移动页框的页迁移出去,关中断时调用
+static void compact_migrate_range(uint32_t start, uint32_t end)
+{
+    uint32_t cr3 = 0;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+
+    struct list_elem *elem = thread_all_list.head.next;
+
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *t = elem2entry(struct task_struct, all_list_tag, elem);
+        elem                  = elem->next;
+
+        if (t->pgdir == NULL || t->status == TASK_HANGING || t->status == TASK_DIED)
+        {
+            continue;
+        }
+
+        // 只有当前页目录的tlb要刷,别的进程切换回来时重新加载cr3,用户页不是全局页
+        bool current     = (cr3 & 0xfffff000) == addr_v2p((uint32_t)t->pgdir);
+        uint32_t pde_idx = 0;
+
+        while (pde_idx < PDE_IDX(0xc0000000))
+        {
+            uint32_t pde = t->pgdir[pde_idx];
+
+            if (!(pde & PG_P_1))
+            {
+                pde_idx++;
+                continue;
+            }
+
+            uint32_t *ptes   = kmap(KMAP_SWAP_PT, pde & 0xfffff000);
+            uint32_t pte_idx = 0;
+
+            while (pte_idx < 1024)
+            {
+                uint32_t pte = ptes[pte_idx];
+                uint32_t phy = pte & 0xfffff000;
+
+                if ((pte & PG_P_1) && phy >= start && phy < end && page_movable(phy_addr2page(phy)) &&
+                    compact_migrate(&ptes[pte_idx]) && current)
+                {
+                    uint32_t vaddr = (pde_idx << 22) | (pte_idx << 12);
+                    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                                 : "memory");
+                }
+
+                pte_idx++;
+            }
+
+            kunmap(KMAP_SWAP_PT, ptes);
+            pde_idx++;
+        }
+    }
+
+    return;
+}
+
+// 内核内存池中没有2^order页的空闲块时规整出一块,成功返回块的首页,状态和buddy_alloc分出来的一样,失败返回NULL
+static struct page *compact_alloc(uint32_t order)
+{
+    struct buddy_zone *zone     = &kernel_pool.zone;
+    uint32_t size               = 1U << order;
+    enum intr_status old_status = intr_disable();
+
+    compact_runs++;
+
+    // 1 预先清0的页框也占着位置,先还给伙伴系统,idle线程以后会再补充
+    while (!list_empty(&kernel_pool.zero_list))
+    {
+        buddy_free(zone, elem2entry(struct page, free_elem, list_pop(&kernel_pool.zero_list)), 0);
+        kernel_pool.zero_cnt--;
+    }
+
+    struct page *block = buddy_alloc(zone, order);
+
+    if (block != NULL)
+    {
+        compact_success++;
+        intr_set_status(old_status);
+        return block;
+    }
+
+    int32_t head = compact_pick_block(order);
+
+    if (head == -1)
+    {
+        intr_set_status(old_status);
+        return NULL;
+    }
+
+    // 2 取下块中的空闲页框
+    block        = zone->pages + head;
+    uint32_t idx = 0;
+
+    while (idx < size)
+    {
+        if (block[idx].flags & PG_BUDDY)
+        {
+            uint32_t end = idx + (1U << block[idx].order);
+
+            while (idx < end)
+            {
+                buddy_claim(zone, block + idx);
+                idx++;
+            }
+
+            continue;
+        }
+
+        idx++;
+    }
+
+    // 3 迁走块中用户的页框
+    uint32_t block_phy = page2phy(zone, block);
+    compact_migrate_range(block_phy, block_phy + size * PG_SIZE);
+
+    // 4 还有用户的页框没迁走就把到手的页框都还回去
+    idx = 0;
+    while (idx < size && !(block[idx].flags & PG_USER))
+    {
+        idx++;
+    }
+
+    if (idx < size)
+    {
+        idx = 0;
+        while (idx < size)
+        {
+            if (!(block[idx].flags & PG_USER))
+            {
+                buddy_free(zone, block + idx, 0);
+            }
+
+            idx++;
+        }
+
+        block = NULL;
+    }
+    else
+    {
+        compact_success++;
+    }
+
+    intr_set_status(old_status);
+
+    return block;
+}
+
+// 在pf池中只分配一个物理页框,不做映射,成功返回物理地址,失败返回NULL
+void *get_a_phy_page(enum pool_flags pf)
+{
+    return palloc(pf & PF_KERNEL ? &kernel_pool : &user_pool);
+}
+
+// 在pf池中分配一个要清0的物理页框,不做映射,*zeroed为true时页框已经清0,否则调用者映射后自己清0
+void *get_a_zeroed_phy_page(enum pool_flags pf, bool *zeroed)
+{
+    return palloc_zeroed(pf & PF_KERNEL ? &kernel_pool : &user_pool, zeroed);
+}
+
+/**
+ * @brief
+ * 给预先清0的页框不够的内存池补充一页,补充了返回true。
+ * 由idle线程在没有别的线程要运行时调用,idle线程不能阻塞,所以直接向伙伴系统要页框,不拿内存池的锁,
+ * 也不触发换页,内存池剩下的空闲页框不多时就不再补充
+ */
+bool zero_pool_fill_one(void)
+{
+    struct pool *pools[2] = {&user_pool, &kernel_pool};
+    uint32_t pool_idx     = 0;
+
+    while (pool_idx < 2)
+    {
+        struct pool *m_pool = pools[pool_idx++];
+
+        if (m_pool->zero_cnt >= ZERO_POOL_PAGES || m_pool->zone.free_pages <= ZERO_POOL_RESERVE)
+        {
+            continue;
+        }
+
+        struct page *pg = buddy_alloc(&m_pool->zone, 0);
+
+        if (pg == NULL)
+        {
+            continue;
+        }
+
+        // 在直接映射区中的页框直接清0,否则临时映射到KMAP_ZERO窗口上清0,只有idle线程使用这个窗口
+        void *kaddr = kmap(KMAP_ZERO, page2phy(&m_pool->zone, pg));
+        memset(kaddr, 0, PG_SIZE);
+        kunmap(KMAP_ZERO, kaddr);
+
+        enum intr_status old_status = intr_disable();
+        list_append(&m_pool->zero_list, &pg->free_elem);
+        m_pool->zero_cnt++;
+        intr_set_status(old_status);
+
+        return true;
+    }
+
+    return false;
+}
+
+// 去掉页表中虚拟地址vaddr的映射,只去掉vaddr对应的pte
+static void page_table_pte_remove(uint32_t vaddr)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    *pte &= ~PG_P_1;     // 将页表项pte的P位置0
+
+    if (vaddr < 0xc0000000 && (*pte & 0xfffff000) != zero_page_phyaddr)
+    {
+        mem_rss_add(running_thread(), -1);
+    }
+
+    // 更新tlb,操作数是vaddr指向的地址而不是变量vaddr本身的地址
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory"); 
+                
+    return ;
+}
+
+// 若用户页vaddr有映射,解除映射并归还物理页框,已换出的页归还交换槽,虚拟地址位图不变,之后访问会重新触发缺页
+void page_unmap(uint32_t vaddr)
+{
+    if (!(*pde_ptr(vaddr) & PG_P_1))
+    {
+        return ;
+    }
+
+    // 防止判断完之后页被换出
+    enum intr_status old_status = intr_disable();
+    uint32_t *pte               = pte_ptr(vaddr);
+
+    if (PTE_IS_SWAP(*pte))
+    {
+        swap_free_entry(*pte);
+        *pte = 0;
+    }
+    else if (*pte & PG_P_1)
+    {
+        pfree(*pte & 0xfffff000);
+        page_table_pte_remove(vaddr);
+    }
+
+    intr_set_status(old_status);
+
+    return ;
+}
+
+// 在虚拟地址池中释放以_vaddr起始的连续pg_cnt个虚拟页地址
+static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+{
+    uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr;
+
+    if (pf == PF_KERNEL)         // 内核虚拟内存池
+    {
+        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx_start, pg_cnt, 0);
+    }
+    else
+    {   // 用户虚拟内存池
+
+        struct task_struct *cur_thread = running_thread();
+        vma_unmap(&cur_thread->vmas, vaddr, vaddr + pg_cnt * PG_SIZE);
+    }
+
+    return ;
+}
+
+// 释放以虚拟地址vaddr为起始的cnt个物理页框
+void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+{
+    uint32_t pg_phy_addr;
+    uint32_t vaddr = (int32_t)_vaddr, page_cnt = 0;
+
+    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
+
+    // 直接映射区中的页没有页表项和虚拟地址位图,只归还页框
+    if (pf == PF_KERNEL && vaddr >= DIRECT_MAP_BASE && vaddr - DIRECT_MAP_BASE < direct_map_size)
+    {
+        while (page_cnt < pg_cnt)
+        {
+            pfree(addr_v2p(vaddr + page_cnt * PG_SIZE));
+            page_cnt++;
+        }
+
+        return ;
+    }
+
+    // 用户空间的页是按需分配的,从没访问过的页没有物理页框,所以按pf而不是物理地址区分内存池
+    if (pf == PF_USER)      // 位于user_pool内存池
+    {
+        vaddr -= PG_SIZE;
+
+        // 关中断,防止判断完之后页被换出
+        enum intr_status old_status = intr_disable();
+
+        while (page_cnt < pg_cnt)
+        {
+            vaddr += PG_SIZE;
+            page_cnt++;
+
+            // 没有物理页框的页可能已经换出了,要归还交换槽
+            if (!page_present(vaddr))
+            {
+                page_unmap(vaddr);
+                continue;
+            }
+
+            pg_phy_addr = addr_v2p(vaddr);
+
+            // 确保物理页框是分给用户的,它可能是从内核内存池借来的,
+            // 只读访问过的匿名页映射的是共享零页,零页是钉住的,pfree不会真的释放它
+            ASSERT((pg_phy_addr % PG_SIZE) == 0 && (phy_is_user_page(pg_phy_addr) || pg_phy_addr == zero_page_phyaddr));
+
+            // 先将对应的物理页框归还到内存池
+            pfree(pg_phy_addr);
+
+            // 再从页表中清除此虚拟地址所在的页表项pte
+            page_table_pte_remove(vaddr);
+        }
+
+        intr_set_status(old_status);
+
+        // 清空虚拟地址的位图中的相应位
+        vaddr_remove(pf, _vaddr, pg_cnt);
+    }
+    else
+    {   // 位于kernel_pool内存池
+
+        vaddr -= PG_SIZE;
+
+        while (page_cnt < pg_cnt)
+        {
+            vaddr += PG_SIZE;
+            pg_phy_addr = addr_v2p(vaddr);
+
+            // 确保待释放的物理页框是分给内核的,它可能是从用户内存池借来的
+            ASSERT((pg_phy_addr % PG_SIZE) == 0 && !phy_is_user_page(pg_phy_addr));
+
+            // 先将对应的物理页框归还到内存池
+            pfree(pg_phy_addr);
+
+            // 再从页表中清除此虚拟地址所在的页表项pte
+            page_table_pte_remove(vaddr);
+
+            page_cnt++;
+        }
+
+        // 清空虚拟地址的位图中的相应位
+        vaddr_remove(pf, _vaddr, pg_cnt);
+
+    } // end if
+
+    return ;
+}
+
+// 回收内存ptr
+void sys_free(void *ptr)
+{
+    ASSERT(ptr != NULL);
+
+    if (ptr != NULL)
+    {
+
+        enum pool_flags PF;
+        struct pool *mem_pool;
+        struct mem_block_desc *descs;
+        struct task_struct    *cur_thread = running_thread();
+
+        // 判断是线程还是进程
+        if (cur_thread->pgdir == NULL)
+        {
+            ASSERT((uint32_t)ptr >= K_HEAP_START);
+            PF = PF_KERNEL;
+            mem_pool = &kernel_pool;
+            descs = k_block_descs;
+            kmprof_free(ptr);
+        }
+        else
+        {
+            PF = PF_USER;
+            mem_pool = &user_pool;
+            descs = cur_thread->u_block_desc;
+        }
+
+        struct mem_block *b = ptr;
+        struct arena *a     = block2arena(b);     // 把mem_block转换成arena,获取元信息
+
+        ASSERT(a->large == 0 || a->large == 1);
+
+        // 可能释放的是别的任务分配的内存,减到0为止
+        uint32_t bytes = a->large ? a->cnt * PG_SIZE : a->desc->block_size;
+        cur_thread->mem.heap_bytes -= bytes < cur_thread->mem.heap_bytes ? bytes : cur_thread->mem.heap_bytes;
+
+        // 小于等于1024的内存块先放进线程自己的缓存,满了再拿锁还回去一批
+        // fork之前分配的块的desc指向父进程的描述符,不进缓存
+        if (mag_enabled && !a->large && a->desc >= descs && a->desc < descs + DESC_CNT)
+        {
+            struct mem_magazine *mag = &cur_thread->mags[a->desc - descs];
+
+            if (mag->cnt == MAG_SIZE)
+            {
+                lock_acquire(&mem_pool->lock);
+                magazine_flush(PF, mag, MAG_BATCH);
+                lock_release(&mem_pool->lock);
+            }
+
+            list_push(&mag->blocks, &b->free_elem);
+            mag->cnt++;
+
+            return ;
+        }
+
+        lock_acquire(&mem_pool->lock);
+
+        if (a->desc == NULL && a->large == true)
+        {   // 大于1024的内存
+            mfree_page(PF, a, a->cnt);
+        }
+        else
+        {   // 小于等于1024的内存块
+            block_put(PF, b);
+        }
+
+        // end if
+        lock_release(&mem_pool->lock);
+
+    } //end if
+
+    return ;
+}
+
+// 把大块内存的arena a原地扩大到pg_cnt页,紧跟在后面的虚拟页都空闲时才能扩大,成功返回true,调用时持有内存池的锁
+static bool arena_grow(enum pool_flags PF, struct arena *a, uint32_t pg_cnt)
+{
+    uint32_t tail  = (uint32_t)a + a->cnt * PG_SIZE;
+    uint32_t extra = pg_cnt - a->cnt;
+
+    if (PF == PF_USER)
+    {
+        // 1 用户进程后面没有区域就把区域延长,页框第一次访问时再分配
+        struct task_struct *cur = running_thread();
+        struct vm_area *next    = vma_find_next(&cur->vmas, tail);
+
+        if ((next != NULL && next->start < tail + extra * PG_SIZE) ||
+            !vma_map(&cur->vmas, tail, extra, VM_READ | VM_WRITE, VMA_ANON))
+        {
+            return false;
+        }
+    }
+    else if ((uint32_t)a >= DIRECT_MAP_BASE)
+    {
+        // 2 直接映射区中虚拟地址连续就是物理地址连续,后面的页框都空闲才行,逐个从伙伴系统中取出来
+        struct buddy_zone *zone = &kernel_pool.zone;
+        uint32_t phy            = tail - DIRECT_MAP_BASE;
+        uint32_t zone_end       = zone->phy_addr_start + zone->page_cnt * PG_SIZE;
+
+        if (phy < zone->phy_addr_start || phy + extra * PG_SIZE > zone_end ||
+            phy + extra * PG_SIZE > direct_map_size)
+        {
+            return false;
+        }
+
+        uint32_t pg_idx = 0;
+        while (pg_idx < extra && buddy_claim(zone, phy2page(zone, phy + pg_idx * PG_SIZE)))
+        {
+            pg_idx++;
+        }
+
+        if (pg_idx < extra)
+        {
+            // 中间有不空闲的页框,已经取出的还回去
+            while (pg_idx-- > 0)
+            {
+                buddy_free(zone, phy2page(zone, phy + pg_idx * PG_SIZE), 0);
+            }
+
+            return false;
+        }
+    }
+    else
+    {
+        // 3 内核堆中的arena,后面的虚拟页在位图中都空闲就占下来,逐页分配页框映射上去
+        uint32_t bit_idx = (tail - kernel_vaddr.vaddr_start) / PG_SIZE;
+        uint32_t pg_idx  = 0;
+
+        if (bit_idx + extra > kernel_vaddr.vaddr_bitmap.btmp_bytes_len * 8)
+        {
+            return false;
+        }
+
+        while (pg_idx < extra)
+        {
+            if (bitmap_scan_test(&kernel_vaddr.vaddr_bitmap, bit_idx + pg_idx))
+            {
+                return false;
+            }
+
+            pg_idx++;
+        }
+
+        bitmap_set_range(&kernel_vaddr.vaddr_bitmap, bit_idx, extra, 1);
+
+        pg_idx = 0;
+        while (pg_idx < extra)
+        {
+            void *page_phyaddr = palloc(&kernel_pool);
+
+            if (page_phyaddr == NULL)
+            {
+                // 已经映射的页连同虚拟地址一起释放,剩下的只还虚拟地址
+                if (pg_idx > 0)
+                {
+                    mfree_page(PF_KERNEL, (void *)tail, pg_idx);
+                }
+
+                vaddr_remove(PF_KERNEL, (void *)(tail + pg_idx * PG_SIZE), extra - pg_idx);
+
+                return false;
+            }
+
+            page_table_add((void *)(tail + pg_idx * PG_SIZE), page_phyaddr);
+            pg_idx++;
+        }
+    }
+
+    a->cnt = pg_cnt;
+
+    return true;
+}
+
+/**
+ * @brief
+ * 把ptr指向的内存调整为size字节,内容保留到两者中较小的大小,成功返回新地址,失败返回NULL且ptr不变。
+ * ptr为NULL时等于sys_malloc,size为0时等于sys_free并返回NULL。
+ * 1 小块在同一规格中放得下且不到浪费一半时原地返回,否则换到合适规格的块中
+ * 2 大块缩小时把多出来的尾部页还回去;扩大时若后面的虚拟页空闲就原地延长arena,
+ *   省掉申请新内存、复制和释放,也不会同时占着新旧两份内存
+ * 扩大出来的部分不保证清0
+ */
+void *sys_realloc(void *ptr, uint32_t size)
+{
+    if (ptr == NULL)
+    {
+        ptr = sys_malloc(size);
+
+        if (ptr != NULL)
+        {
+            kmprof_retag(ptr, KMPROF_SITE());
+        }
+
+        return ptr;
+    }
+
+    if (size == 0)
+    {
+        sys_free(ptr);
+        return NULL;
+    }
+
+    enum pool_flags PF    = running_thread()->pgdir == NULL ? PF_KERNEL : PF_USER;
+    struct pool *mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    struct arena *a       = block2arena(ptr);
+    uint32_t old_size;
+
+    if (size >= mem_pool->pool_size)
+    {
+        return NULL;
+    }
+
+    if (!a->large)
+    {
+        // 1 小块
+        old_size = a->desc->block_size;
+
+        if (size <= old_size && (old_size == 16 || size > old_size / 2))
+        {
+            if (PF == PF_KERNEL)
+            {
+                kmprof_resize(ptr, size, old_size);
+            }
+
+            return ptr;
+        }
+    }
+    else
+    {
+        // 2 大块,小于等于1024字节时换成小块
+        old_size = a->cnt * PG_SIZE - sizeof(struct arena);
+
+        if (size > 1024)
+        {
+            uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
+            bool in_place     = true;
+
+            lock_acquire(&mem_pool->lock);
+
+            struct mem_usage *usage = &running_thread()->mem;
+
+            if (page_cnt < a->cnt)
+            {
+                mfree_page(PF, (void *)((uint32_t)a + page_cnt * PG_SIZE), a->cnt - page_cnt);
+
+                uint32_t bytes     = (a->cnt - page_cnt) * PG_SIZE;
+                usage->heap_bytes -= bytes < usage->heap_bytes ? bytes : usage->heap_bytes;
+                a->cnt             = page_cnt;
+            }
+            else if (page_cnt > a->cnt)
+            {
+                uint32_t bytes = (page_cnt - a->cnt) * PG_SIZE;
+                in_place       = mem_limit_check(MEM_RES_HEAP, bytes) && arena_grow(PF, a, page_cnt);
+
+                if (in_place)
+                {
+                    usage->heap_bytes += bytes;
+                }
+            }
+
+            lock_release(&mem_pool->lock);
+
+            if (in_place)
+            {
+                if (PF == PF_KERNEL)
+                {
+                    kmprof_resize(ptr, size, a->cnt * PG_SIZE);
+                }
+
+                return ptr;
+            }
+        }
+    }
+
+    // 3 不能原地调整,换一块新的
+    void *new_ptr = sys_malloc(size);
+
+    if (new_ptr == NULL)
+    {
+        return NULL;
+    }
+
+    if (PF == PF_KERNEL)
+    {
+        kmprof_retag(new_ptr, KMPROF_SITE());
+    }
+
+    memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    sys_free(ptr);
+
+    return new_ptr;
+}
+
+// 申请cnt个size字节的内存,sys_malloc返回的内存已经清0,这里只检查乘法溢出,不再memset
+void *sys_calloc(uint32_t cnt, uint32_t size)
+{
+    if (cnt != 0 && size > 0xffffffff / cnt)
+    {
+        return NULL;
+    }
+
+    void *ptr = sys_malloc(cnt * size);
+
+    // 用户进程的地址不在记录中,不用区分
+    if (ptr != NULL)
+    {
+        kmprof_retag(ptr, KMPROF_SITE());
+    }
+
+    return ptr;
+}
+
+// 初始化内存占用的统计,各种资源都不限制
+void mem_usage_init(struct mem_usage *usage)
+{
+    memset(usage, 0, sizeof(struct mem_usage));
+
+    uint32_t res = 0;
+    while (res < MEM_RES_CNT)
+    {
+        usage->limit[res++] = MEM_UNLIMITED;
+    }
+
+    return ;
+}
+
+// 任务t映射着的用户页数变化delta
+void mem_rss_add(struct task_struct *t, int32_t delta)
+{
+    t->mem.rss += delta;
+
+    if (t->mem.rss > t->mem.rss_peak)
+    {
+        t->mem.rss_peak = t->mem.rss;
+    }
+
+    return ;
+}
+
+// 当前任务再占用amount个res资源后是否还在上限之内,超出时记一次limit_hits
+bool mem_limit_check(uint32_t res, uint32_t amount)
+{
+    struct mem_usage *usage = &running_thread()->mem;
+    uint32_t used           = res == MEM_RES_PAGES ? usage->rss + usage->pt_pages : usage->heap_bytes;
+
+    if (usage->limit[res] == MEM_UNLIMITED || (used <= usage->limit[res] && amount <= usage->limit[res] - used))
+    {
+        return true;
+    }
+
+    usage->limit_hits++;
+
+    return false;
+}
+
+// exec出来的程序默认的页数上限,为用户内存池可用页框的7/8
+uint32_t mem_default_page_limit(void)
+{
+    uint32_t pages = user_pool.pool_size / PG_SIZE;
+
+    return pages - (pages >> MEM_RESERVE_SHIFT);
+}
+
+// 把进程pid的内存占用复制到usage中,pid为0时是当前进程,成功返回0,没有此进程返回-1
+int32_t sys_memstat(int32_t pid, struct mem_usage *usage)
+{
+    struct task_struct *t = pid == 0 ? running_thread() : pid2thread(pid);
+
+    if (t == NULL || usage == NULL)
+    {
+        return -1;
+    }
+
+    // 别的任务的统计可能在中断中被换页修改,关中断复制一份完整的,开中断后再复制给用户,复制时可能缺页
+    struct mem_usage snapshot;
+    enum intr_status old_status = intr_disable();
+    memcpy(&snapshot, &t->mem, sizeof(struct mem_usage));
+    intr_set_status(old_status);
+
+    return copy_to_user(usage, &snapshot, sizeof(struct mem_usage)) == 0 ? 0 : -1;
+}
+
+// 设置当前进程res资源的上限为limit,之后fork的子进程也继承这个上限,成功返回0
+int32_t sys_memlimit(uint32_t res, uint32_t limit)
+{
+    if (res >= MEM_RES_CNT)
+    {
+        return -1;
+    }
+
+    running_thread()->mem.limit[res] = limit;
+
+    return 0;
+}
+
+// 为malloc做准备
+void block_desc_init(struct mem_block_desc *desc_array)
+{
+    uint16_t desc_idx, block_size = 16;
+
+    // 初始化每个mem_block_desc描述符
+    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+    {
+        desc_array[desc_idx].block_size = block_size;
+
+        // 初始化arena中的内存块数量
+        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+
+        list_init(&desc_array[desc_idx].free_list);
+
+        block_size *= 2; // 更新为下一个规格内存块
+    }
+
+    return ;
+}
+
+/**
+ * @brief
+ * 解析loader保存的e820内存布局,取出4G以下type为1的可用内存,按页向内对齐,
+ * 按地址排序并合并相连的段,记录在mem_ranges中,返回可用内存的最高地址。
+ * loader求的总内存只是各段结尾的最大值,中间BIOS保留的空洞也算了进去,这里不再使用。
+ * 没有拿到e820布局时(e801和0x88子功能),把[0, all_mem)当作一整段可用内存
+ */
+static uint32_t e820_parse(uint32_t all_mem)
+{
+    struct ards *ards    = (struct ards *)ARDS_BUF;
+    uint32_t     ards_nr = *(uint16_t *)ARDS_NR;
+
+    if (ards_nr > ARDS_MAX)
+    {
+        ards_nr = ARDS_MAX;
+    }
+
+    mem_range_cnt = 0;
+
+    uint32_t idx = 0;
+    while (idx < ards_nr)
+    {
+        struct ards *cur = ards + idx++;
+
+        put_str("  e820: ");
+        put_int(cur->base_high);
+        put_char(' ');
+        put_int(cur->base_low);
+        put_str(" len ");
+        put_int(cur->len_high);
+        put_char(' ');
+        put_int(cur->len_low);
+        put_str(" type ");
+        put_int(cur->type);
+        put_str("\n");
+
+        // 4G以上的内存32位页表映射不到,不使用
+        if (cur->type != ARDS_USABLE || cur->base_high != 0)
+        {
+            continue;
+        }
+
+        uint64_t end64 = (uint64_t)cur->base_low + cur->len_low + ((uint64_t)cur->len_high << 32);
+        uint32_t end   = (end64 > 0xfffff000ULL ? 0xfffff000 : (uint32_t)end64) & 0xfffff000;
+        uint32_t start = (cur->base_low + PG_SIZE - 1) & 0xfffff000;
+
+        if (cur->base_low > 0xfffff000 || start >= end)
+        {
+            continue;
+        }
+
+        // 插入排序,BIOS不保证ARDS按地址排列
+        uint32_t pos = mem_range_cnt;
+        while (pos > 0 && mem_ranges[pos - 1].start > start)
+        {
+            mem_ranges[pos] = mem_ranges[pos - 1];
+            pos--;
+        }
+
+        mem_ranges[pos].start = start;
+        mem_ranges[pos].end   = end;
+        mem_range_cnt++;
+    }
+
+    if (mem_range_cnt == 0)
+    {
+        mem_ranges[0].start = 0;
+        mem_ranges[0].end   = all_mem & 0xfffff000;
+        mem_range_cnt       = 1;
+    }
+
+    // 合并重叠或首尾相连的段,相连的段分开加入伙伴系统会多出两个无法合并的伙伴
+    uint32_t merged = 0;
+    idx = 1;
+    while (idx < mem_range_cnt)
+    {
+        if (mem_ranges[idx].start <= mem_ranges[merged].end)
+        {
+            if (mem_ranges[idx].end > mem_ranges[merged].end)
+            {
+                mem_ranges[merged].end = mem_ranges[idx].end;
+            }
+        }
+        else
+        {
+            mem_ranges[++merged] = mem_ranges[idx];
+        }
+        idx++;
+    }
+    mem_range_cnt = merged + 1;
+
+    return mem_ranges[merged].end;
+}
+
+// 物理地址[start, end)中可用的页框数
+static uint32_t usable_pages(uint32_t start, uint32_t end)
+{
+    uint32_t pg_cnt = 0;
+
+    uint32_t idx = 0;
+    while (idx < mem_range_cnt)
+    {
+        uint32_t s = mem_ranges[idx].start > start ? mem_ranges[idx].start : start;
+        uint32_t e = mem_ranges[idx].end < end ? mem_ranges[idx].end : end;
+
+        if (s < e)
+        {
+            pg_cnt += (e - s) / PG_SIZE;
+        }
+        idx++;
+    }
+
+    return pg_cnt;
+}
+
+// 从start开始往后数pg_cnt个可用页框,返回最后一个之后的地址,不超过limit
+static uint32_t usable_end(uint32_t start, uint32_t pg_cnt, uint32_t limit)
+{
+    uint32_t addr = start;
+
+    uint32_t idx = 0;
+    while (idx < mem_range_cnt && pg_cnt > 0)
+    {
+        uint32_t s = mem_ranges[idx].start > start ? mem_ranges[idx].start : start;
+        uint32_t e = mem_ranges[idx].end < limit ? mem_ranges[idx].end : limit;
+        idx++;
+
+        if (s >= e)
+        {
+            continue;
+        }
+
+        if ((e - s) / PG_SIZE >= pg_cnt)
+        {
+            return s + pg_cnt * PG_SIZE;
+        }
+
+        pg_cnt -= (e - s) / PG_SIZE;
+        addr    = e;
+    }
+
+    return addr;
+}
+
+// 内存池m_pool跨越物理地址[phy_addr_start, end),把其中可用的页框交给它的伙伴系统,空洞不加入
+static void pool_add_usable(struct pool *m_pool, uint32_t end)
+{
+    uint32_t start = m_pool->phy_addr_start;
+
+    uint32_t idx = 0;
+    while (idx < mem_range_cnt)
+    {
+        uint32_t s = mem_ranges[idx].start > start ? mem_ranges[idx].start : start;
+        uint32_t e = mem_ranges[idx].end < end ? mem_ranges[idx].end : end;
+
+        if (s < e)
+        {
+            buddy_add_range(&m_pool->zone, (s - start) / PG_SIZE, (e - s) / PG_SIZE);
+        }
+        idx++;
+    }
+
+    m_pool->pool_size = m_pool->zone.free_pages * PG_SIZE;
+
+    return ;
+}
+
+// 初始化内存池,mem_top是可用物理内存的最高地址,中间的空洞由mem_ranges描述
+static void mem_pool_init(uint32_t mem_top)
+{
+    put_str("  mem_pool_init start\n");
+
+    // 页表大小= 1页的页目录表+第0和第768个页目录项指向同一个页表+第769~1022个页目录项共指向254个页表,共256个页框
+    uint32_t page_table_size   = PG_SIZE * 256;
+
+    // 0x100000为低端1M内存,用来记录当前已使用的内存字节数
+    uint32_t used_mem          = page_table_size + 0x100000; 
+
+    ASSERT(mem_top > used_mem);
+
+    // 从used_mem到最高可用地址的页框数,包含空洞,每个都要有描述符
+    uint32_t all_span_pages    = (mem_top - used_mem) / PG_SIZE;
+
+    /**
+     * @brief 
+     * 每个物理页框都需要一个struct page描述符给伙伴系统使用,
+     * 描述符数组放在可用内存最前面的页框中,并映射到内核堆的起始处K_HEAP_START,
+     * 这些页框不再交给内存池管理。空洞中的页框也有描述符,这样页框地址换算描述符仍是一次减法
+     * 
+     */
+
+    uint32_t page_desc_pages   = DIV_ROUND_UP(all_span_pages * sizeof(struct page), PG_SIZE);
+
+    uint32_t kp_start   = used_mem + page_desc_pages * PG_SIZE;   // Kernel Pool start,内核内存池的起始地址
+
+    // 描述符数组直接放在1M以上的第一段可用内存中,这一段不能有空洞
+    ASSERT(usable_pages(used_mem, kp_start) == page_desc_pages);
+
+    // 可用页框对半分给两个内存池,内核内存池最多跨KERNEL_POOL_MAX字节,多出来的给用户
+    uint32_t all_free_pages    = usable_pages(kp_start, mem_top);
+    uint32_t kp_limit          = mem_top - kp_start > KERNEL_POOL_MAX ? kp_start + KERNEL_POOL_MAX : mem_top;
+
+    // User Pool start,用户内存池的起始地址,也是内核内存池的结束地址
+    uint32_t up_start   = usable_end(kp_start, all_free_pages / 2, kp_limit);
+
+    uint32_t kernel_span_pages = (up_start - kp_start) / PG_SIZE;
+    uint32_t user_span_pages   = (mem_top - up_start) / PG_SIZE;
+
+    kernel_pool.phy_addr_start = kp_start;         // 用于记录内核物理内存池的起始地址
+    user_pool.phy_addr_start = up_start;           // 用户物理内存池的起始地址
+
+    /**
+     * @brief 
+     * 内核虚拟地址的位图用于维护内核堆的虚拟地址,要覆盖描述符数组和整个内核内存池。
+     * 位图放在MEM_BITMAP_BASE(0xc009a000)处,4个页框的位图最多可以表示512M的内核堆
+     * 
+     */
+
+    uint32_t kvbm_length = DIV_ROUND_UP(page_desc_pages + kernel_span_pages, 8);
+
+    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kvbm_length; 
+    kernel_vaddr.vaddr_bitmap.bits           = (void *)MEM_BITMAP_BASE;
+    kernel_vaddr.vaddr_start                 = K_HEAP_START;
+    bitmap_init(&kernel_vaddr.vaddr_bitmap);
 
-            if (a == NULL)
-            {
-                lock_release(&mem_pool->lock);
-                return NULL;
-            }
+    // 内核堆不能和直接映射区重叠
+    ASSERT(K_HEAP_START + (page_desc_pages + kernel_span_pages) * PG_SIZE <= DIRECT_MAP_BASE);
 
-            // 为新的arena初始化信息，这次的arena用于小内存块分配
-            memset(a, 0, PG_SIZE);
+    // 描述符数组所在的页框直接映射,页表项所在的页表在loader中已经建好,不会再去申请物理页
+    bitmap_set_range(&kernel_vaddr.vaddr_bitmap, 0, page_desc_pages, 1);
 
-            // 对于分配的小块内存,将desc置为相应内存块描述符, cnt置为此arena可用的内存块数,large置为false
-            a->desc  = &descs[desc_idx];             // 使desc指向上面找到的内存块描述符
-            a->large = false;
-            a->cnt   = descs[desc_idx].blocks_per_arena;
+    uint32_t pg_idx = 0;
+    while (pg_idx < page_desc_pages)
+    {
+        page_table_add((void *)(K_HEAP_START + pg_idx * PG_SIZE), (void *)(used_mem + pg_idx * PG_SIZE));
+        pg_idx++;
+    }
 
-            uint32_t block_idx;
+    // 内核内存池的描述符在前,用户内存池的紧跟其后,只有可用的页框进入伙伴系统
+    struct page *pages = (struct page *)K_HEAP_START;
+    buddy_init_empty(&kernel_pool.zone, pages, kp_start, kernel_span_pages);
+    buddy_init_empty(&user_pool.zone, pages + kernel_span_pages, up_start, user_span_pages);
 
-            enum intr_status old_status = intr_disable();
+    pool_add_usable(&kernel_pool, up_start);
+    pool_add_usable(&user_pool, mem_top);
 
-            //  开始将arena拆分成内存块,并添加到内存块描述符的free_list中
-            for (block_idx = 0; block_idx < descs[desc_idx].blocks_per_arena; block_idx++)
-            {
-                b = arena2block(a, block_idx);
-                ASSERT(!elem_find(&a->desc->free_list, &b->free_elem));
-                list_append(&a->desc->free_list, &b->free_elem);
-            }
+    // 两个内存池互相借页框的水位和上限
+    kernel_pool.wmark_min  = kernel_pool.zone.free_pages >> POOL_WMARK_SHIFT;
+    user_pool.wmark_min    = user_pool.zone.free_pages >> POOL_WMARK_SHIFT;
+    kernel_pool.borrow_max = user_pool.zone.free_pages >> POOL_BORROW_SHIFT;
+    user_pool.borrow_max   = kernel_pool.zone.free_pages >> POOL_BORROW_SHIFT;
 
-            intr_set_status(old_status);
+    // 输出内存池信息
+    put_str("  page_desc_start: ");
+    put_int((int)pages);
 
-        } // end if
+    put_str("  page_desc_pages: ");
+    put_int(page_desc_pages);
 
-        // 开始分配内存块
-        b = elem2entry(struct mem_block, free_elem, list_pop(&(descs[desc_idx].free_list)));
-        memset(b, 0, descs[desc_idx].block_size);
+    put_str("\n");
 
-        a = block2arena(b);             // 获取内存块b所在的arena
-        a->cnt--;                       // 将此arena中的空闲内存块数减1
+    put_str("  kernel_pool_phy_addr_start: ");
+    put_int(kernel_pool.phy_addr_start);
 
-        lock_release(&mem_pool->lock);
+    put_str("  user_pool_phy_addr_start:   ");
+    put_int(user_pool.phy_addr_start);
+    
+    put_str("\n");
 
-        return (void *)b;
+    put_str("  kernel_pool_size: ");
+    put_int(kernel_pool.pool_size);
 
-    } // end if
+    put_str("  user_pool_size:   ");
+    put_int(user_pool.pool_size);
 
-}
+    put_str("\n");
 
-// 将物理地址pg_phy_addr回收到物理内存池
-void pfree(uint32_t pg_phy_addr)
-{
-    struct pool *mem_pool;
-    uint32_t bit_idx = 0;
+    lock_init(&kernel_pool.lock);              // kernel，添加内核锁
+    lock_init(&user_pool.lock);                // user，添加用户锁
 
-    if (pg_phy_addr >= user_pool.phy_addr_start)             // 用户物理内存池
-    {
-        mem_pool = &user_pool;
-        bit_idx  = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
-    }
-    else
-    {   // 内核物理内存池
-        mem_pool = &kernel_pool;
-        bit_idx  = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
-    }
+    list_init(&kernel_pool.zero_list);         // 预先清0的页框,开始时为空
+    list_init(&user_pool.zero_list);
 
-    // 将位图中该位清0
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0); 
+    put_str("  mem_pool_init done\n");
 
     return ;
 }
 
-// 去掉页表中虚拟地址vaddr的映射,只去掉vaddr对应的pte
-static void page_table_pte_remove(uint32_t vaddr)
+// 根据物理页框地址pg_phy_addr将其归还相应内存池的伙伴系统,不改动页表
+// 页框被写时复制共享时只减少引用计数
+void free_a_phy_page(uint32_t pg_phy_addr)
 {
-    uint32_t *pte = pte_ptr(vaddr);
-    *pte &= ~PG_P_1;     // 将页表项pte的P位置0
+    pfree(pg_phy_addr);
 
-    // 更新tlb
-    asm volatile("invlpg %0" ::"m"(vaddr)
-                 : "memory"); 
-                
     return ;
 }
 
-// 在虚拟地址池中释放以_vaddr起始的连续pg_cnt个虚拟页地址
-static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+// 打开或关闭CR4.PGE,开关时整个tlb都会被清空,cpu不支持全局页时什么也不做
+void page_global_enable(bool enable)
 {
-    uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr, cnt = 0;
-
-    if (pf == PF_KERNEL)         // 内核虚拟内存池
+    if (!pge_supported)
     {
-        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-        }
-
+        return ;
     }
-    else
-    {   // 用户虚拟内存池
-
-        struct task_struct *cur_thread = running_thread();
-        bit_idx_start = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
-
-        while (cnt < pg_cnt)
-        {
-            bitmap_set(&cur_thread->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-        }
 
-    }
+    uint32_t cr4 = 0;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 = enable ? (cr4 | CR4_PGE) : (cr4 & ~CR4_PGE);
+    asm volatile("movl %0, %%cr4" ::"r"(cr4) : "memory");
 
     return ;
 }
 
-// 释放以虚拟地址vaddr为起始的cnt个物理页框
-void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
+/**
+ * @brief
+ * 内核部分的页表项都加上G位并打开CR4.PGE。所有页目录的内核部分都指向同一组页表,
+ * 切换页目录重新加载cr3时,tlb中内核部分的表项不必清掉。
+ * loader为了进入高地址建立的0~4M恒等映射和内核的第一个页表是同一个,这里一并去掉,
+ * 否则低端地址的表项带着G位,会残留在用户进程的tlb中
+ */
+static void global_pages_init(void)
 {
-    uint32_t pg_phy_addr;
-    uint32_t vaddr = (int32_t)_vaddr, page_cnt = 0;
-
-    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
-
-    // 获取虚拟地址vaddr对应的物理地址
-    pg_phy_addr = addr_v2p(vaddr); 
+    uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
 
-    // 确保待释放的物理内存在低端1M+1k大小的页目录+1k大小的页表地址范围外
-    ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= 0x102000);
+    pge_supported = (edx & CPUID_PGE) != 0;
 
-    // 判断pg_phy_addr属于用户物理内存池还是内核物理内存池
-    if (pg_phy_addr >= user_pool.phy_addr_start)      // 位于user_pool内存池
+    if (!pge_supported)
     {
-        vaddr -= PG_SIZE;
+        put_str("  global pages not supported\n");
+        return ;
+    }
 
-        while (page_cnt < pg_cnt)
-        {
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
+    // 1 去掉恒等映射,之后访问低端1M要用0xc0000000以上的地址
+    *pde_ptr(0) = 0;
 
-            // 确保物理地址属于用户物理内存池
-            ASSERT((pg_phy_addr % PG_SIZE) == 0 && pg_phy_addr >= user_pool.phy_addr_start);
+    // 2 内核页表中存在的页表项都设为全局页,页目录项和最后一项自映射的页目录项不设
+    uint32_t pde_idx = 768;
 
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
+    while (pde_idx < 1023)
+    {
+        if (*pde_ptr(pde_idx << 22) & PG_P_1)
+        {
+            uint32_t *pte    = pte_ptr(pde_idx << 22);
+            uint32_t pte_idx = 0;
 
-            // 再从页表中清除此虚拟地址所在的页表项pte
-            page_table_pte_remove(vaddr);
+            while (pte_idx < 1024)
+            {
+                if (pte[pte_idx] & PG_P_1)
+                {
+                    pte[pte_idx] |= PG_GLOBAL;
+                }
 
-            page_cnt++;
+                pte_idx++;
+            }
         }
 
-        // 清空虚拟地址的位图中的相应位
-        vaddr_remove(pf, _vaddr, pg_cnt);
+        pde_idx++;
     }
-    else
-    {   // 位于kernel_pool内存池
 
-        vaddr -= PG_SIZE;
+    // 3 打开CR4.PGE,同时清空了整个tlb
+    page_global_enable(true);
+    put_str("  global pages enabled\n");
 
-        while (page_cnt < pg_cnt)
-        {
-            vaddr += PG_SIZE;
-            pg_phy_addr = addr_v2p(vaddr);
+    return ;
+}
 
-            // 确保待释放的物理内存只属于内核物理内存池
-            ASSERT((pg_phy_addr % PG_SIZE) == 0              &&
-                   pg_phy_addr >= kernel_pool.phy_addr_start &&
-                   pg_phy_addr < user_pool.phy_addr_start);
+/**
+ * @brief
+ * 把物理内存从0开始直接映射到DIRECT_MAP_BASE,最多DIRECT_MAP_MAX字节。
+ * cpu支持4M页时,4M对齐的整块直接用页目录项映射成大页,一个表项顶1024个页表项,
+ * 不足4M的尾部(或者不支持4M页时的全部)用4K页映射,用loader为内核空间建好的页表。
+ * 这些页目录项要在创建第一个用户进程之前建好,创建进程时才会复制到它的页目录中
+ */
+static void direct_map_init(uint32_t all_mem)
+{
+    uint32_t eax = 1, ebx = 0, ecx = 0, edx = 0;
+    asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
 
-            // 先将对应的物理页框归还到内存池
-            pfree(pg_phy_addr);
+    bool pse = (edx & CPUID_PSE) != 0;
 
-            // 再从页表中清除此虚拟地址所在的页表项pte
-            page_table_pte_remove(vaddr);
+    if (pse)
+    {
+        uint32_t cr4 = 0;
+        asm volatile("movl %%cr4, %0" : "=r"(cr4));
+        asm volatile("movl %0, %%cr4" ::"r"(cr4 | CR4_PSE) : "memory");
+    }
 
-            page_cnt++;
+    uint32_t map_size  = (all_mem < DIRECT_MAP_MAX ? all_mem : DIRECT_MAP_MAX) & 0xfffff000;
+    uint32_t phy       = 0;
+    uint32_t big_pages = 0;
+
+    while (phy < map_size)
+    {
+        uint32_t vaddr = DIRECT_MAP_BASE + phy;
+
+        if (pse && phy + 0x400000 <= map_size)
+        {
+            *pde_ptr(vaddr) = phy | PG_PS | PG_GLOBAL | PG_US_S | PG_RW_W | PG_P_1;
+            phy            += 0x400000;
+            big_pages++;
+            continue;
         }
 
-        // 清空虚拟地址的位图中的相应位
-        vaddr_remove(pf, _vaddr, pg_cnt);
+        *pte_ptr(vaddr) = phy | PG_GLOBAL | PG_US_S | PG_RW_W | PG_P_1;
+        phy            += PG_SIZE;
+    }
 
-    } // end if
+    // 重新加载cr3,清掉这些页目录项原来的缓存
+    uint32_t cr3 = 0;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+    asm volatile("movl %0, %%cr3" ::"r"(cr3) : "memory");
+
+    direct_map_size = map_size;
+
+    put_str("  direct map: ");
+    put_int(map_size);
+    put_str(" bytes, 4M pages: ");
+    put_int(big_pages);
+    put_str("\n");
 
     return ;
 }
 
-// 回收内存ptr
-void sys_free(void *ptr)
+// 内存管理部分初始化入口
+void mem_init(void)
 {
-    ASSERT(ptr != NULL);
-
-    if (ptr != NULL)
-    {
+    put_str("\nmem_init start\n");
+    uint32_t mem_bytes_total = (*(uint32_t *)(0xb00));
 
-        enum pool_flags PF;
-        struct pool *mem_pool;
+    // 按e820布局找出可用内存,mem_top是可用内存的最高地址
+    uint32_t mem_top = e820_parse(mem_bytes_total);
+    mem_pool_init(mem_top); // 初始化内存池
 
-        // 判断是线程还是进程
-        if (running_thread()->pgdir == NULL)
-        {
-            ASSERT((uint32_t)ptr >= K_HEAP_START);
-            PF = PF_KERNEL;
-            mem_pool = &kernel_pool;
-        }
-        else
-        {
-            PF = PF_USER;
-            mem_pool = &user_pool;
-        }
+    // 伙伴系统自检,分配再释放后各阶空闲块必须复原
+    buddy_self_test(&kernel_pool.zone);
+    buddy_self_test(&user_pool.zone);
+    put_str("  buddy self test done\n");
 
-        lock_acquire(&mem_pool->lock);
+    // 内核部分的映射设为全局页,切换进程时不再被清出tlb
+    global_pages_init();
 
-        struct mem_block *b = ptr;
-        struct arena *a     = block2arena(b);     // 把mem_block转换成arena,获取元信息
+    // 物理内存直接映射到DIRECT_MAP_BASE,之后的slab、页缓存等从直接映射区分配
+    // 要在global_pages_init之后,大页的页目录项不能当作页表遍历
+    direct_map_init(mem_top);
 
-        ASSERT(a->large == 0 || a->large == 1);
+    // 初始化mem_block_desc数组descs,为malloc做准备
+    block_desc_init(k_block_descs);
 
-        if (a->desc == NULL && a->large == true)
-        {   // 大于1024的内存
-            mfree_page(PF, a, a->cnt);
-        }
-        else
-        {   // 小于等于1024的内存块
-            // 先将内存块回收到free_list
-            list_append(&a->desc->free_list, &b->free_elem);
+    // 临时映射页框用的窗口,idle线程清0页框、换页和fork时使用
+    kmap_init();
 
-            // 再判断此arena中的内存块是否都是空闲,如果是就释放arena
-            if (++a->cnt == a->desc->blocks_per_arena)
-            {
-                uint32_t block_idx;
-                for (block_idx = 0; block_idx < a->desc->blocks_per_arena; block_idx++)
-                {
-                    struct mem_block *b = arena2block(a, block_idx);
-                    ASSERT(elem_find(&a->desc->free_list, &b->free_elem));
-                    list_remove(&b->free_elem);
-                }
+    // 读还没写过的匿名内存时映射的零页,从直接映射区分配,已经清0
+    void *zero_page = get_kernel_direct_pages(1);
+    ASSERT(zero_page != NULL);
+    zero_page_phyaddr = addr_v2p((uint32_t)zero_page);
+    phy_addr2page(zero_page_phyaddr)->flags |= PG_PINNED;
 
-                mfree_page(PF, a, 1);
-            }
+    // 初始化slab分配器,之后各模块才能创建自己的对象cache
+    kmem_cache_init();
 
-        }
+    // 打开KMALLOC_PROF时分配内核堆分配的记录表
+    kmprof_init();
 
-        // end if
-        lock_release(&mem_pool->lock);
+    // 用户地址空间的区域结构从slab分配
+    vma_init();
 
-    } //end if
+    // 注册缺页异常处理,写时复制的fork依赖它
+    page_fault_init();
+    put_str("mem_init done\n\n");
 
-    return ;
+    return;
 }
 
-// 为malloc做准备
-void block_desc_init(struct mem_block_desc *desc_array)
+/**
+ * @brief
+ * 返回zone分配2^order页时的碎片指数,乘了1000。有够大的空闲块、分配能成功时返回-1。
+ * 分配失败时,越接近1000说明空闲的页框够多、只是太零散,规整有用;越接近0说明是空闲页框本身不够
+ */
+static int32_t frag_index(struct buddy_zone *zone, uint32_t order)
 {
-    uint16_t desc_idx, block_size = 16;
+    uint32_t blocks = 0;
+    uint32_t cur    = 0;
 
-    // 初始化每个mem_block_desc描述符
-    for (desc_idx = 0; desc_idx < DESC_CNT; desc_idx++)
+    while (cur < BUDDY_MAX_ORDER)
     {
-        desc_array[desc_idx].block_size = block_size;
-
-        // 初始化arena中的内存块数量
-        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+        if (cur >= order && zone->free_area[cur].nr_free > 0)
+        {
+            return -1;
+        }
 
-        list_init(&desc_array[desc_idx].free_list);
+        blocks += zone->free_area[cur].nr_free;
+        cur++;
+    }
 
-        block_size *= 2; // 更新为下一个规格内存块
+    if (blocks == 0)
+    {
+        return 0;
     }
 
-    return ;
+    return 1000 - (1000 + zone->free_pages * 1000 / (1U << order)) / blocks;
 }
 
-// 初始化内存池
-static void mem_pool_init(uint32_t all_mem)
+// 打印内存池的使用情况,free blocks依次是0~10阶空闲块的个数
+static void pool_info(char *name, struct pool *mem_pool)
 {
-    put_str("  mem_pool_init start\n");
-
-    // 页表大小= 1页的页目录表+第0和第768个页目录项指向同一个页表+第769~1022个页目录项共指向254个页表,共256个页框
-    uint32_t page_table_size   = PG_SIZE * 256;
+    struct buddy_zone *zone = &mem_pool->zone;
 
-    // 0x100000为低端1M内存,用来记录当前已使用的内存字节数
-    uint32_t used_mem          = page_table_size + 0x100000; 
+    printk("%s: %d/%d pages free\n  free blocks:", name, zone->free_pages, mem_pool->pool_size / PG_SIZE);
 
-    // 用来存储目前可以用的内存字节数
-    uint32_t free_mem          = all_mem - used_mem;         
+    uint32_t order = 0;
+    while (order < BUDDY_MAX_ORDER)
+    {
+        printk(" %d", zone->free_area[order].nr_free);
+        order++;
+    }
 
-    // 1页为4k,不管总内存是不是4k的倍数,对于以页为单位的内存分配策略，不足1页的内存不用考虑了。
-    uint16_t all_free_pages    = free_mem / PG_SIZE;    // 用来保存可用内存字节数free_mem转换成的物理页数
-    uint16_t kernel_free_pages = all_free_pages / 2;    // kernel
-    uint16_t user_free_pages   = all_free_pages - kernel_free_pages;
+    // 碎片指数,每阶一个,"-"表示这一阶能分配成功
+    printk("\n  frag index:");
 
-    /**
-     * @brief 
-     * 为简化位图操作，余数不处理，坏处是这样做会丢内存。
-     * 好处是不用做内存的越界检查,因为位图表示的内存少于实际物理内存
-     * 
-     */
+    order = 0;
+    while (order < BUDDY_MAX_ORDER)
+    {
+        int32_t index = frag_index(zone, order);
 
-    uint32_t kbm_length = kernel_free_pages / 8;  // Kernel BitMap的长度,位图中的一位表示一页,以字节为单位
-    uint32_t ubm_length = user_free_pages / 8;    // User BitMap的长度
+        if (index < 0)
+        {
+            printk(" -");
+        }
+        else
+        {
+            printk(" %d", index);
+        }
 
-    uint32_t kp_start   = used_mem;               // Kernel Pool start,内核内存池的起始地址
+        order++;
+    }
 
-    // User Pool start,用户内存池的起始地址
-    uint32_t up_start   = kp_start + kernel_free_pages * PG_SIZE;
+    printk("\n  zeroed pages: %d/%d, hit %d, miss %d\n",
+           mem_pool->zero_cnt, ZERO_POOL_PAGES, mem_pool->zero_hit, mem_pool->zero_miss);
 
-    kernel_pool.phy_addr_start = kp_start;         // 用于记录内核物理内存池的起始地址
-    user_pool.phy_addr_start = up_start;           // 用户物理内存池的起始地址
+    return;
+}
 
-    // 两个起始物理地址初始化各自内存池的起始地址
-    kernel_pool.pool_size = kernel_free_pages * PG_SIZE; // kernel
-    user_pool.pool_size = user_free_pages * PG_SIZE;     // User
+/**
+ * @brief
+ * 打印内核和用户两方当前怎样划分物理内存。
+ * 一方用掉的页框 = 自己内存池中用掉的 - 借给对方的 + 从对方借来的,
+ * 预先清0的页框还没有分出去,算作空闲
+ */
+static void pool_split_info(void)
+{
+    uint32_t k_used = kernel_pool.pool_size / PG_SIZE - kernel_pool.zone.free_pages - kernel_pool.zero_cnt;
+    uint32_t u_used = user_pool.pool_size / PG_SIZE - user_pool.zone.free_pages - user_pool.zero_cnt;
 
-    // 初始化各自内存池中的容量宇节数
-    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length; // kernel
-    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;   // User
+    k_used = k_used - user_pool.borrowed + kernel_pool.borrowed;
+    u_used = u_used - kernel_pool.borrowed + user_pool.borrowed;
 
-    /**
-     * @brief Create 是初始化各自内存池所使用的位图。
-     * 位图是全局的数据，长度不固定。
-     * 全局或静态的数组需要在编译时知道其长度，
-     * 而我们需要根据总内存大小算出需要多少字节。
-     * 所以改为指定一块内存来生成位图.
-     */
+    printk("split: kernel %d pages (borrowed %d/%d), user %d pages (borrowed %d/%d)\n",
+           k_used, kernel_pool.borrowed, kernel_pool.borrow_max,
+           u_used, user_pool.borrowed, user_pool.borrow_max);
+    printk("  min watermark: kernel_pool %d, user_pool %d\n", kernel_pool.wmark_min, user_pool.wmark_min);
 
-    // 内核使用的最高地址是0xc009f000,这是主线程的栈地址.(内核的大小预计为70K左右
-    // 32M内存占用的位图是2k.内核内存池的位图先定在MEM_BITMAP_BASE(0xc009a000)处
-    kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;              
+    return;
+}
 
-    // 用户内存池的位图紧跟在内核内存池位图之后
-    user_pool.pool_bitmap.bits   = (void *)(MEM_BITMAP_BASE + kbm_length); 
+// 显示物理内存池、slab、页缓存和交换分区的使用情况
+void sys_meminfo(void)
+{
+    pool_info("kernel_pool", &kernel_pool);
+    pool_info("user_pool", &user_pool);
+    pool_split_info();
+    printk("compaction: runs %d, success %d, migrated %d pages\n", compact_runs, compact_success, compact_migrated);
+    kmem_cache_info();
+    page_cache_info();
+    swap_info();
 
-    // 输出内存池信息
-    put_str("  kernel_pool_bitmap_start: ");
-    put_int((int)kernel_pool.pool_bitmap.bits);
+    return;
+}
 
-    put_str("  kernel_pool_phy_addr_start: ");
-    put_int(kernel_pool.phy_addr_start);
+#ifdef BUDDY_BENCH
+// 伙伴系统的微基准测试,需要printk,在init_all之后调用
+void mem_bench(void)
+{
+    printk("buddy bench start\n");
+    buddy_bench(&kernel_pool.zone, "kernel_pool");
+    buddy_bench(&user_pool.zone, "user_pool");
+    printk("buddy bench done\n");
 
-    put_str("\n");
+    return;
+}
+#endif
 
-    put_str("  user_pool_bitmap_start:   ");
-    put_int((int)user_pool.pool_bitmap.bits);
+#ifdef MALLOC_BENCH
 
-    put_str("  user_pool_phy_addr_start:   ");
-    put_int(user_pool.phy_addr_start);
-    
-    put_str("\n");
+#define MALLOC_BENCH_THREADS 4         // 同时申请释放的内核线程数
+#define MALLOC_BENCH_ROUNDS  2000      // 每个线程的轮数
+#define MALLOC_BENCH_BATCH   8         // 每轮先申请再全部释放的块数,大小在16~128字节间轮换
 
-    // 将位图置0
-    bitmap_init(&kernel_pool.pool_bitmap);     // kernel
-    bitmap_init(&user_pool.pool_bitmap);       // user
+static struct semaphore bench_done;    // 每个线程做完后up一次
 
-    lock_init(&kernel_pool.lock);              // kernel，添加内核锁
-    lock_init(&user_pool.lock);                // user，添加用户锁
+// 压测线程,做完后把缓存的块还回去,然后一直阻塞
+static void malloc_bench_worker(void *arg UNUSED)
+{
+    void *blocks[MALLOC_BENCH_BATCH];
+    uint32_t round = 0;
 
-    // 下面初始化内核虚拟地址的位图,按实际物理内存大小生成数组。
-    // 用于维护内核堆的虚拟地址,所以要和内核内存池大小一致
-    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length; 
+    while (round < MALLOC_BENCH_ROUNDS)
+    {
+        uint32_t idx = 0;
+        while (idx < MALLOC_BENCH_BATCH)
+        {
+            blocks[idx] = sys_malloc(16 << (idx % 4));
+            ASSERT(blocks[idx] != NULL);
+            idx++;
+        }
 
-    // 位图的数组指向一块未使用的内存,目前定位在内核内存池和用户内存池之外
-    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
+        while (idx > 0)
+        {
+            sys_free(blocks[--idx]);
+        }
 
-    kernel_vaddr.vaddr_start = K_HEAP_START;
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
+        round++;
+    }
 
-    put_str("  mem_pool_init done\n");
+    mem_magazine_drain(running_thread());
+    sema_up(&bench_done);
+    thread_block(TASK_BLOCKED);
 
-    return ;
+    return;
 }
 
-// 根据物理页框地址pg_phy_addr在相应的内存池的位图清0,不改动页表
-void free_a_phy_page(uint32_t pg_phy_addr)
+// 测量当前配置下多个线程同时申请释放时,平均一对sys_malloc/sys_free的周期数
+static void malloc_bench_run(char *name)
 {
-    struct pool *mem_pool;
-    uint32_t bit_idx = 0;
+    sema_init(&bench_done, 0);
 
-    if (pg_phy_addr >= user_pool.phy_addr_start)
+    uint64_t start = rdtsc();
+
+    uint32_t thread_idx = 0;
+    while (thread_idx < MALLOC_BENCH_THREADS)
     {
-        mem_pool = &user_pool;
-        bit_idx = (pg_phy_addr - user_pool.phy_addr_start) / PG_SIZE;
+        thread_start("malloc_bench", default_prio, malloc_bench_worker, NULL);
+        thread_idx++;
     }
-    else
+
+    while (thread_idx > 0)
     {
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phy_addr - kernel_pool.phy_addr_start) / PG_SIZE;
+        sema_down(&bench_done);
+        thread_idx--;
     }
 
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    printk("  %s: %d cycles per malloc/free pair\n", name,
+           cycles / (MALLOC_BENCH_THREADS * MALLOC_BENCH_ROUNDS * MALLOC_BENCH_BATCH));
 
-    return ;
+    return;
 }
 
-// 内存管理部分初始化入口
-void mem_init(void)
+// sys_malloc的微基准测试,对比每次都拿内存池的锁和使用线程自己的内存块缓存,在init_all之后调用
+void malloc_bench(void)
 {
-    put_str("\nmem_init start\n");
-    uint32_t mem_bytes_total = (*(uint32_t *)(0xb00));
-    mem_pool_init(mem_bytes_total); // 初始化内存池
+    printk("malloc bench start\n");
 
-    // 初始化mem_block_desc数组descs,为malloc做准备
-    block_desc_init(k_block_descs);
-    put_str("mem_init done\n\n");
+    mag_enabled = false;
+    malloc_bench_run("pool lock every call");
+
+    mag_enabled = true;
+    malloc_bench_run("per-thread magazines");
+
+    printk("malloc bench done\n");
 
     return;
 }
+#endif
 
 /**
      * @brief
@@ -10,10 +10,38 @@
 #define PG_RW_W 2            // R/W 属性位值, 读/写/执行，RW位的值为W，即RW=1，表此页内存允许读、写、执行
 #define PG_US_S 0            // U/S 属性位值, 系统级，US=O，表示只允许特权级别为0、1、2的程序访问此页内存，特权级3程序不被允许。
 #define PG_US_U 4            // U/S 属性位值, 用户，表示允许所有特权级别程序访问此页内存。
+#define PG_ACCESSED 0x20     // 页表项的A位,cpu访问这一页时置1
+#define PG_DIRTY 0x40        // 页表项的D位,cpu写这一页时置1
+#define PG_PS   0x80         // 页目录项的PS位,为1时页目录项直接映射4M的大页,不再经过页表
+#define PG_GLOBAL 0x100      // 页表项的G位,打开CR4.PGE后重新加载cr3时不清除tlb中这一项,只用于内核部分
+#define PG_COW  0x200        // 页表项的第9位留给软件使用,这里用来标记写时复制的页,此时RW位为0
+#define PG_SWAP 0x400        // 页表项的第10位,P位为0时表示页已换出到交换分区,高20位是交换槽号
+
+// 页表项pte是否记录着换出到交换分区的页
+#define PTE_IS_SWAP(pte) (((pte) & (PG_P_1 | PG_SWAP)) == PG_SWAP)
+
+#define DIRECT_MAP_BASE 0xe0000000   // 物理内存直接映射区的起始虚拟地址,物理地址p映射在DIRECT_MAP_BASE + p
+#define DIRECT_MAP_MAX  0x1fc00000   // 直接映射区最多映射508M,到自映射的最后一个页目录项为止
+
+#define ZERO_POOL_PAGES   64      // 每个内存池最多预先清0的页框数
+#define ZERO_POOL_RESERVE 256     // 内存池的空闲页框不多于这个数时,不再预先清0页框
+
+#define POOL_WMARK_SHIFT  4       // 最低水位为内存池可用页框的1/16,借给另一方后空闲页框不能低于它
+#define POOL_BORROW_SHIFT 1       // 一方最多向另一方借对方可用页框的1/2
 
 // 16 32 64 128 256 512 1024
 #define DESC_CNT 7           // 内存块描述符个数
 
+#define MAG_SIZE  16         // 每个任务每种规格最多缓存的空闲内存块数
+#define MAG_BATCH 8          // 缓存空了或满了时,拿一次锁从arena取回或还回去的块数
+
+// 任务内存上限的种类,sys_memlimit的res参数
+#define MEM_RES_PAGES     0           // 映射着的用户页加上用户空间的页表页,缺页时检查
+#define MEM_RES_HEAP      1           // sys_malloc分配出去还没释放的字节数,sys_malloc时检查
+#define MEM_RES_CNT       2
+#define MEM_UNLIMITED     0xffffffff  // 不限制
+#define MEM_RESERVE_SHIFT 3           // exec出来的程序默认最多用用户内存池的7/8页框,剩下的留给init和shell
+
 // 内存池标记,用于判断用哪个内存池
 enum pool_flags
 {
@@ -44,8 +72,29 @@ struct mem_block_desc
     struct list free_list;     // 目前可用的mem_block链表
 };
 
+// 任务私有的空闲内存块缓存,每种规格一个,malloc和free先在这里取放,不用拿内存池的锁
+struct mem_magazine
+{
+    struct list blocks;        // 缓存的mem_block,最近释放的在链表头
+    uint32_t    cnt;           // 缓存的块数,不超过MAG_SIZE
+};
+
+// 任务占用的内存和上限,fork时随pcb复制给子进程,所以上限对整个进程子树都有效
+struct mem_usage
+{
+    uint32_t rss;                    // 映射着的用户页数,fork后共享的页在父子进程中各算一次
+    uint32_t rss_peak;               // rss的最大值
+    uint32_t pt_pages;               // 用户空间的页表页数
+    uint32_t heap_bytes;             // sys_malloc分配出去还没释放的字节数,按块或页的实际大小算
+    uint32_t limit[MEM_RES_CNT];     // 各种资源的上限,MEM_UNLIMITED表示不限制
+    uint32_t limit_hits;             // 因超过上限而失败的分配次数
+};
+
+struct task_struct;
+
 
 extern struct pool kernel_pool, user_pool; // 用来生成内核地址和用户地址
+extern struct mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符
 
 
 // 内存管理部分初始化入口
@@ -54,6 +103,12 @@ void mem_init(void);
 // 从内核物理内存池中申请pg_cnt页内存,成功则返回其虚拟地址,失败则返回NULL
 void *get_kernel_pages(uint32_t pg_cnt);  
 
+// 从内核物理内存池中申请物理上连续的pg_cnt页,返回其在直接映射区中的地址,页已清0,用mfree_page释放
+void *get_kernel_direct_pages(uint32_t pg_cnt);
+
+// 返回物理地址pg_phy_addr在直接映射区中的虚拟地址,超出直接映射区时返回NULL
+void *phy2kaddr(uint32_t pg_phy_addr);
+
 // 分配pg_cnt个页空间,成功则返回起始虚拟地址,失败时返回NULL
 void *malloc_page(enum pool_flags pf, uint32_t pg_cnt); 
 
@@ -66,21 +121,42 @@ uint32_t *pde_ptr(uint32_t vaddr);
 // 得到虚拟地址映射到的物理地址
 uint32_t addr_v2p(uint32_t vaddr); 
 
-// 将地址vaddr与pf池中的物理地址关联,仅支持一页空间分配
-void *get_a_page(enum pool_flags pf, uint32_t vaddr);
-
-// 在用户空间中申请4k内存，并返回虚地址
-void *get_user_pages(uint32_t pg_cnt);
-
-// 安装1页大小的vaddr,专门针对fork时虚拟地址位图无须操作的情况
-void *get_a_page_without_op_vaddrbitmap(enum pool_flags pf, uint32_t vaddr);
-
 // 初始化内存
 void block_desc_init(struct mem_block_desc *desc_array);
 
 // 在堆中申请size字节内存
 void *sys_malloc(uint32_t size); 
 
+// 把ptr指向的内存调整为size字节,后面的虚拟页空闲时原地扩大,失败返回NULL且ptr不变
+void *sys_realloc(void *ptr, uint32_t size);
+
+// 申请cnt个size字节的内存,已经清0,cnt * size溢出时返回NULL
+void *sys_calloc(uint32_t cnt, uint32_t size);
+
+// 初始化任务pthread的内存块缓存,创建任务和fork时调用
+void mem_magazine_init(struct task_struct *pthread);
+
+// 把内核线程pthread缓存的内存块都还给arena,线程退出时调用
+void mem_magazine_drain(struct task_struct *pthread);
+
+// 初始化内存占用的统计,各种资源都不限制
+void mem_usage_init(struct mem_usage *usage);
+
+// 任务t映射着的用户页数变化delta,换页时会修改别的进程的
+void mem_rss_add(struct task_struct *t, int32_t delta);
+
+// 当前任务再占用amount个res资源后是否还在上限之内,超出时记一次limit_hits
+bool mem_limit_check(uint32_t res, uint32_t amount);
+
+// exec出来的程序默认的页数上限,为用户内存池可用页框的7/8
+uint32_t mem_default_page_limit(void);
+
+// 把进程pid的内存占用复制到usage中,pid为0时是当前进程,成功返回0,没有此进程返回-1
+int32_t sys_memstat(int32_t pid, struct mem_usage *usage);
+
+// 设置当前进程res资源的上限为limit,之后fork的子进程也继承这个上限,成功返回0
+int32_t sys_memlimit(uint32_t res, uint32_t limit);
+
 // 释放内存
 // 释放以虚拟地址vaddr为起始的cnt个物理页框
 void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt); 
@@ -88,11 +164,73 @@ void mfree_page(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt);
 // 将物理地址pg_phy_addr回收到物理内存池
 void pfree(uint32_t pg_phy_addr); 
 
+// 批量释放phys中的cnt个物理页框,和逐个pfree效果相同,物理上连续的页框整块还给伙伴系统
+void pfree_batch(uint32_t *phys, uint32_t cnt);
+
 // 系统调用实现释放内存
 void sys_free(void *ptr);
 
-// 根据物理页框地址pg_phy_addr在相应的内存池的位图清0,不改动页表
+// 根据物理页框地址pg_phy_addr将其归还相应内存池的伙伴系统,不改动页表
+// 页框被写时复制共享时只减少引用计数
 void free_a_phy_page(uint32_t pg_phy_addr);
 
+// 物理页框pg_phy_addr又被一个页表项映射,引用计数加1
+void page_ref_inc(uint32_t pg_phy_addr);
+
+// 返回物理页框pg_phy_addr的引用计数
+uint32_t page_ref_count(uint32_t pg_phy_addr);
+
+// 返回全局零页的物理地址,零页内容全为0,只读映射给还没写过的匿名页
+uint32_t zero_page_phy(void);
+
+// 在pf池中分配一个要清0的物理页框,不做映射,*zeroed为true时页框已经清0,否则调用者映射后自己清0
+void *get_a_zeroed_phy_page(enum pool_flags pf, bool *zeroed);
+
+// 给预先清0的页框不够的内存池补充一页,由idle线程在没有别的线程要运行时调用,补充了返回true
+bool zero_pool_fill_one(void);
+
+// 打开或关闭CR4.PGE,开关时整个tlb都会被清空,cpu不支持全局页时什么也不做
+void page_global_enable(bool enable);
+
+// 物理页框pg_phy_addr是否分给了用户,页框可能在内核内存池中
+bool phy_is_user_page(uint32_t pg_phy_addr);
+
+// 在pf池中只分配一个物理页框,不做映射,成功返回物理地址,失败返回NULL
+void *get_a_phy_page(enum pool_flags pf);
+
+// 将虚拟地址vaddr映射到物理页框pg_phyaddr,vaddr原来必须没有映射
+void page_map(uint32_t vaddr, uint32_t pg_phyaddr);
+
+// 若用户页vaddr有映射,解除映射并归还物理页框,已换出的页归还交换槽,虚拟地址位图不变,之后访问会重新触发缺页
+void page_unmap(uint32_t vaddr);
+
+// 虚拟地址vaddr所在的页是否已经映射了物理页框
+bool page_present(uint32_t vaddr);
+
+// 把别处还持有着的页框pg_phyaddr也映射到用户页vaddr,页框的引用计数加1,cow为true时写这一页会先复制一份
+void page_map_shared(uint32_t vaddr, uint32_t pg_phyaddr, bool cow);
+
+// 设置已映射的用户页vaddr是否可写,写时复制的页保持只读,由缺页异常处理
+void page_set_writable(uint32_t vaddr, bool writable);
+
+// 已映射的页vaddr自上次调用以来是否被写过,返回前清除页表项的D位
+bool page_test_clean(uint32_t vaddr);
+
+// 为vaddr所在的页目录项创建一个空页表,返回vaddr对应的pte指针,失败返回NULL
+uint32_t *page_table_create(uint32_t vaddr);
+
+// 显示物理内存池、slab、页缓存和交换分区的使用情况
+void sys_meminfo(void);
+
+#ifdef BUDDY_BENCH
+// 伙伴系统的微基准测试,需要printk,在init_all之后调用
+void mem_bench(void);
+#endif
+
+#ifdef MALLOC_BENCH
+// sys_malloc的微基准测试,对比每次都拿内存池的锁和使用线程自己的内存块缓存,在init_all之后调用
+void malloc_bench(void);
+#endif
+
 
 #endif // __KERNEL_MEMORY_H
\ No newline at end of file
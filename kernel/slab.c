@@ -0,0 +1,352 @@
+#include "slab.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "print.h"
+#include "../lib/string.h"
+#include "../lib/kernel/list.h"
+#include "../lib/kernel/stdio-kernel.h"
+
+/**
+ * @brief
+ * slab分配器
+ *
+ * sys_malloc按16~1024的固定规格分配,每次还要经过内存池的锁和整块的memset,
+ * 对inode、dir这类频繁创建销毁的定长对象来说既慢又浪费。
+ * 这里为每种对象建一个cache,cache以页为单位向伙伴系统申请slab,
+ * slab开头是描述符,后面按对象大小切分,空闲对象串成单链表:
+ *
+ *      .------------.--------.--------.--------.-----.
+ *      | struct slab |  obj0  |  obj1  |  obj2  | ... |
+ *      '------------'--------'--------'--------'-----'
+ *
+ * 对象的地址按4K取整就是slab描述符,所以释放时不需要查找。
+ * pcb这种正好一页的对象放不下描述符,cache直接把空闲页串成单链表缓存起来。
+ * 分配和释放都只在关中断的情况下摘挂链表,只有slab不够用时才会去申请页框
+ */
+
+static struct kmem_cache cache_cache;      // 用来分配struct kmem_cache的cache,静态创建
+static struct list       cache_chain;      // 所有的cache
+
+// 是否是整页对象的cache
+static bool is_page_cache(struct kmem_cache *cache)
+{
+    return cache->obj_size == PG_SIZE;
+}
+
+// 返回对象obj所在的slab
+static struct slab *obj2slab(void *obj)
+{
+    return (struct slab *)((uint32_t)obj & 0xfffff000);
+}
+
+// 返回slab中第idx个对象的地址
+static void *slab2obj(struct kmem_cache *cache, struct slab *s, uint32_t idx)
+{
+    return (void *)((uint32_t)(s + 1) + idx * cache->obj_size);
+}
+
+// 初始化cache的各个成员
+static void cache_setup(struct kmem_cache *cache, const char *name, uint32_t obj_size, void (*ctor)(void *obj))
+{
+    memset(cache, 0, sizeof(struct kmem_cache));
+
+    ASSERT(strlen(name) < KMEM_NAME_LEN);
+    strcpy(cache->name, name);
+
+    // 空闲时对象的前4字节要存放链表指针,所以至少4字节并按4字节对齐
+    obj_size = obj_size < sizeof(void *) ? sizeof(void *) : obj_size;
+    cache->obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    cache->ctor     = ctor;
+
+    ASSERT(cache->obj_size <= SLAB_MAX_SIZE || cache->obj_size == PG_SIZE);
+
+    if (is_page_cache(cache))
+    {
+        cache->objs_per_slab = 1;
+    }
+    else
+    {
+        cache->objs_per_slab = (PG_SIZE - sizeof(struct slab)) / cache->obj_size;
+    }
+
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_free);
+
+    return;
+}
+
+// 向伙伴系统申请一页,切分成对象后挂到空slab链表上,失败返回false
+static bool cache_grow(struct kmem_cache *cache)
+{
+    // 申请页框时可能会在内存池的锁上阻塞,不能在关中断的情况下调用,slab放在直接映射区
+    void *page = get_kernel_direct_pages(1);
+
+    if (page == NULL)
+    {
+        return false;
+    }
+
+    enum intr_status old_status = intr_disable();
+
+    cache->nr_slabs++;
+    cache->grow_cnt++;
+
+    if (is_page_cache(cache))
+    {
+        *(void **)page    = cache->free_pages;
+        cache->free_pages = page;
+        cache->nr_free_slabs++;
+
+        intr_set_status(old_status);
+        return true;
+    }
+
+    struct slab *s = (struct slab *)page;
+    s->cache       = cache;
+    s->inuse       = 0;
+    s->free_obj    = NULL;
+
+    // 从后往前挂,使低地址的对象先被分配
+    uint32_t obj_idx = cache->objs_per_slab;
+    while (obj_idx-- > 0)
+    {
+        void *obj = slab2obj(cache, s, obj_idx);
+
+        *(void **)obj = s->free_obj;
+        s->free_obj   = obj;
+    }
+
+    list_append(&cache->slabs_free, &s->slab_tag);
+    cache->nr_free_slabs++;
+
+    intr_set_status(old_status);
+
+    return true;
+}
+
+// 初始化slab分配器,在伙伴系统初始化之后调用
+void kmem_cache_init(void)
+{
+    put_str("  kmem_cache_init start\n");
+
+    list_init(&cache_chain);
+
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL);
+    list_append(&cache_chain, &cache_cache.cache_tag);
+
+    put_str("  kmem_cache_init done\n");
+
+    return;
+}
+
+// 创建对象大小为obj_size的cache,ctor为对象的构造函数,失败返回NULL
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t obj_size, void (*ctor)(void *obj))
+{
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache_setup(cache, name, obj_size, ctor);
+
+    enum intr_status old_status = intr_disable();
+    list_append(&cache_chain, &cache->cache_tag);
+    intr_set_status(old_status);
+
+    return cache;
+}
+
+// 从cache中分配一个对象,失败返回NULL
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    enum intr_status old_status = intr_disable();
+    void *obj;
+
+    // 部分分配的slab优先,其次是空slab,都没有才向伙伴系统申请
+    while (list_empty(&cache->slabs_partial) && cache->nr_free_slabs == 0)
+    {
+        intr_set_status(old_status);
+
+        if (!cache_grow(cache))
+        {
+            return NULL;
+        }
+
+        old_status = intr_disable();
+    }
+
+    if (is_page_cache(cache))
+    {
+        obj               = cache->free_pages;
+        cache->free_pages = *(void **)obj;
+        cache->nr_free_slabs--;
+    }
+    else
+    {
+        struct slab *s;
+
+        if (!list_empty(&cache->slabs_partial))
+        {
+            s = elem2entry(struct slab, slab_tag, cache->slabs_partial.head.next);
+        }
+        else
+        {
+            s = elem2entry(struct slab, slab_tag, cache->slabs_free.head.next);
+            list_remove(&s->slab_tag);
+            list_push(&cache->slabs_partial, &s->slab_tag);
+            cache->nr_free_slabs--;
+        }
+
+        obj         = s->free_obj;
+        s->free_obj = *(void **)obj;
+        s->inuse++;
+
+        // slab被分配满了,移到full链表
+        if (s->inuse == cache->objs_per_slab)
+        {
+            list_remove(&s->slab_tag);
+            list_push(&cache->slabs_full, &s->slab_tag);
+        }
+    }
+
+    cache->active_objs++;
+    cache->alloc_cnt++;
+
+    intr_set_status(old_status);
+
+    // 空闲对象的前4字节被链表指针覆盖过,所以构造函数每次分配都要调用,而不是只在切分slab时调用一次
+    if (cache->ctor != NULL)
+    {
+        cache->ctor(obj);
+    }
+
+    return obj;
+}
+
+// 将对象obj归还cache
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    ASSERT(obj != NULL && cache->active_objs > 0);
+
+    enum intr_status old_status = intr_disable();
+    void *release_page = NULL;
+
+    cache->active_objs--;
+    cache->free_cnt++;
+
+    if (is_page_cache(cache))
+    {
+        ASSERT(((uint32_t)obj & 0xfff) == 0);
+
+        if (cache->nr_free_slabs < SLAB_FREE_KEEP)
+        {
+            *(void **)obj     = cache->free_pages;
+            cache->free_pages = obj;
+            cache->nr_free_slabs++;
+        }
+        else
+        {
+            release_page = obj;
+        }
+    }
+    else
+    {
+        struct slab *s = obj2slab(obj);
+        ASSERT(s->cache == cache && s->inuse > 0);
+
+        // 对象从满slab中释放,slab变为部分分配
+        if (s->inuse == cache->objs_per_slab)
+        {
+            list_remove(&s->slab_tag);
+            list_push(&cache->slabs_partial, &s->slab_tag);
+        }
+
+        *(void **)obj = s->free_obj;
+        s->free_obj   = obj;
+        s->inuse--;
+
+        // slab全空了,空slab太多就还给伙伴系统
+        if (s->inuse == 0)
+        {
+            list_remove(&s->slab_tag);
+
+            if (cache->nr_free_slabs < SLAB_FREE_KEEP)
+            {
+                list_push(&cache->slabs_free, &s->slab_tag);
+                cache->nr_free_slabs++;
+            }
+            else
+            {
+                release_page = s;
+            }
+        }
+    }
+
+    if (release_page != NULL)
+    {
+        cache->nr_slabs--;
+        mfree_page(PF_KERNEL, release_page, 1);
+    }
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 销毁cache,cache中的对象必须已经全部释放
+void kmem_cache_destroy(struct kmem_cache *cache)
+{
+    ASSERT(cache != &cache_cache && cache->active_objs == 0);
+
+    enum intr_status old_status = intr_disable();
+    list_remove(&cache->cache_tag);
+    intr_set_status(old_status);
+
+    if (is_page_cache(cache))
+    {
+        while (cache->free_pages != NULL)
+        {
+            void *page        = cache->free_pages;
+            cache->free_pages = *(void **)page;
+            mfree_page(PF_KERNEL, page, 1);
+        }
+    }
+    else
+    {
+        while (!list_empty(&cache->slabs_free))
+        {
+            mfree_page(PF_KERNEL, elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free)), 1);
+        }
+    }
+
+    kmem_cache_free(&cache_cache, cache);
+
+    return;
+}
+
+// 打印一个cache的统计信息,作为list_traversal的回调函数
+static bool cache_info(struct list_elem *elem, int arg UNUSED)
+{
+    struct kmem_cache *cache = elem2entry(struct kmem_cache, cache_tag, elem);
+
+    printk("  %s: size %d, objs %d/%d, slabs %d, alloc %d, free %d, grow %d\n",
+           cache->name, cache->obj_size, cache->active_objs, cache->nr_slabs * cache->objs_per_slab,
+           cache->nr_slabs, cache->alloc_cnt, cache->free_cnt, cache->grow_cnt);
+
+    // 返回false是为了让list_traversal继续遍历
+    return false;
+}
+
+// 打印所有cache的统计信息
+void kmem_cache_info(void)
+{
+    printk("slab caches:\n");
+    list_traversal(&cache_chain, cache_info, 0);
+
+    return;
+}
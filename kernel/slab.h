@@ -0,0 +1,64 @@
+#ifndef __KERNEL_SLAB_H
+#define __KERNEL_SLAB_H
+#include "stdint.h"
+#include "global.h"
+#include "../lib/kernel/list.h"
+
+#define KMEM_NAME_LEN  16          // cache名字的最大长度
+#define SLAB_MAX_SIZE  1024        // 页内slab能容纳的最大对象,再大的只支持整页对象
+#define SLAB_FREE_KEEP 2           // 每个cache最多保留的空slab数,多出来的还给伙伴系统
+
+// slab描述符,和arena一样放在slab所在页框的开头,对象紧跟其后
+struct slab
+{
+    struct kmem_cache *cache;      // 此slab所属的cache
+    struct list_elem   slab_tag;   // 挂在cache的full/partial/free链表上
+    void              *free_obj;   // 空闲对象单链表,空闲对象的前4字节存放下一个空闲对象的地址
+    uint32_t           inuse;      // 已分配出去的对象数
+};
+
+// 对象缓存,同一种内核对象使用同一个cache
+struct kmem_cache
+{
+    char     name[KMEM_NAME_LEN];
+    uint32_t obj_size;             // 对象大小,按4字节对齐
+    uint32_t objs_per_slab;        // 每个slab容纳的对象数
+    void   (*ctor)(void *obj);     // 构造函数,每次分配出对象后调用,可以为NULL
+
+    struct list slabs_full;        // 对象全部分配出去的slab
+    struct list slabs_partial;     // 部分分配出去的slab
+    struct list slabs_free;        // 对象全部空闲的slab
+    uint32_t    nr_free_slabs;     // 空slab数,对整页对象来说就是缓存着的空闲页数
+
+    // 整页对象(如pcb)没有放slab描述符的地方,空闲页直接串成单链表
+    void       *free_pages;
+
+    // 统计信息
+    uint32_t nr_slabs;             // 当前持有的页框数
+    uint32_t active_objs;          // 已分配出去的对象数
+    uint32_t alloc_cnt;            // 累计分配次数
+    uint32_t free_cnt;             // 累计释放次数
+    uint32_t grow_cnt;             // 累计向伙伴系统申请页框的次数
+
+    struct list_elem cache_tag;    // 挂在全局的cache_chain上
+};
+
+// 初始化slab分配器,在伙伴系统初始化之后调用
+void kmem_cache_init(void);
+
+// 创建对象大小为obj_size的cache,ctor为对象的构造函数,每次分配都会调用,失败返回NULL
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t obj_size, void (*ctor)(void *obj));
+
+// 从cache中分配一个对象,失败返回NULL
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+// 将对象obj归还cache
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+// 销毁cache,cache中的对象必须已经全部释放
+void kmem_cache_destroy(struct kmem_cache *cache);
+
+// 打印所有cache的统计信息
+void kmem_cache_info(void);
+
+#endif // __KERNEL_SLAB_H
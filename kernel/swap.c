@@ -0,0 +1,419 @@
+#include "swap.h"
+#include "memory.h"
+#include "kmap.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "../lib/string.h"
+#include "../lib/kernel/list.h"
+#include "../lib/kernel/stdio-kernel.h"
+#include "../thread/thread.h"
+#include "../thread/sync.h"
+#include "../device/ide.h"
+#include "../userprog/process.h"
+
+/**
+ * @brief
+ * 交换分区和页面回收
+ *
+ * 用户内存池用完时,把一段时间没访问过的用户页写到交换分区上,腾出页框给新的分配。
+ * 交换分区按页划分为交换槽,换出的页在页表项中记下槽号并打上PG_SWAP标记(P位为0),
+ * 进程再访问这一页时触发缺页异常,由swap_in从交换槽读回来。
+ * fork会复制页表项,所以每个交换槽有引用计数,最后一个引用它的页表项去掉后才空闲。
+ *
+ * 回收用时钟算法:时钟指针按pid顺序轮流扫描各个进程的页表,
+ * 页表项的A位为1说明最近访问过,清0后给它第二次机会,A位为0的页才换出。
+ * 只换出引用计数为1的用户内存池页框,写时复制共享着的页和映射着的页缓存不换出。
+ *
+ * 别的进程的页表不在当前的地址空间中,扫描时用kmap访问页表所在的页框(见kernel/kmap.c)。
+ * 扫描在关中断下进行,选中的页先在页表项中换成交换槽号,再持有swap_lock写到交换分区,
+ * swap_in也要持有swap_lock,所以不会读到还没写完的交换槽
+ */
+
+// 一个选中要换出的页
+struct swap_victim
+{
+    uint32_t pg_phyaddr;           // 页框的物理地址
+    uint32_t slot;                 // 写到哪个交换槽
+};
+
+static struct partition *swap_part;        // 交换分区,为NULL表示没有启用换页
+static uint32_t          nr_slots;         // 交换槽数
+static uint16_t         *slot_refs;        // 每个交换槽被多少个页表项引用,0为空闲,每个进程至多引用一次,16位够pid的上限用
+static uint32_t          slot_hint;        // 下次从这里开始找空闲交换槽
+static uint32_t          used_slots;       // 已用的交换槽数
+static struct lock       swap_lock;        // 读写交换分区和使用KMAP_SWAP_DATA窗口时持有
+
+// 时钟指针,下次从进程clock_pid的clock_vaddr处开始扫描
+static pid_t    clock_pid;
+static uint32_t clock_vaddr;
+
+// 统计信息
+static uint32_t swap_out_cnt;              // 累计换出的页数
+static uint32_t swap_in_cnt;               // 累计换入的页数
+
+// 使当前tlb中vaddr的缓存失效
+static void swap_tlb_flush(uint32_t vaddr)
+{
+    asm volatile("invlpg (%0)" ::"r"(vaddr)
+                 : "memory");
+
+    return;
+}
+
+// 交换槽slot的起始扇区
+static uint32_t slot2lba(uint32_t slot)
+{
+    return swap_part->start_lba + slot * (PG_SIZE / 512);
+}
+
+// 分配一个空闲交换槽,引用计数置1,没有空闲的返回-1,关中断时调用
+static int32_t slot_alloc(void)
+{
+    uint32_t cnt = 0;
+
+    while (cnt < nr_slots)
+    {
+        uint32_t slot = slot_hint;
+        slot_hint     = (slot_hint + 1) % nr_slots;
+
+        if (slot_refs[slot] == 0)
+        {
+            slot_refs[slot] = 1;
+            used_slots++;
+            return (int32_t)slot;
+        }
+
+        cnt++;
+    }
+
+    return -1;
+}
+
+// 页目录pgdir是否就是当前cr3中的页目录
+static bool pgdir_is_current(uint32_t *pgdir)
+{
+    uint32_t cr3 = 0;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+
+    return (cr3 & 0xfffff000) == addr_v2p((uint32_t)pgdir);
+}
+
+// 返回pid大于等于from的第一个有用户空间且还没退出的进程,没有则返回NULL,关中断时调用
+static struct task_struct *clock_task(pid_t from)
+{
+    struct task_struct *found = NULL;
+    struct list_elem *elem    = thread_all_list.head.next;
+
+    while (elem != &thread_all_list.tail)
+    {
+        struct task_struct *t = elem2entry(struct task_struct, all_list_tag, elem);
+
+        if (t->pgdir != NULL && t->status != TASK_HANGING && t->status != TASK_DIED &&
+            t->pid >= from && (found == NULL || t->pid < found->pid))
+        {
+            found = t;
+        }
+
+        elem = elem->next;
+    }
+
+    return found;
+}
+
+/**
+ * @brief
+ * 从clock_vaddr开始扫描进程t的页表,把选中的页换成交换槽号记到victims中,
+ * 已选中nr个,最多选到max个,budget为还能检查的页表项数。返回选中后的总数,
+ * 扫完整个用户空间时把时钟指针移到下一个进程。关中断时调用
+ */
+static uint32_t clock_scan_task(struct task_struct *t, struct swap_victim *victims, uint32_t nr,
+                                uint32_t max, uint32_t *budget)
+{
+    bool     current = pgdir_is_current(t->pgdir);
+    uint32_t vaddr   = clock_vaddr;
+
+    while (vaddr < 0xc0000000 && nr < max && *budget > 0)
+    {
+        uint32_t pde = t->pgdir[vaddr >> 22];
+
+        if (!(pde & PG_P_1))
+        {
+            vaddr = (vaddr & 0xffc00000) + 0x400000;
+            continue;
+        }
+
+        uint32_t *ptes    = kmap(KMAP_SWAP_PT, pde & 0xfffff000);
+        uint32_t  pte_idx = (vaddr >> 12) & 0x3ff;
+
+        while (pte_idx < 1024 && nr < max && *budget > 0)
+        {
+            uint32_t pte        = ptes[pte_idx];
+            uint32_t pg_phyaddr = pte & 0xfffff000;
+            uint32_t pg_vaddr   = (vaddr & 0xffc00000) + pte_idx * PG_SIZE;
+
+            pte_idx++;
+
+            if (!(pte & PG_P_1) || (pte & PG_COW) || !phy_is_user_page(pg_phyaddr) ||
+                page_ref_count(pg_phyaddr) != 1)
+            {
+                continue;
+            }
+
+            (*budget)--;
+
+            // 最近访问过,给它第二次机会
+            if (pte & PG_ACCESSED)
+            {
+                ptes[pte_idx - 1] = pte & ~PG_ACCESSED;
+
+                if (current)
+                {
+                    swap_tlb_flush(pg_vaddr);
+                }
+
+                continue;
+            }
+
+            int32_t slot = slot_alloc();
+
+            if (slot == -1)
+            {
+                *budget = 0;
+                break;
+            }
+
+            // 页表项中保留可写和脏的属性,换入时恢复
+            ptes[pte_idx - 1] = ((uint32_t)slot << 12) | PG_SWAP | (pte & (PG_RW_W | PG_DIRTY));
+
+            if (current)
+            {
+                swap_tlb_flush(pg_vaddr);
+            }
+
+            victims[nr].pg_phyaddr = pg_phyaddr;
+            victims[nr].slot       = slot;
+            nr++;
+
+            mem_rss_add(t, -1);
+        }
+
+        kunmap(KMAP_SWAP_PT, ptes);
+        vaddr = (vaddr & 0xffc00000) + pte_idx * PG_SIZE;
+    }
+
+    // 这个进程扫完了,转到下一个进程
+    if (vaddr >= 0xc0000000)
+    {
+        clock_pid   = t->pid + 1;
+        clock_vaddr = USER_VADDR_START;
+    }
+    else
+    {
+        clock_pid   = t->pid;
+        clock_vaddr = vaddr;
+    }
+
+    return nr;
+}
+
+// 查找交换分区并初始化交换槽,在filesys_init之后调用,没有交换分区时不启用换页
+void swap_init(void)
+{
+    printk("swap_init start\n");
+
+    lock_init(&swap_lock);
+
+    struct list_elem *elem = partition_list.head.next;
+
+    while (elem != &partition_list.tail)
+    {
+        struct partition *part = elem2entry(struct partition, part_tag, elem);
+
+        if (!strcmp(part->name, SWAP_PART_NAME))
+        {
+            swap_part = part;
+            break;
+        }
+
+        elem = elem->next;
+    }
+
+    if (swap_part == NULL)
+    {
+        printk("swap partition %s not found, swapping disabled\n", SWAP_PART_NAME);
+        return;
+    }
+
+    nr_slots = swap_part->sec_cnt / (PG_SIZE / 512);
+    nr_slots = nr_slots < SWAP_MAX_SLOTS ? nr_slots : SWAP_MAX_SLOTS;
+
+    slot_refs = get_kernel_pages(DIV_ROUND_UP(nr_slots * sizeof(uint16_t), PG_SIZE));
+
+    if (nr_slots == 0 || slot_refs == NULL)
+    {
+        PANIC("swap_init: no memory for swap");
+    }
+
+    clock_vaddr = USER_VADDR_START;
+
+    printk("swap on %s, %d slots\n", swap_part->name, nr_slots);
+    printk("swap_init done\n");
+
+    return;
+}
+
+// 把不常用的用户页换出到交换分区,释放至多want个物理页框,返回实际释放的页框数
+uint32_t swap_reclaim(uint32_t want)
+{
+    if (swap_part == NULL || want == 0)
+    {
+        return 0;
+    }
+
+    struct swap_victim victims[SWAP_BATCH];
+    uint32_t max    = want < SWAP_BATCH ? want : SWAP_BATCH;
+    uint32_t budget = SWAP_SCAN_MAX;
+    uint32_t nr     = 0;
+    uint32_t rounds = 0;
+
+    lock_acquire(&swap_lock);
+
+    // 1 关中断扫描,页表在扫描过程中不会被改动,扫过所有进程两遍还不够就放弃
+    enum intr_status old_status = intr_disable();
+
+    while (nr < max && budget > 0 && rounds < 2)
+    {
+        struct task_struct *t = clock_task(clock_pid);
+
+        if (t == NULL)
+        {
+            // 已经到最后一个进程,从头开始
+            clock_pid   = 0;
+            clock_vaddr = USER_VADDR_START;
+            rounds++;
+            continue;
+        }
+
+        if (t->pid != clock_pid)
+        {
+            clock_vaddr = USER_VADDR_START;
+        }
+
+        nr = clock_scan_task(t, victims, nr, max, &budget);
+    }
+
+    intr_set_status(old_status);
+
+    // 2 把选中的页写到交换槽,然后释放页框
+    uint32_t idx = 0;
+
+    while (idx < nr)
+    {
+        void *kaddr = kmap(KMAP_SWAP_DATA, victims[idx].pg_phyaddr);
+        ide_write(swap_part->my_disk, slot2lba(victims[idx].slot), kaddr, PG_SIZE / 512);
+        kunmap(KMAP_SWAP_DATA, kaddr);
+
+        pfree(victims[idx].pg_phyaddr);
+        swap_out_cnt++;
+        idx++;
+    }
+
+    lock_release(&swap_lock);
+
+    return nr;
+}
+
+// 把当前进程换出到交换分区的页vaddr读回来,成功返回true
+bool swap_in(uint32_t vaddr)
+{
+    vaddr &= 0xfffff000;
+
+    // 先分配页框再拿swap_lock,分配不到时的回收也要拿swap_lock
+    uint32_t pg_phyaddr = (uint32_t)get_a_phy_page(PF_USER);
+
+    if (pg_phyaddr == 0)
+    {
+        return false;
+    }
+
+    lock_acquire(&swap_lock);
+
+    // 拿锁期间同一进程的其他线程可能已经把这一页换入了
+    uint32_t *pte  = pte_ptr(vaddr);
+    uint32_t entry = (*pde_ptr(vaddr) & PG_P_1) ? *pte : 0;
+
+    if (!PTE_IS_SWAP(entry))
+    {
+        lock_release(&swap_lock);
+        pfree(pg_phyaddr);
+
+        return (entry & PG_P_1) != 0;
+    }
+
+    // 先通过kmap读到新页框中,页表项一直保持换出的状态,读完再映射
+    void *kaddr = kmap(KMAP_SWAP_DATA, pg_phyaddr);
+    ide_read(swap_part->my_disk, slot2lba(entry >> 12), kaddr, PG_SIZE / 512);
+    kunmap(KMAP_SWAP_DATA, kaddr);
+
+    enum intr_status old_status = intr_disable();
+
+    *pte = pg_phyaddr | PG_US_U | PG_P_1 | (entry & (PG_RW_W | PG_DIRTY));
+    swap_tlb_flush(vaddr);
+    swap_free_entry(entry);
+    mem_rss_add(running_thread(), 1);
+
+    intr_set_status(old_status);
+
+    swap_in_cnt++;
+    running_thread()->maj_flt++;
+
+    lock_release(&swap_lock);
+
+    return true;
+}
+
+// 页表项pte记录的交换槽又被一个页表项引用,fork复制页表时调用
+void swap_dup_entry(uint32_t pte)
+{
+    uint32_t slot = pte >> 12;
+    ASSERT(PTE_IS_SWAP(pte) && slot < nr_slots && slot_refs[slot] > 0 && slot_refs[slot] < 0xffff);
+
+    enum intr_status old_status = intr_disable();
+    slot_refs[slot]++;
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 页表项pte不再引用它记录的交换槽,没有页表项引用时交换槽变为空闲
+void swap_free_entry(uint32_t pte)
+{
+    uint32_t slot = pte >> 12;
+    ASSERT(PTE_IS_SWAP(pte) && slot < nr_slots && slot_refs[slot] > 0);
+
+    enum intr_status old_status = intr_disable();
+
+    if (--slot_refs[slot] == 0)
+    {
+        used_slots--;
+    }
+
+    intr_set_status(old_status);
+
+    return;
+}
+
+// 打印交换分区的使用情况
+void swap_info(void)
+{
+    if (swap_part == NULL)
+    {
+        printk("swap: off\n");
+        return;
+    }
+
+    printk("swap: %s, slots %d/%d, swap out %d, swap in %d\n",
+           swap_part->name, used_slots, nr_slots, swap_out_cnt, swap_in_cnt);
+
+    return;
+}
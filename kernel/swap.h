@@ -0,0 +1,29 @@
+#ifndef __KERNEL_SWAP_H
+#define __KERNEL_SWAP_H
+#include "stdint.h"
+#include "global.h"
+
+#define SWAP_PART_NAME  "sdb9"     // 留作交换分区的分区,文件系统初始化时不格式化它
+#define SWAP_MAX_SLOTS  16384      // 最多使用的交换槽数,每槽一页,即64M
+#define SWAP_BATCH      8          // 一次回收最多换出的页数
+#define SWAP_SCAN_MAX   4096       // 一次回收最多检查的页表项数
+
+// 查找交换分区并初始化交换槽,在filesys_init之后调用,没有交换分区时不启用换页
+void swap_init(void);
+
+// 把不常用的用户页换出到交换分区,释放至多want个物理页框,返回实际释放的页框数
+uint32_t swap_reclaim(uint32_t want);
+
+// 把当前进程换出到交换分区的页vaddr读回来,成功返回true
+bool swap_in(uint32_t vaddr);
+
+// 页表项pte记录的交换槽又被一个页表项引用,fork复制页表时调用
+void swap_dup_entry(uint32_t pte);
+
+// 页表项pte不再引用它记录的交换槽,没有页表项引用时交换槽变为空闲
+void swap_free_entry(uint32_t pte);
+
+// 打印交换分区的使用情况
+void swap_info(void);
+
+#endif // __KERNEL_SWAP_H
@@ -0,0 +1,735 @@
+#include "vma.h"
+#include "memory.h"
+#include "slab.h"
+#include "debug.h"
+#include "print.h"
+#include "../lib/string.h"
+#include "../thread/thread.h"
+#include "../userprog/process.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../fs/page-cache.h"
+
+/**
+ * @brief
+ * 用户地址空间的区域树
+ *
+ * 原来每个进程用一张覆盖0x8048000~0xc0000000的位图管理用户虚拟地址,
+ * 每个进程固定占用96K内核内存,fork时还要整张复制。
+ * 现在用户空间由若干互不重叠的区域描述,每个区域记录地址范围、访问属性和后备存储,
+ * 区域按起始地址组织成AVL树,查找和插入都是O(log n)。
+ * 属性相同的相邻匿名区域会合并,所以堆再怎么分配,区域数也不会很多。
+ *
+ * 区域的地址互不重叠,所以在不越过前后区域的情况下修改start或end不会破坏树的有序性,
+ * 合并和截断时直接修改,不必先删除再插入
+ */
+
+static struct kmem_cache *vma_cache;
+
+// 返回以v为根的子树高度
+static int8_t vma_height(struct vm_area *v)
+{
+    return v == NULL ? 0 : v->height;
+}
+
+// 根据左右子树更新v的高度
+static void vma_update_height(struct vm_area *v)
+{
+    int8_t hl = vma_height(v->left);
+    int8_t hr = vma_height(v->right);
+
+    v->height = (hl > hr ? hl : hr) + 1;
+
+    return;
+}
+
+// 右旋,返回新的子树根
+static struct vm_area *vma_rotate_right(struct vm_area *y)
+{
+    struct vm_area *x = y->left;
+
+    y->left  = x->right;
+    x->right = y;
+
+    vma_update_height(y);
+    vma_update_height(x);
+
+    return x;
+}
+
+// 左旋,返回新的子树根
+static struct vm_area *vma_rotate_left(struct vm_area *x)
+{
+    struct vm_area *y = x->right;
+
+    x->right = y->left;
+    y->left  = x;
+
+    vma_update_height(x);
+    vma_update_height(y);
+
+    return y;
+}
+
+// 恢复以v为根的子树的平衡,返回新的子树根
+static struct vm_area *vma_balance(struct vm_area *v)
+{
+    vma_update_height(v);
+
+    int8_t factor = vma_height(v->left) - vma_height(v->right);
+
+    if (factor > 1)
+    {
+        // 左子树的右边更高,先把它转成左边更高
+        if (vma_height(v->left->left) < vma_height(v->left->right))
+        {
+            v->left = vma_rotate_left(v->left);
+        }
+
+        return vma_rotate_right(v);
+    }
+
+    if (factor < -1)
+    {
+        if (vma_height(v->right->right) < vma_height(v->right->left))
+        {
+            v->right = vma_rotate_right(v->right);
+        }
+
+        return vma_rotate_left(v);
+    }
+
+    return v;
+}
+
+// 把区域v插入以node为根的子树,返回新的子树根
+static struct vm_area *vma_insert_node(struct vm_area *node, struct vm_area *v)
+{
+    if (node == NULL)
+    {
+        return v;
+    }
+
+    if (v->start < node->start)
+    {
+        node->left = vma_insert_node(node->left, v);
+    }
+    else
+    {
+        node->right = vma_insert_node(node->right, v);
+    }
+
+    return vma_balance(node);
+}
+
+// 摘下以node为根的子树中起始地址最小的结点存入*min,返回新的子树根
+static struct vm_area *vma_remove_min(struct vm_area *node, struct vm_area **min)
+{
+    if (node->left == NULL)
+    {
+        *min = node;
+        return node->right;
+    }
+
+    node->left = vma_remove_min(node->left, min);
+
+    return vma_balance(node);
+}
+
+// 从以node为根的子树中摘下区域v,返回新的子树根
+static struct vm_area *vma_erase_node(struct vm_area *node, struct vm_area *v)
+{
+    ASSERT(node != NULL);
+
+    if (v->start < node->start)
+    {
+        node->left = vma_erase_node(node->left, v);
+    }
+    else if (v->start > node->start)
+    {
+        node->right = vma_erase_node(node->right, v);
+    }
+    else
+    {
+        // 用右子树中最小的结点顶替被摘下的结点
+        struct vm_area *left  = node->left;
+        struct vm_area *right = node->right;
+        struct vm_area *min   = NULL;
+
+        if (right == NULL)
+        {
+            return left;
+        }
+
+        right      = vma_remove_min(right, &min);
+        min->left  = left;
+        min->right = right;
+
+        return vma_balance(min);
+    }
+
+    return vma_balance(node);
+}
+
+// 分配一个区域结构并初始化,失败返回NULL
+static struct vm_area *vma_alloc(uint32_t start, uint32_t end, uint8_t prot, enum vma_type type)
+{
+    struct vm_area *v = kmem_cache_alloc(vma_cache);
+
+    if (v == NULL)
+    {
+        return NULL;
+    }
+
+    memset(v, 0, sizeof(struct vm_area));
+    v->start  = start;
+    v->end    = end;
+    v->prot   = prot;
+    v->type   = type;
+    v->height = 1;
+
+    return v;
+}
+
+// 释放区域结构,文件映射区域还要关闭文件
+static void vma_free(struct vm_area *v)
+{
+    if (v->file != NULL)
+    {
+        inode_close(v->file);
+    }
+
+    kmem_cache_free(vma_cache, v);
+
+    return;
+}
+
+// 把区域v加入树中
+static void vma_insert(struct vma_tree *tree, struct vm_area *v)
+{
+    tree->root = vma_insert_node(tree->root, v);
+    tree->count++;
+
+    return;
+}
+
+// 把区域v从树中摘下并释放
+static void vma_erase(struct vma_tree *tree, struct vm_area *v)
+{
+    tree->root = vma_erase_node(tree->root, v);
+    tree->count--;
+    vma_free(v);
+
+    return;
+}
+
+// 相邻的两个区域能否合并成一个,文件映射区域不合并
+static bool vma_mergeable(struct vm_area *v, uint8_t prot, enum vma_type type)
+{
+    return v != NULL && v->type != VMA_FILE && v->type == type && v->prot == prot;
+}
+
+// 创建vm_area的slab cache,在kmem_cache_init之后调用
+void vma_init(void)
+{
+    put_str("  vma_init start\n");
+
+    vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), NULL);
+    ASSERT(vma_cache != NULL);
+
+    put_str("  vma_init done\n");
+
+    return;
+}
+
+// 初始化空的地址空间
+void vma_tree_init(struct vma_tree *tree)
+{
+    tree->root      = NULL;
+    tree->count     = 0;
+    tree->free_hint = USER_VADDR_START;
+
+    return;
+}
+
+// 返回包含vaddr的区域,没有则返回NULL
+struct vm_area *vma_find(struct vma_tree *tree, uint32_t vaddr)
+{
+    struct vm_area *v = tree->root;
+
+    while (v != NULL)
+    {
+        if (vaddr < v->start)
+        {
+            v = v->left;
+        }
+        else if (vaddr >= v->end)
+        {
+            v = v->right;
+        }
+        else
+        {
+            return v;
+        }
+    }
+
+    return NULL;
+}
+
+// 返回第一个结束地址大于vaddr的区域,即包含vaddr或在vaddr之后的第一个区域,没有则返回NULL
+struct vm_area *vma_find_next(struct vma_tree *tree, uint32_t vaddr)
+{
+    struct vm_area *v    = tree->root;
+    struct vm_area *next = NULL;
+
+    // 区域互不重叠,按起始地址有序也就按结束地址有序
+    while (v != NULL)
+    {
+        if (v->end > vaddr)
+        {
+            next = v;
+            v    = v->left;
+        }
+        else
+        {
+            v = v->right;
+        }
+    }
+
+    return next;
+}
+
+// 在[from, to)中找size字节没有区域占用的地址,失败返回0
+static uint32_t vma_gap_search(struct vma_tree *tree, uint32_t from, uint32_t to, uint32_t size)
+{
+    uint32_t addr = from;
+
+    while (addr + size <= to)
+    {
+        struct vm_area *next = vma_find_next(tree, addr);
+
+        if (next == NULL || next->start >= addr + size)
+        {
+            return addr;
+        }
+
+        addr = next->end;
+    }
+
+    return 0;
+}
+
+// 在用户堆的范围内找连续pg_cnt页没有区域占用的地址,失败返回0
+uint32_t vma_get_unmapped(struct vma_tree *tree, uint32_t pg_cnt)
+{
+    // 下面留给brk堆增长,上面栈向下增长的范围留给栈
+    uint32_t heap_start = USER_HEAP_START + USER_HEAP_MAX;
+    uint32_t heap_end   = 0xc0000000 - USER_STACK3_LIMIT;
+    uint32_t size       = pg_cnt * PG_SIZE;
+
+    if (tree->free_hint < heap_start || tree->free_hint >= heap_end)
+    {
+        tree->free_hint = heap_start;
+    }
+
+    // 和位图的next-fit一样,先从上次分配结束的地方往后找,找不到再从头找
+    uint32_t addr = vma_gap_search(tree, tree->free_hint, heap_end, size);
+
+    if (addr == 0 && tree->free_hint != heap_start)
+    {
+        uint32_t end = tree->free_hint + size;
+        addr = vma_gap_search(tree, heap_start, end < heap_end ? end : heap_end, size);
+    }
+
+    if (addr != 0)
+    {
+        tree->free_hint = addr + size;
+    }
+
+    return addr;
+}
+
+// 把没有区域占用的[start, start + pg_cnt页)加为匿名或栈区域,能和相邻区域合并就合并,成功返回true
+bool vma_map(struct vma_tree *tree, uint32_t start, uint32_t pg_cnt, uint8_t prot, enum vma_type type)
+{
+    uint32_t end = start + pg_cnt * PG_SIZE;
+
+    ASSERT(type != VMA_FILE && start % PG_SIZE == 0 && pg_cnt > 0);
+
+    struct vm_area *next = vma_find_next(tree, start);
+    ASSERT(next == NULL || next->start >= end);
+
+    struct vm_area *prev = start == 0 ? NULL : vma_find(tree, start - 1);
+
+    if (next != NULL && next->start != end)
+    {
+        next = NULL;
+    }
+
+    // 1 和前一个区域相连,向后延长它,若又和后一个区域相连,把后一个也并进来
+    if (vma_mergeable(prev, prot, type))
+    {
+        if (vma_mergeable(next, prot, type))
+        {
+            prev->end = next->end;
+            vma_erase(tree, next);
+        }
+        else
+        {
+            prev->end = end;
+        }
+
+        return true;
+    }
+
+    // 2 和后一个区域相连,向前延长它
+    if (vma_mergeable(next, prot, type))
+    {
+        next->start = start;
+        return true;
+    }
+
+    // 3 新建一个区域
+    struct vm_area *v = vma_alloc(start, end, prot, type);
+
+    if (v == NULL)
+    {
+        return false;
+    }
+
+    vma_insert(tree, v);
+
+    return true;
+}
+
+// 把没有区域占用的[start, end)加为文件映射区域,start处对应文件file的file_off处,成功返回true
+bool vma_map_file(struct vma_tree *tree, uint32_t start, uint32_t end, uint8_t prot,
+                  struct inode *file, uint32_t file_off, uint32_t file_end)
+{
+    ASSERT(start % PG_SIZE == 0 && end % PG_SIZE == 0 && start < end);
+
+    struct vm_area *next = vma_find_next(tree, start);
+    ASSERT(next == NULL || next->start >= end);
+
+    struct vm_area *v = vma_alloc(start, end, prot, VMA_FILE);
+
+    if (v == NULL)
+    {
+        return false;
+    }
+
+    v->file     = file;
+    v->file_off = file_off;
+    v->file_end = file_end;
+    file->i_open_cnts++;
+
+    vma_insert(tree, v);
+
+    return true;
+}
+
+// 去掉[start, end)范围内的区域,跨边界的区域会被截断或拆分,只修改区域不动页表,成功返回true
+bool vma_unmap(struct vma_tree *tree, uint32_t start, uint32_t end)
+{
+    struct vm_area *v = vma_find_next(tree, start);
+
+    while (v != NULL && v->start < end)
+    {
+        // 1 区域跨过了整个范围,拆成前后两段
+        if (v->start < start && v->end > end)
+        {
+            struct vm_area *tail = vma_alloc(end, v->end, v->prot, v->type);
+
+            if (tail == NULL)
+            {
+                return false;
+            }
+
+            if (v->type == VMA_FILE)
+            {
+                tail->file     = v->file;
+                tail->file_off = v->file_off + (end - v->start);
+                tail->file_end = v->file_end;
+                v->file->i_open_cnts++;
+            }
+
+            v->end = start;
+            vma_insert(tree, tail);
+
+            return true;
+        }
+
+        // 2 区域的后半部分在范围内,截掉后半部分
+        if (v->start < start)
+        {
+            v->end = start;
+        }
+        // 3 区域的前半部分在范围内,截掉前半部分
+        else if (v->end > end)
+        {
+            v->file_off += end - v->start;
+            v->start     = end;
+            return true;
+        }
+        // 4 区域整个在范围内
+        else
+        {
+            vma_erase(tree, v);
+        }
+
+        v = vma_find_next(tree, start);
+    }
+
+    return true;
+}
+
+// 用户栈向下增长到vaddr,把vaddr所在页到上方区域之间的空隙加为栈区域,成功返回true
+bool vma_grow_stack(struct vma_tree *tree, uint32_t vaddr)
+{
+    uint32_t start       = vaddr & 0xfffff000;
+    struct vm_area *next = vma_find_next(tree, start);
+    uint32_t end         = next == NULL ? 0xc0000000 : next->start;
+
+    ASSERT(end > start);
+
+    return vma_map(tree, start, (end - start) / PG_SIZE, VM_READ | VM_WRITE, VMA_STACK);
+}
+
+/**
+ * @brief
+ * 文件映射区域vma中的页vaddr整页都是文件内容且和页缓存的页对齐时,直接映射页缓存的页框,成功返回true。
+ * cached_only为true时只用已经在缓存中的页,不读硬盘
+ */
+static bool vma_file_map_cache(struct vm_area *vma, uint32_t vaddr, bool cached_only)
+{
+    uint32_t file_pos = vma->file_off + (vaddr - vma->start);
+
+    if (file_pos % PG_SIZE != 0 || vaddr + PG_SIZE > vma->file_end || file_pos >= vma->file->i_size)
+    {
+        return false;
+    }
+
+    struct cache_page *cp = cached_only ? page_cache_find(vma->file, file_pos / PG_SIZE) :
+                                          page_cache_get(vma->file, file_pos / PG_SIZE);
+
+    if (cp == NULL)
+    {
+        return false;
+    }
+
+    // 私有的可写映射先只读共享页缓存,写的时候才复制一份,共享映射直接写页缓存
+    bool cow = (vma->prot & VM_WRITE) && !(vma->prot & VM_SHARED);
+    page_map_shared(vaddr, addr_v2p((uint32_t)cp->kaddr), cow);
+
+    if (!(vma->prot & VM_WRITE))
+    {
+        page_set_writable(vaddr, false);
+    }
+
+    page_cache_put(cp);
+
+    return true;
+}
+
+// 为文件映射区域vma中的页vaddr准备内容,能共享页缓存就直接映射,否则分配清0的页框再从文件读入,成功返回true
+static bool vma_file_fill(struct vm_area *vma, uint32_t vaddr)
+{
+    if (vma_file_map_cache(vma, vaddr, false))
+    {
+        return true;
+    }
+
+    bool zeroed         = false;
+    uint32_t pg_phyaddr = (uint32_t)get_a_zeroed_phy_page(PF_USER, &zeroed);
+
+    if (pg_phyaddr == 0)
+    {
+        return false;
+    }
+
+    page_map(vaddr, pg_phyaddr);
+
+    if (!zeroed)
+    {
+        memset((void *)vaddr, 0, PG_SIZE);
+    }
+
+    uint32_t end = vaddr + PG_SIZE < vma->file_end ? vaddr + PG_SIZE : vma->file_end;
+
+    if (vaddr < end)
+    {
+        // 不经过文件描述符,直接用inode构造一个只读的文件结构
+        struct file vma_file;
+        vma_file.fd_pos   = vma->file_off + (vaddr - vma->start);
+        vma_file.fd_flag  = O_RDONLY;
+        vma_file.fd_inode = vma->file;
+
+        // 超出文件大小的部分读不到,保持为0
+        if (vma_file.fd_pos < vma->file->i_size)
+        {
+            file_read(&vma_file, (void *)vaddr, end - vaddr);
+        }
+    }
+
+    // 读入文件时页被内核写过,清掉D位,之后的D位才表示用户的修改
+    page_test_clean(vaddr);
+
+    if (!(vma->prot & VM_WRITE))
+    {
+        page_set_writable(vaddr, false);
+    }
+
+    return true;
+}
+
+/**
+ * @brief
+ * 把只读的文件映射区域vma中vaddr附近、已经在页缓存中的页也映射上。
+ * 同一个程序的代码页被别的进程读入过后都在页缓存中,这里不读硬盘也不分配页框,
+ * 新进程执行时就少了很多次缺页。窗口按VMA_FAULT_AROUND页对齐,不会跨页表
+ */
+static void vma_fault_around(struct vm_area *vma, uint32_t vaddr)
+{
+    uint32_t start = vaddr & ~(VMA_FAULT_AROUND * PG_SIZE - 1);
+    uint32_t end   = start + VMA_FAULT_AROUND * PG_SIZE;
+
+    start = start > vma->start ? start : vma->start;
+    end   = end < vma->end ? end : vma->end;
+
+    while (start < end)
+    {
+        // 跳过已映射的和已换出的页
+        if (!page_present(start) && !PTE_IS_SWAP(*pte_ptr(start)))
+        {
+            if (!mem_limit_check(MEM_RES_PAGES, 1))
+            {
+                break;
+            }
+
+            vma_file_map_cache(vma, start, true);
+        }
+
+        start += PG_SIZE;
+    }
+
+    return;
+}
+
+// 处理文件映射区域vma中vaddr处的缺页,从文件读入并预读后面几页,成功返回true
+bool vma_file_fault(struct vm_area *vma, uint32_t vaddr)
+{
+    vaddr &= 0xfffff000;
+
+    if (!vma_file_fill(vma, vaddr))
+    {
+        return false;
+    }
+
+    running_thread()->maj_flt++;
+
+    // 代码和数据多是顺序访问的,反正磁盘已经在读这个文件了,顺便把后面的几页也读进来
+    uint32_t ahead_idx = 1;
+
+    while (ahead_idx <= VMA_READ_AHEAD)
+    {
+        uint32_t ahead_vaddr = vaddr + ahead_idx * PG_SIZE;
+
+        if (ahead_vaddr >= vma->end || ahead_vaddr >= vma->file_end || page_present(ahead_vaddr))
+        {
+            break;
+        }
+
+        // 换出的页可能是私有映射写过的脏页,不能用文件内容覆盖,否则修改丢失,交换槽也泄漏了。
+        // 预读的页可能跨到下一个页表,页表不存在时页表项就是空的
+        if ((*pde_ptr(ahead_vaddr) & PG_P_1) && PTE_IS_SWAP(*pte_ptr(ahead_vaddr)))
+        {
+            break;
+        }
+
+        // 预读的页也占页框,到了页数上限就不再预读。预读失败不影响这次缺页,以后访问时再读
+        if (!mem_limit_check(MEM_RES_PAGES, 1) || !vma_file_fill(vma, ahead_vaddr))
+        {
+            break;
+        }
+
+        ahead_idx++;
+    }
+
+    if (!(vma->prot & VM_WRITE))
+    {
+        vma_fault_around(vma, vaddr);
+    }
+
+    return true;
+}
+
+// 复制以src为根的子树,分配失败时把*ok置为false
+static struct vm_area *vma_copy_node(struct vm_area *src, bool *ok)
+{
+    if (src == NULL)
+    {
+        return NULL;
+    }
+
+    struct vm_area *v = kmem_cache_alloc(vma_cache);
+
+    if (v == NULL)
+    {
+        *ok = false;
+        return NULL;
+    }
+
+    memcpy(v, src, sizeof(struct vm_area));
+
+    if (v->file != NULL)
+    {
+        v->file->i_open_cnts++;
+    }
+
+    // 分配失败时子树不完整,但仍是有序的,可以直接销毁
+    v->left  = vma_copy_node(src->left, ok);
+    v->right = vma_copy_node(src->right, ok);
+
+    return v;
+}
+
+// 把src的所有区域复制到dst,用于fork,成功返回true
+bool vma_tree_copy(struct vma_tree *dst, struct vma_tree *src)
+{
+    bool ok = true;
+
+    dst->root      = vma_copy_node(src->root, &ok);
+    dst->count     = src->count;
+    dst->free_hint = src->free_hint;
+
+    if (!ok)
+    {
+        vma_tree_destroy(dst);
+    }
+
+    return ok;
+}
+
+// 后序释放以v为根的子树
+static void vma_destroy_node(struct vm_area *v)
+{
+    if (v == NULL)
+    {
+        return;
+    }
+
+    vma_destroy_node(v->left);
+    vma_destroy_node(v->right);
+    vma_free(v);
+
+    return;
+}
+
+// 释放地址空间中所有的区域,不动页表
+void vma_tree_destroy(struct vma_tree *tree)
+{
+    vma_destroy_node(tree->root);
+    vma_tree_init(tree);
+
+    return;
+}
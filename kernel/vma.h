@@ -0,0 +1,87 @@
+#ifndef __KERNEL_VMA_H
+#define __KERNEL_VMA_H
+#include "stdint.h"
+#include "global.h"
+
+#define VM_READ  1                 // 区域可读
+#define VM_WRITE 2                 // 区域可写
+#define VM_EXEC  4                 // 区域可执行
+#define VM_SHARED 8                // 共享的文件映射,写过的页要写回文件
+
+#define VMA_READ_AHEAD 3           // 文件映射的区域缺页时,顺带读入后面的页数
+#define VMA_FAULT_AROUND 16        // 只读的文件映射区域缺页时,顺带映射附近已在页缓存中的页,按此页数对齐,须是2的幂
+
+struct inode;
+
+// 区域的后备存储
+enum vma_type
+{
+    VMA_ANON,                      // 匿名内存,第一次访问时分配清0的页框
+    VMA_FILE,                      // 文件映射,第一次访问时从文件读入
+    VMA_STACK                      // 用户栈,和匿名内存一样,但可以向下增长
+};
+
+// 虚拟内存区域,描述用户空间中一段连续的、属性相同的地址[start, end)
+struct vm_area
+{
+    uint32_t      start;           // 起始地址,按页对齐
+    uint32_t      end;             // 结束地址(不含),按页对齐
+    uint8_t       prot;            // VM_READ/VM_WRITE/VM_EXEC的组合
+    uint8_t       type;            // enum vma_type
+    int8_t        height;          // 以此结点为根的子树高度,用于AVL树的平衡
+
+    // 以下仅用于VMA_FILE
+    struct inode *file;            // 后备文件,区域持有它的一次打开计数
+    uint32_t      file_off;        // start对应的文件偏移
+    uint32_t      file_end;        // 文件内容到此虚拟地址为止,从这里到end的部分为0
+
+    struct vm_area *left;          // 地址更低的区域
+    struct vm_area *right;         // 地址更高的区域
+};
+
+// 进程的用户地址空间,区域互不重叠,按起始地址组织成AVL树
+struct vma_tree
+{
+    struct vm_area *root;
+    uint32_t        count;         // 区域个数
+    uint32_t        free_hint;     // 上次分配结束的地址,下次从这里开始找空闲地址
+};
+
+// 创建vm_area的slab cache,在kmem_cache_init之后调用
+void vma_init(void);
+
+// 初始化空的地址空间
+void vma_tree_init(struct vma_tree *tree);
+
+// 返回包含vaddr的区域,没有则返回NULL
+struct vm_area *vma_find(struct vma_tree *tree, uint32_t vaddr);
+
+// 返回第一个结束地址大于vaddr的区域,即包含vaddr或在vaddr之后的第一个区域,没有则返回NULL
+struct vm_area *vma_find_next(struct vma_tree *tree, uint32_t vaddr);
+
+// 在用户堆的范围内找连续pg_cnt页没有区域占用的地址,失败返回0
+uint32_t vma_get_unmapped(struct vma_tree *tree, uint32_t pg_cnt);
+
+// 把没有区域占用的[start, start + pg_cnt页)加为匿名或栈区域,能和相邻区域合并就合并,成功返回true
+bool vma_map(struct vma_tree *tree, uint32_t start, uint32_t pg_cnt, uint8_t prot, enum vma_type type);
+
+// 把没有区域占用的[start, end)加为文件映射区域,start处对应文件file的file_off处,成功返回true
+bool vma_map_file(struct vma_tree *tree, uint32_t start, uint32_t end, uint8_t prot,
+                  struct inode *file, uint32_t file_off, uint32_t file_end);
+
+// 去掉[start, end)范围内的区域,跨边界的区域会被截断或拆分,只修改区域不动页表,成功返回true
+bool vma_unmap(struct vma_tree *tree, uint32_t start, uint32_t end);
+
+// 用户栈向下增长到vaddr,把vaddr所在页到上方区域之间的空隙加为栈区域,成功返回true
+bool vma_grow_stack(struct vma_tree *tree, uint32_t vaddr);
+
+// 处理文件映射区域vma中vaddr处的缺页,从文件读入并预读后面几页,成功返回true
+bool vma_file_fault(struct vm_area *vma, uint32_t vaddr);
+
+// 把src的所有区域复制到dst,用于fork,成功返回true
+bool vma_tree_copy(struct vma_tree *dst, struct vma_tree *src);
+
+// 释放地址空间中所有的区域,不动页表
+void vma_tree_destroy(struct vma_tree *tree);
+
+#endif // __KERNEL_VMA_H
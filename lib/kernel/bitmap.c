@@ -5,10 +5,137 @@
 #include "interrupt.h"
 #include "debug.h"
 
+/**
+ * @brief
+ * 位图在内存中仍是字节数组,第bit_idx位在第bit_idx/8字节的第bit_idx%8位,
+ * x86是小端序,而且允许不对齐的访问,所以按32位的字来读时,第bit_idx位恰好在第bit_idx/32个字的第bit_idx%32位。
+ * 扫描时整字跳过全1的字,在字内用bsf指令直接定位空闲位和连续空闲位的边界,
+ * 不再一位一位地调用bitmap_scan_test。
+ * 另外记录上次分配结束的位置next_fit,下次从这里开始找
+ */
+
+#define BITS_PER_WORD 32
+#define WORD_FULL     0xffffffff
+
+// 返回word中最低的为1的位的下标,word不能为0
+static inline uint32_t word_first_set(uint32_t word)
+{
+    uint32_t idx;
+    asm("bsf %1, %0" : "=r"(idx) : "rm"(word));
+
+    return idx;
+}
+
+// 返回第off位及以上各位为1的掩码,off为0~31
+static inline uint32_t mask_from(uint32_t off)
+{
+    return WORD_FULL << off;
+}
+
+// 读出位图的第word_idx个字,位图结尾不足一个字的部分按已占用处理
+static uint32_t bitmap_load_word(struct bitmap *btmp, uint32_t word_idx)
+{
+    uint32_t byte_idx = word_idx * 4;
+
+    if (byte_idx + 4 <= btmp->btmp_bytes_len)
+    {
+        return *(uint32_t *)(btmp->bits + byte_idx);
+    }
+
+    uint32_t word = WORD_FULL;
+    uint32_t byte = 0;
+
+    while (byte_idx + byte < btmp->btmp_bytes_len)
+    {
+        word &= ~(0xffU << (byte * 8));
+        word |= (uint32_t)btmp->bits[byte_idx + byte] << (byte * 8);
+        byte++;
+    }
+
+    return word;
+}
+
+// 在[start, end)范围内找连续cnt个空闲位,找到返回起始下标,否则返回-1
+static int bitmap_scan_range(struct bitmap *btmp, uint32_t start, uint32_t end, uint32_t cnt)
+{
+    uint32_t run       = 0;          // 当前连续空闲位的个数
+    uint32_t run_start = 0;          // 当前连续空闲位的起始下标
+    uint32_t word_idx  = start / BITS_PER_WORD;
+    uint32_t off       = start % BITS_PER_WORD;
+
+    uint32_t *words      = (uint32_t *)btmp->bits;
+    uint32_t  full_words = btmp->btmp_bytes_len / 4;       // 完整的字数,结尾不足一字的部分由bitmap_load_word处理
+
+    while (word_idx * BITS_PER_WORD < end)
+    {
+        // 不在连续段中时,先整字跳过全1的字,这是占用率高时最主要的开销
+        if (run == 0)
+        {
+            while (word_idx < full_words && words[word_idx] == WORD_FULL)
+            {
+                word_idx++;
+                off = 0;
+            }
+
+            if (word_idx * BITS_PER_WORD >= end)
+            {
+                break;
+            }
+        }
+
+        // free中为1的位表示空闲,off之前的位不在扫描范围内
+        uint32_t free = ~bitmap_load_word(btmp, word_idx) & mask_from(off);
+
+        while (free != 0)
+        {
+            uint32_t first = word_first_set(free);
+
+            // 空闲位前面有已占用的位,连续段被打断
+            if (first != off || run == 0)
+            {
+                run       = 0;
+                run_start = word_idx * BITS_PER_WORD + first;
+            }
+
+            // 从first开始的第一个已占用位就是这一段空闲位的结尾
+            uint32_t used = ~free & mask_from(first);
+            uint32_t last = used != 0 ? word_first_set(used) : BITS_PER_WORD;
+
+            run += last - first;
+            off  = last;
+
+            if (run >= cnt)
+            {
+                return run_start + cnt <= end ? (int)run_start : -1;
+            }
+
+            if (off == BITS_PER_WORD)
+            {
+                break;
+            }
+
+            free &= mask_from(off);
+        }
+
+        // 空闲段没有延续到字的最高位,下一个字要重新计数
+        if (off != BITS_PER_WORD)
+        {
+            run = 0;
+        }
+
+        word_idx++;
+        off = 0;
+    }
+
+    return -1;
+}
+
 // 将位图btmp初始化
 void bitmap_init(struct bitmap *btmp)
 {
     memset(btmp->bits, 0, btmp->btmp_bytes_len);
+    btmp->next_fit = 0;
+
     return;
 }
 
@@ -24,69 +151,32 @@ int bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx)
 // 在位图中申请连续cnt个位,成功则返回其起始位下标，失败返回-1
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt)
 {
-    uint32_t idx_byte = 0; // 用于记录空闲位所在的字节
-
-    while ((btmp->bits[idx_byte] == 0xff) && (idx_byte < btmp->btmp_bytes_len))
-    {
-        // 1表示该位已分配,所以若为0xff,则表示该字节内已无空闲位,向下一字节继续找
-        idx_byte++;
-    }
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
 
-    ASSERT(idx_byte < btmp->btmp_bytes_len);
+    ASSERT(cnt > 0);
 
-    // 如果idx_byte 等于位图的字节长度，表示位图己没有空闲位，直接返回－1
-    if (idx_byte == btmp->btmp_bytes_len)
+    if (btmp->next_fit >= bits_len)
     {
-        // 若该内存池找不到可用空间
-        return -1;
+        btmp->next_fit = 0;
     }
 
     /**
-     * @brief 
-     * 若在位图数组范围内的某字节内找到了空闲位，在该字节内逐位比对,返回空闲位的索引。
-     * 
+     * @brief
+     * next-fit: 从上次分配结束的位置往后找,前面的位大多已经分配出去了,不必每次从头扫描。
+     * 找不到再从头找到next_fit为止,跨过next_fit的连续段也要能找到,所以第二段多找cnt-1位
      */
 
-    int idx_bit = 0; // 仅仅是字节内的索引，其值范围是0~7
-
-    // 和btmp->bits[idx_byte]这个字节逐位对比
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
-    {
-        idx_bit++;
-    }
+    int bit_idx_start = bitmap_scan_range(btmp, btmp->next_fit, bits_len, cnt);
 
-    // 转换为整个位图内的索引
-    int bit_idx_start = idx_byte * 8 + idx_bit; // 空闲位在位图内的下标
-    if (cnt == 1)
+    if (bit_idx_start == -1 && btmp->next_fit != 0)
     {
-        return bit_idx_start;
+        uint32_t end  = btmp->next_fit + cnt - 1;
+        bit_idx_start = bitmap_scan_range(btmp, 0, end < bits_len ? end : bits_len, cnt);
     }
 
-    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);    // 记录还有多少位可以判断
-    uint32_t next_bit = bit_idx_start + 1;                             // 记录位图中下一个代查找的位
-    uint32_t count    = 1;                                             // 用于记录找到的空闲位的个数
-
-    bit_idx_start = -1;                     // 先将其置为-1,若找不到连续的位就直接返回
-    while (bit_left-- > 0)
+    if (bit_idx_start != -1)
     {
-        // 若next_bit为0
-        if (!(bitmap_scan_test(btmp, next_bit)))
-        {
-            count++;
-        }
-        else
-        {
-            count = 0;
-        }
-
-        // 若找到连续的cnt个空位
-        if (count == cnt)
-        {
-            bit_idx_start = next_bit - cnt + 1;
-            break;
-        }
-
-        next_bit++;
+        btmp->next_fit = bit_idx_start + cnt;
     }
 
     return bit_idx_start;
@@ -103,12 +193,12 @@ void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
 
     /**
      * @brief Construct a new if object
-     * 
+     *
      * 一般都会用个0x1这样的数对字节中的位操作,
      * 将1任意移动后再取反,或者先取反再移位,可用来对位置0操作。
-     * 
+     *
      */
-    
+
     if (value) // 如果value为1
     {
         btmp->bits[byte_idx] |= (BITMAP_MASK << bit_odd);
@@ -119,4 +209,67 @@ void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
     }
 
     return;
-}
\ No newline at end of file
+}
+
+// 将位图btmp中从bit_idx开始的连续cnt位都设置为value
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value)
+{
+    ASSERT((value == 0) || (value == 1));
+    ASSERT(bit_idx + cnt <= btmp->btmp_bytes_len * 8);
+
+    uint32_t end = bit_idx + cnt;
+
+    // 1 开头不按字对齐的位逐位设置
+    while (bit_idx < end && bit_idx % BITS_PER_WORD != 0)
+    {
+        bitmap_set(btmp, bit_idx++, value);
+    }
+
+    // 2 中间整字设置
+    uint32_t fill = value ? WORD_FULL : 0;
+    while (bit_idx + BITS_PER_WORD <= end)
+    {
+        *(uint32_t *)(btmp->bits + bit_idx / 8) = fill;
+        bit_idx += BITS_PER_WORD;
+    }
+
+    // 3 结尾不足一个字的位逐位设置
+    while (bit_idx < end)
+    {
+        bitmap_set(btmp, bit_idx++, value);
+    }
+
+    return;
+}
+
+// 返回位图中第from位及之后第一个为1的位的下标,没有则返回-1
+int bitmap_next_set(struct bitmap *btmp, uint32_t from)
+{
+    uint32_t bits_len = btmp->btmp_bytes_len * 8;
+    uint32_t word_idx = from / BITS_PER_WORD;
+
+    if (from >= bits_len)
+    {
+        return -1;
+    }
+
+    uint32_t used = bitmap_load_word(btmp, word_idx) & mask_from(from % BITS_PER_WORD);
+
+    // 全0的字整字跳过
+    while (used == 0)
+    {
+        word_idx++;
+
+        if (word_idx * BITS_PER_WORD >= bits_len)
+        {
+            return -1;
+        }
+
+        used = bitmap_load_word(btmp, word_idx);
+    }
+
+    // 结尾不足一个字的部分被当作已占用,要排除掉
+    uint32_t bit_idx = word_idx * BITS_PER_WORD + word_first_set(used);
+
+    return bit_idx < bits_len ? (int)bit_idx : -1;
+}
@@ -9,13 +9,14 @@ struct bitmap
 {
     /**
      * @brief 
-     * 在遍历位图时,整体上以字节为单位,细节上是以位为单位,所以此处位图的指针必须是单字节
+     * 位图按字节存储,扫描时按32位的字来遍历,设置单个位时仍以字节为单位
      * 
      */
 
     
     uint32_t btmp_bytes_len;     // 位图的字节长度
     uint8_t *bits;               // 位图的指针,用来记录上层模块的位图的地址
+    uint32_t next_fit;           // 上次分配结束的位置,bitmap_scan从这里开始找
 };
 
 // 将位图初始化
@@ -30,5 +31,11 @@ int bitmap_scan(struct bitmap *btmp, uint32_t cnt);
 // bitmap_set 接受3个参数，位图指针 btmp 、位索引 bit_idx 、位值 value ，函数功能是将位图 btmp 中的bit_idx 位设置为 value ，其中 bit_idx 为整个位图中的位索引。
 void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
 
+// 将位图btmp中从bit_idx开始的连续cnt位都设置为value,中间的部分整字设置
+void bitmap_set_range(struct bitmap *btmp, uint32_t bit_idx, uint32_t cnt, int8_t value);
+
+// 返回位图中第from位及之后第一个为1的位的下标,没有则返回-1
+int bitmap_next_set(struct bitmap *btmp, uint32_t from);
+
 
 #endif // __LIB_KERNEL_BITMAP_H
\ No newline at end of file
@@ -85,5 +85,21 @@ static inline void insw(uint16_t port, void *addr, uint32_t word_cnt)
                  : "memory");
 }
 
+// 读取时间戳计数器,返回处理器上电以来的时钟周期数,用于性能测量
+static inline uint64_t rdtsc(void)
+{
+    /**
+     * @brief rdtsc(void)
+     * rdtsc把64位的计数值的高32位放入edx,低32位放入eax,
+     * 约束"=A"表示edx:eax这一对寄存器组成的64位值
+     */
+
+    uint64_t tsc;
+    asm volatile("rdtsc"
+                 : "=A"(tsc));
+
+    return tsc;
+}
+
 
 #endif // __LIB_O_H
@@ -0,0 +1,553 @@
+#include "malloc.h"
+#include "syscall.h"
+#include "assert.h"
+#include "string.h"
+#include "../userprog/process.h"
+
+/**
+ * @brief
+ * 用户态的内存分配器,在brk堆中分配内存,只有堆要变大变小时才通过sbrk进入内核
+ *
+ * 每块内存前面有8字节的块头,记录块的大小和标志,大小是8的倍数,低3位用来放标志。
+ * 1 小块(含块头不超过1024字节)分成16~1024字节7种规格,每种规格一个空闲链表,
+ *   链表空了就从大块中切一个4K的run,整个切成这种规格的小块。小块不合并,run也不归还
+ * 2 大块从堆中按地址顺序紧挨着切出来,空闲的大块挂在一个双向链表中,首次适配。
+ *   空闲大块的最后4字节是它的大小,后一块的块头中有CHUNK_PREV_INUSE标志,
+ *   释放时据此和前后空闲的块合并,所以不会有两个相邻的空闲大块
+ * 3 堆顶[top, end)是还没有分出去的部分,和它相邻的空闲块直接并入堆顶,
+ *   堆顶空闲超过HEAP_TRIM时用sbrk把多出来的页还给内核
+ * 4 realloc能原地调整就不搬:大块后面是空闲块或堆顶时直接向后延长,缩小时把尾部切下来释放。
+ *   calloc只清0可能被用过的部分,fresh以上是sbrk新要来还没分出去过的页,缺页时内核已经清0
+ *
+ *      USER_HEAP_START                                      top            end(brk)
+ *      | struct heap | 大块 | run(小块...) | 空闲大块 | 大块 |   未分配    |
+ *
+ * 管理信息放在堆的第一页而不是全局变量中:init和shell是和内核链接在一起的,
+ * 它们的全局变量在内核空间中,所有这样的进程共用一份,而堆是每个进程自己的
+ */
+
+#define HEAP_MAGIC       0x68656170      // "heap",堆的管理信息已经初始化
+#define CHUNK_ALIGN      8               // 块的大小和地址都按8字节对齐
+#define CHUNK_HDR        8               // 块头的大小
+#define CHUNK_FLAGS      7               // size的低3位是标志
+#define CHUNK_INUSE      1               // 块正在使用
+#define CHUNK_PREV_INUSE 2               // 地址上紧挨着的前一个大块正在使用,否则前一块的最后4字节是它的大小
+#define CHUNK_SMALL      4               // 小块,在某个run中,不参与合并
+#define LARGE_MIN        24              // 空闲大块要放下块头、两个链表指针和尾部的大小
+
+#define SMALL_CLASS_CNT  7               // 小块的规格: 16 32 64 128 256 512 1024字节(含块头)
+#define SMALL_MAX        1024            // 最大的小块
+#define RUN_SIZE         4096            // 小块不够时一次从大块中切出的run的大小
+
+#define HEAP_GROW        (64 * 1024)     // 堆不够时至少扩大的字节数,减少进入内核的次数
+#define HEAP_TRIM        (128 * 1024)    // 堆顶空闲超过这个数时还给内核
+#define HEAP_KEEP        (64 * 1024)     // 还给内核时堆顶保留的空闲字节数
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+// 块头,next和prev只在块空闲时有效,占的是用户数据的位置
+struct chunk
+{
+    uint32_t      size;                  // 块的大小(含块头),低3位是CHUNK_xxx标志
+    uint32_t      cls;                   // 小块的规格下标,大块不用
+    struct chunk *next;                  // 空闲链表中的下一块
+    struct chunk *prev;                  // 空闲链表中的上一块,只用于大块
+};
+
+// 堆的管理信息,放在USER_HEAP_START处,每个进程一份,fork时随堆一起复制,exec时随堆一起保留
+struct heap
+{
+    uint32_t      magic;                 // 为HEAP_MAGIC时已经初始化,堆的第一页开始时全是0
+    uint32_t      top;                   // 大块切到这里,[top, end)还没有分出去
+    uint32_t      end;                   // 堆的结束地址,和内核中的brk相同
+    uint32_t      fresh;                 // [fresh, end)从没分出去过,内容一定是0
+    struct chunk *bins[SMALL_CLASS_CNT]; // 各规格空闲小块的单向链表
+    struct chunk *large;                 // 空闲大块的双向链表
+};
+
+#define chunk_size(c)  ((c)->size & ~CHUNK_FLAGS)
+#define chunk2mem(c)   ((void *)((uint32_t)(c) + CHUNK_HDR))
+#define mem2chunk(p)   ((struct chunk *)((uint32_t)(p) - CHUNK_HDR))
+#define chunk_at(addr) ((struct chunk *)(addr))
+
+// 返回当前进程的堆,第一次使用时初始化
+static struct heap *heap_get(void)
+{
+    struct heap *h = (struct heap *)USER_HEAP_START;
+
+    if (h->magic != HEAP_MAGIC)
+    {
+        uint32_t cls = 0;
+        while (cls < SMALL_CLASS_CNT)
+        {
+            h->bins[cls++] = NULL;
+        }
+
+        h->large = NULL;
+        h->top   = USER_HEAP_START + ALIGN_UP(sizeof(struct heap), CHUNK_ALIGN);
+        h->end   = (uint32_t)sbrk(0);
+        h->fresh = h->top;
+        h->magic = HEAP_MAGIC;
+    }
+
+    return h;
+}
+
+// 把空闲大块c挂到空闲链表头
+static void large_insert(struct heap *h, struct chunk *c)
+{
+    c->prev = NULL;
+    c->next = h->large;
+
+    if (h->large != NULL)
+    {
+        h->large->prev = c;
+    }
+
+    h->large = c;
+
+    return;
+}
+
+// 把空闲大块c从空闲链表中摘下
+static void large_unlink(struct heap *h, struct chunk *c)
+{
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        h->large = c->next;
+    }
+
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    return;
+}
+
+// 把c设为大小为size的空闲大块,写好尾部的大小,并告诉后一块前面是空闲的
+static void large_set_free(struct heap *h, struct chunk *c, uint32_t size, uint32_t prev_inuse)
+{
+    c->size = size | prev_inuse;
+    *(uint32_t *)((uint32_t)c + size - 4) = size;
+
+    // 空闲块不会紧挨着堆顶,后面一定还有块
+    struct chunk *next = chunk_at((uint32_t)c + size);
+    assert((uint32_t)next < h->top);
+    next->size &= ~CHUNK_PREV_INUSE;
+
+    return;
+}
+
+// 堆顶空闲太多时还给内核一部分
+static void heap_trim(struct heap *h)
+{
+    uint32_t free_top = h->end - h->top;
+
+    if (free_top < HEAP_TRIM)
+    {
+        return;
+    }
+
+    uint32_t shrink = (free_top - HEAP_KEEP) & ~(PG_SIZE - 1);
+
+    if (sbrk(-(int32_t)shrink) != (void *)-1)
+    {
+        h->end -= shrink;
+
+        // 还回去的页再要回来时是新分配的页框
+        if (h->fresh > h->end)
+        {
+            h->fresh = h->end;
+        }
+    }
+
+    return;
+}
+
+// 保证堆顶至少有size字节,不够时用sbrk扩大堆,失败返回false
+static bool top_reserve(struct heap *h, uint32_t size)
+{
+    if (h->end - h->top >= size)
+    {
+        return true;
+    }
+
+    uint32_t need = size - (h->end - h->top);
+    uint32_t grow = ALIGN_UP(need, HEAP_GROW);
+
+    // 一次多要一些,要不到就只要够用的页数
+    if (sbrk(grow) == (void *)-1)
+    {
+        grow = ALIGN_UP(need, PG_SIZE);
+
+        if (sbrk(grow) == (void *)-1)
+        {
+            return false;
+        }
+    }
+
+    h->end += grow;
+
+    return true;
+}
+
+// 堆顶向后移动size字节,移过的部分不再是没用过的
+static void top_advance(struct heap *h, uint32_t size)
+{
+    h->top += size;
+
+    if (h->fresh < h->top)
+    {
+        h->fresh = h->top;
+    }
+
+    return;
+}
+
+// 从堆顶切一个大小为size的大块,堆顶不够时用sbrk扩大堆,失败返回NULL
+static struct chunk *top_alloc(struct heap *h, uint32_t size)
+{
+    if (!top_reserve(h, size))
+    {
+        return NULL;
+    }
+
+    // 堆顶前面的块一定在使用,否则释放时已经并入堆顶了
+    struct chunk *c = chunk_at(h->top);
+    c->size         = size | CHUNK_INUSE | CHUNK_PREV_INUSE;
+    top_advance(h, size);
+
+    return c;
+}
+
+// 分配一个大小为size(含块头,已对齐)的大块,失败返回NULL
+static struct chunk *large_alloc(struct heap *h, uint32_t size)
+{
+    // 首次适配
+    struct chunk *c = h->large;
+    while (c != NULL && chunk_size(c) < size)
+    {
+        c = c->next;
+    }
+
+    if (c == NULL)
+    {
+        return top_alloc(h, size);
+    }
+
+    large_unlink(h, c);
+
+    uint32_t csize = chunk_size(c);
+
+    if (csize - size >= LARGE_MIN)
+    {
+        // 剩下的部分足够做一个空闲块,切开放回空闲链表
+        c->size = size | (c->size & CHUNK_PREV_INUSE) | CHUNK_INUSE;
+
+        struct chunk *rest = chunk_at((uint32_t)c + size);
+        large_set_free(h, rest, csize - size, CHUNK_PREV_INUSE);
+        large_insert(h, rest);
+    }
+    else
+    {
+        c->size |= CHUNK_INUSE;
+        chunk_at((uint32_t)c + csize)->size |= CHUNK_PREV_INUSE;
+    }
+
+    return c;
+}
+
+// 释放大块c,和前后空闲的块合并,和堆顶相邻时并入堆顶
+static void large_free(struct heap *h, struct chunk *c)
+{
+    uint32_t size       = chunk_size(c);
+    uint32_t prev_inuse = c->size & CHUNK_PREV_INUSE;
+
+    // 1 和后面空闲的块合并
+    struct chunk *next = chunk_at((uint32_t)c + size);
+
+    if ((uint32_t)next != h->top && !(next->size & CHUNK_INUSE))
+    {
+        large_unlink(h, next);
+        size += chunk_size(next);
+    }
+
+    // 2 和前面空闲的块合并,前一块空闲时它的大小在c前面的4字节中
+    if (!prev_inuse)
+    {
+        struct chunk *prev = chunk_at((uint32_t)c - *((uint32_t *)c - 1));
+
+        large_unlink(h, prev);
+        size      += chunk_size(prev);
+        c          = prev;
+        prev_inuse = prev->size & CHUNK_PREV_INUSE;
+    }
+
+    // 3 和堆顶相邻就并入堆顶
+    if ((uint32_t)c + size == h->top)
+    {
+        h->top = (uint32_t)c;
+        heap_trim(h);
+
+        return;
+    }
+
+    large_set_free(h, c, size, prev_inuse);
+    large_insert(h, c);
+
+    return;
+}
+
+// 规格为cls的小块用完了,切一个run补充,失败返回false
+static bool small_refill(struct heap *h, uint32_t cls)
+{
+    struct chunk *run = large_alloc(h, RUN_SIZE);
+
+    if (run == NULL)
+    {
+        return false;
+    }
+
+    uint32_t csize = 16 << cls;
+    uint32_t addr  = (uint32_t)chunk2mem(run);
+    uint32_t end   = (uint32_t)run + RUN_SIZE;
+
+    while (addr + csize <= end)
+    {
+        struct chunk *c = chunk_at(addr);
+        c->size         = csize | CHUNK_SMALL;
+        c->cls          = cls;
+        c->next         = h->bins[cls];
+        h->bins[cls]    = c;
+
+        addr += csize;
+    }
+
+    return true;
+}
+
+// 申请size字节大小的内存,返回的内存没有清0,失败返回NULL
+void *malloc(uint32_t size)
+{
+    if (size == 0 || size > USER_HEAP_MAX)
+    {
+        return NULL;
+    }
+
+    struct heap *h = heap_get();
+    uint32_t need  = ALIGN_UP(size + CHUNK_HDR, CHUNK_ALIGN);
+
+    // 1 大块
+    if (need > SMALL_MAX)
+    {
+        struct chunk *c = large_alloc(h, need);
+
+        return c == NULL ? NULL : chunk2mem(c);
+    }
+
+    // 2 小块,找能放下的最小规格
+    uint32_t cls = 0;
+    while ((16U << cls) < need)
+    {
+        cls++;
+    }
+
+    if (h->bins[cls] == NULL && !small_refill(h, cls))
+    {
+        return NULL;
+    }
+
+    struct chunk *c = h->bins[cls];
+    h->bins[cls]    = c->next;
+    c->size        |= CHUNK_INUSE;
+
+    return chunk2mem(c);
+}
+
+// 释放ptr指向的内存,ptr为NULL时什么也不做
+void free(void *ptr)
+{
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    struct heap *h  = heap_get();
+    struct chunk *c = mem2chunk(ptr);
+
+    // 重复释放或者不是malloc返回的地址
+    assert(c->size & CHUNK_INUSE);
+
+    c->size &= ~CHUNK_INUSE;
+
+    if (c->size & CHUNK_SMALL)
+    {
+        c->next         = h->bins[c->cls];
+        h->bins[c->cls] = c;
+
+        return;
+    }
+
+    large_free(h, c);
+
+    return;
+}
+
+// 把在用的大块c原地调整为size字节(含块头,已对齐),成功返回true
+static bool large_resize(struct heap *h, struct chunk *c, uint32_t size)
+{
+    uint32_t csize = chunk_size(c);
+    uint32_t flags = c->size & CHUNK_FLAGS;
+    uint32_t next  = (uint32_t)c + csize;
+
+    // 1 缩小,切下来的尾部够做一个块就当作在用的块释放,和后面合并
+    if (size <= csize)
+    {
+        if (csize - size >= LARGE_MIN)
+        {
+            c->size = size | flags;
+
+            struct chunk *rest = chunk_at((uint32_t)c + size);
+            rest->size         = (csize - size) | CHUNK_INUSE | CHUNK_PREV_INUSE;
+            large_free(h, rest);
+        }
+
+        return true;
+    }
+
+    // 2 后面是堆顶,堆顶向后移
+    if (next == h->top)
+    {
+        if (!top_reserve(h, size - csize))
+        {
+            return false;
+        }
+
+        top_advance(h, size - csize);
+        c->size = size | flags;
+
+        return true;
+    }
+
+    // 3 后面是够大的空闲块,并进来,多出来的再切回去
+    struct chunk *nc = chunk_at(next);
+
+    if ((nc->size & CHUNK_INUSE) || csize + chunk_size(nc) < size)
+    {
+        return false;
+    }
+
+    uint32_t total = csize + chunk_size(nc);
+    large_unlink(h, nc);
+
+    if (total - size >= LARGE_MIN)
+    {
+        c->size = size | flags;
+
+        struct chunk *rest = chunk_at((uint32_t)c + size);
+        large_set_free(h, rest, total - size, CHUNK_PREV_INUSE);
+        large_insert(h, rest);
+    }
+    else
+    {
+        c->size = total | flags;
+        chunk_at((uint32_t)c + total)->size |= CHUNK_PREV_INUSE;
+    }
+
+    return true;
+}
+
+// 把ptr指向的内存调整为size字节,内容保留到两者中较小的大小,能原地调整就不搬,失败返回NULL且ptr不变
+void *realloc(void *ptr, uint32_t size)
+{
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    if (size > USER_HEAP_MAX)
+    {
+        return NULL;
+    }
+
+    struct heap *h   = heap_get();
+    struct chunk *c  = mem2chunk(ptr);
+    uint32_t need    = ALIGN_UP(size + CHUNK_HDR, CHUNK_ALIGN);
+    uint32_t csize   = chunk_size(c);
+
+    assert(c->size & CHUNK_INUSE);
+
+    if (c->size & CHUNK_SMALL)
+    {
+        // 1 小块在原规格中放得下且不到浪费一半就不动
+        if (need <= csize && (csize == 16 || need > csize / 2))
+        {
+            return ptr;
+        }
+    }
+    else if (need > SMALL_MAX && large_resize(h, c, need))
+    {
+        // 2 大块原地缩小或向后延长
+        return ptr;
+    }
+
+    // 3 换一块新的
+    void *new_ptr = malloc(size);
+
+    if (new_ptr == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t old_size = csize - CHUNK_HDR;
+    memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    free(ptr);
+
+    return new_ptr;
+}
+
+// 申请cnt个size字节的内存并清0,cnt * size溢出时返回NULL
+void *calloc(uint32_t cnt, uint32_t size)
+{
+    if (cnt != 0 && size > USER_HEAP_MAX / cnt)
+    {
+        return NULL;
+    }
+
+    struct heap *h  = heap_get();
+    uint32_t fresh  = h->fresh;
+    uint32_t total  = cnt * size;
+    void *ptr       = malloc(total);
+
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
+
+    // 只清0分配前fresh以下的部分,小块的数据区里存过空闲链表指针,总要清
+    struct chunk *c = mem2chunk(ptr);
+    uint32_t dirty  = (uint32_t)ptr + total;
+
+    if (!(c->size & CHUNK_SMALL) && fresh < dirty)
+    {
+        dirty = fresh;
+    }
+
+    if (dirty > (uint32_t)ptr)
+    {
+        memset(ptr, 0, dirty - (uint32_t)ptr);
+    }
+
+    return ptr;
+}
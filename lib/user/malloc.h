@@ -0,0 +1,17 @@
+#ifndef __LIB_USER_MALLOC_H
+#define __LIB_USER_MALLOC_H
+#include "stdint.h"
+
+// 申请size字节大小的内存,返回的内存没有清0,失败返回NULL
+void *malloc(uint32_t size);
+
+// 释放ptr指向的内存,ptr为NULL时什么也不做
+void free(void *ptr);
+
+// 把ptr指向的内存调整为size字节,能原地调整就不搬,失败返回NULL且ptr不变
+void *realloc(void *ptr, uint32_t size);
+
+// 申请cnt个size字节的内存并清0,cnt * size溢出时返回NULL
+void *calloc(uint32_t cnt, uint32_t size);
+
+#endif // __LIB_USER_MALLOC_H
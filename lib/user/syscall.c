@@ -61,18 +61,6 @@ uint32_t write(int32_t fd, const void *buf, uint32_t count)
     return _syscall3(SYS_WRITE, fd, buf, count);
 }
 
-// 申请size字节大小的内存,并返回结果
-void *malloc(uint32_t size)
-{
-    return (void *)_syscall1(SYS_MALLOC, size);
-}
-
-// 释放ptr指向的内存
-void free(void *ptr)
-{
-    _syscall1(SYS_FREE, ptr);
-}
-
 // 派生子进程,返回子进程pid
 pid_t fork(void)
 {
@@ -216,3 +204,66 @@ void help(void)
 {
     _syscall0(SYS_HELP);
 }
+
+// 显示内存使用情况
+void meminfo(void)
+{
+    _syscall0(SYS_MEMINFO);
+}
+
+// 把文件fd从offset开始的length字节映射到进程的地址空间,成功返回映射的起始地址,失败返回MAP_FAILED
+void *mmap(void *addr, uint32_t length, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset)
+{
+    // 系统调用最多传3个参数,用结构体传递
+    struct mmap_args args;
+    args.addr   = addr;
+    args.length = length;
+    args.prot   = prot;
+    args.flags  = flags;
+    args.fd     = fd;
+    args.offset = offset;
+
+    return (void *)_syscall1(SYS_MMAP, &args);
+}
+
+// 解除[addr, addr + length)的映射,成功返回0,失败返回-1
+int32_t munmap(void *addr, uint32_t length)
+{
+    return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+// 把[addr, addr + length)中共享文件映射写过的页写回文件,成功返回0,失败返回-1
+int32_t msync(void *addr, uint32_t length)
+{
+    return _syscall2(SYS_MSYNC, addr, length);
+}
+
+// 把堆的结束地址设为addr,成功返回0,失败返回-1
+int32_t brk(void *addr)
+{
+    return _syscall1(SYS_BRK, addr) == (int)addr ? 0 : -1;
+}
+
+// 把堆扩大increment字节,为负时缩小,成功返回原来的结束地址,失败返回(void *)-1
+void *sbrk(int32_t increment)
+{
+    return (void *)_syscall1(SYS_SBRK, increment);
+}
+
+// 把进程pid的内存占用和上限复制到usage中,pid为0时是自己,成功返回0,没有此进程返回-1
+int32_t memstat(int32_t pid, struct mem_usage *usage)
+{
+    return _syscall2(SYS_MEMSTAT, pid, usage);
+}
+
+// 设置自己res(MEM_RES_PAGES或MEM_RES_HEAP)的上限为limit,之后fork的子进程也继承,成功返回0
+int32_t memlimit(uint32_t res, uint32_t limit)
+{
+    return _syscall2(SYS_MEMLIMIT, res, limit);
+}
+
+// 显示内核堆中占用最多的调用点和任务,以及各规格内存块的碎片情况
+void kmprof(void)
+{
+    _syscall0(SYS_KMPROF);
+}
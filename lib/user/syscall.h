@@ -3,6 +3,8 @@
 #include "stdint.h"
 #include "../fs/fs.h"
 #include "../thread/thread.h"
+#include "../userprog/mmap.h"
+#include "malloc.h"                  // malloc和free已经改在用户态实现,不再是系统调用
 
 // 用来存放系统调用子功能号，以后再增加新的调用后还需要把新的子功能号添加到此结构中
 enum SYSCALL_NR
@@ -34,7 +36,16 @@ enum SYSCALL_NR
     SYS_WAIT,        // 等待子进程,子进程状态存储到status
     SYS_PIPE,        // 管道
     SYS_FD_REDIRECT, // 文件从定向
-    SYS_HELP         // 显示系统支持的命令
+    SYS_HELP,        // 显示系统支持的命令
+    SYS_MEMINFO,     // 显示内存使用情况
+    SYS_MMAP,        // 建立内存映射
+    SYS_MUNMAP,      // 解除内存映射
+    SYS_MSYNC,       // 把共享文件映射写回文件
+    SYS_BRK,         // 设置堆的结束地址
+    SYS_SBRK,        // 扩大或缩小堆
+    SYS_MEMSTAT,     // 获取进程的内存占用
+    SYS_MEMLIMIT,    // 设置进程的内存上限
+    SYS_KMPROF       // 显示内核堆中占用最多的调用点和碎片情况
 };
 
 
@@ -44,12 +55,6 @@ uint32_t getpid(void);
 // 写
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
 
-// 申请size字节大小的内存,并返回结果
-void *malloc(uint32_t size);
-
-// 释放ptr指向的内存
-void free(void *ptr);
-
 // 派生子进程,返回子进程pid
 int16_t fork(void);
 
@@ -122,4 +127,32 @@ void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 // 显示系统支持的命令
 void help(void);
 
+// 显示内存使用情况
+void meminfo(void);
+
+// 把文件fd从offset开始的length字节映射到进程的地址空间,fd为-1且flags含MAP_ANONYMOUS时是匿名映射,
+// 成功返回映射的起始地址,失败返回MAP_FAILED
+void *mmap(void *addr, uint32_t length, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset);
+
+// 解除[addr, addr + length)的映射,成功返回0,失败返回-1
+int32_t munmap(void *addr, uint32_t length);
+
+// 把[addr, addr + length)中共享文件映射写过的页写回文件,成功返回0,失败返回-1
+int32_t msync(void *addr, uint32_t length);
+
+// 把堆的结束地址设为addr,成功返回0,失败返回-1
+int32_t brk(void *addr);
+
+// 把堆扩大increment字节,为负时缩小,成功返回原来的结束地址,失败返回(void *)-1
+void *sbrk(int32_t increment);
+
+// 把进程pid的内存占用和上限复制到usage中,pid为0时是自己,成功返回0,没有此进程返回-1
+int32_t memstat(int32_t pid, struct mem_usage *usage);
+
+// 设置自己res(MEM_RES_PAGES或MEM_RES_HEAP)的上限为limit,之后fork的子进程也继承,成功返回0
+int32_t memlimit(uint32_t res, uint32_t limit);
+
+// 显示内核堆中占用最多的调用点和任务,以及各规格内存块的碎片情况,内核要带KMALLOC_PROF编译
+void kmprof(void);
+
 #endif // __LIB_USER_SYSCALL_H
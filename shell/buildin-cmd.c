@@ -460,3 +460,33 @@ void buildin_help(uint32_t argc UNUSED, char **argv UNUSED)
 
     return ;
 }
+
+// meminfo命令内建函数
+void buildin_meminfo(uint32_t argc, char **argv UNUSED)
+{
+    if (argc != 1)
+    {
+        printf("meminfo: no argument support!\n");
+
+        return ;
+    }
+
+    meminfo();
+
+    return ;
+}
+
+// kmprof命令内建函数
+void buildin_kmprof(uint32_t argc, char **argv UNUSED)
+{
+    if (argc != 1)
+    {
+        printf("kmprof: no argument support!\n");
+
+        return ;
+    }
+
+    kmprof();
+
+    return ;
+}
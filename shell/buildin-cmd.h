@@ -32,4 +32,10 @@ int32_t buildin_rm(uint32_t argc, char **argv);
 // 显示内建命令列表
 void buildin_help(uint32_t argc, char **argv);
 
+// meminfo命令内建函数
+void buildin_meminfo(uint32_t argc, char **argv);
+
+// kmprof命令内建函数
+void buildin_kmprof(uint32_t argc, char **argv);
+
 #endif // __SHELL_BUILDIN_CMD_H
@@ -1,9 +1,23 @@
 #include "pipe.h"
 #include "../kernel/memory.h"
+#include "../kernel/slab.h"
+#include "../kernel/debug.h"
 #include "../fs/fs.h"
 #include "../fs/file.h"
 #include "../device/ioqueue.h"
 #include "../thread/thread.h"
+#include "../kernel/fault.h"
+
+static struct kmem_cache *pipe_cache;    // 管道的环形缓冲区都从此cache分配
+
+// 创建管道环形缓冲区的对象cache
+void pipe_init(void)
+{
+    pipe_cache = kmem_cache_create("pipe", sizeof(struct ioqueue), NULL);
+    ASSERT(pipe_cache != NULL);
+
+    return;
+}
 
 
 // 判断文件描述符local_fd是否是管道
@@ -19,28 +33,51 @@ int32_t sys_pipe(int32_t pipefd[2])
 {
     int32_t global_fd = get_free_slot_in_global();
 
-    // 申请一页内核内存做环形缓冲区
-    file_table[global_fd].fd_inode = get_kernel_pages(1);
+    // 从pipe_cache申请环形缓冲区,环形缓冲区只有64字节,不必占用一整页
+    file_table[global_fd].fd_inode = kmem_cache_alloc(pipe_cache);
 
-    // 初始化环形缓冲区
-    ioqueue_init((struct ioqueue *)file_table[global_fd].fd_inode);
     if (file_table[global_fd].fd_inode == NULL)
     {
         return -1;
     }
 
+    // 初始化环形缓冲区
+    ioqueue_init((struct ioqueue *)file_table[global_fd].fd_inode);
+
     // 将fd_flag复用为管道标志
     file_table[global_fd].fd_flag = PIPE_FLAG;
 
     // 将fd_pos复用为管道打开数
     file_table[global_fd].fd_pos = 2;
 
-    pipefd[0] = pcb_fd_install(global_fd);
-    pipefd[1] = pcb_fd_install(global_fd);
-    
+    int32_t fds[2];
+    fds[0] = pcb_fd_install(global_fd);
+    fds[1] = pcb_fd_install(global_fd);
+
+    // pipefd的地址非法时关闭刚打开的两个描述符,管道随之释放
+    if (copy_to_user(pipefd, fds, sizeof(fds)) != 0)
+    {
+        sys_close(fds[0]);
+        sys_close(fds[1]);
+        return -1;
+    }
+
     return 0;
 }
 
+// 管道的打开数减1,减到0时释放管道的环形缓冲区
+void pipe_release(uint32_t global_fd)
+{
+    // fd_pos复用为管道打开数
+    if (--file_table[global_fd].fd_pos == 0)
+    {
+        kmem_cache_free(pipe_cache, file_table[global_fd].fd_inode);
+        file_table[global_fd].fd_inode = NULL;
+    }
+
+    return;
+}
+
 // 从管道中读数据
 uint32_t pipe_read(int32_t fd, void *buf, uint32_t count)
 {
@@ -58,7 +95,14 @@ uint32_t pipe_read(int32_t fd, void *buf, uint32_t count)
 
     while (bytes_read < size)
     {
-        *buffer = ioq_getchar(ioq);
+        char c = ioq_getchar(ioq);
+
+        // buf的地址非法时停止读取,已读出的这个字节丢弃
+        if (copy_to_user(buffer, &c, 1) != 0)
+        {
+            break;
+        }
+
         bytes_read++;
         buffer++;
     }
@@ -80,7 +124,15 @@ uint32_t pipe_write(int32_t fd, const void *buf, uint32_t count)
     const char *buffer   = buf;
     while (bytes_write < size)
     {
-        ioq_putchar(ioq, *buffer);
+        char c;
+
+        // buf的地址非法时停止写入
+        if (copy_from_user(&c, buffer, 1) != 0)
+        {
+            break;
+        }
+
+        ioq_putchar(ioq, c);
         bytes_write++;
         buffer++;
     }
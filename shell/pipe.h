@@ -6,6 +6,12 @@
 
 #define PIPE_FLAG 0xFFFF
 
+// 创建管道环形缓冲区的对象cache
+void pipe_init(void);
+
+// 管道的打开数减1,减到0时释放管道的环形缓冲区
+void pipe_release(uint32_t global_fd);
+
 // 判断文件描述符local_fd是否是管道
 bool is_pipe(uint32_t local_fd);
 
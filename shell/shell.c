@@ -186,6 +186,14 @@ static void cmd_execute(uint32_t argc, char **argv)
     {
         buildin_help(argc, argv);
     }
+    else if (!strcmp("meminfo", argv[0]))
+    {
+        buildin_meminfo(argc, argv);
+    }
+    else if (!strcmp("kmprof", argv[0]))
+    {
+        buildin_kmprof(argc, argv);
+    }
     else
     { // 如果是外部命令,需要从磁盘上加载
 
@@ -6,12 +6,14 @@
 #include "interrupt.h"
 #include "print.h"
 #include "memory.h"
+#include "slab.h"
 #include "../userprog/process.h"
 #include "../thread/sync.h"
 #include "../fs/file.h"
 #include "../fs/fs.h"
 #include "../lib/stdio.h"
 
+#define PS_COL_WIDTH 11    // ps每一列占PS_COL_WIDTH-1个字符,缺页计数加进来后一行仍不超过80列
 
 // pid的位图,最大支持1024个pid
 uint8_t pid_bitmap_bits[128] = {0};
@@ -30,6 +32,7 @@ struct list        thread_ready_list;       // 就绪队列,以后每创建一
 struct list        thread_all_list;         // 所有线程队列
 struct lock        pid_lock;                // 分配pid锁
 static struct list_elem *thread_tag;        // 用于保存队列中的线程结点
+static struct kmem_cache *pcb_cache;        // pcb所在的页都从此cache分配
 
 extern void switch_to(struct task_struct *cur, struct task_struct *next);
 extern void init(void);
@@ -42,11 +45,21 @@ static void idle(void *arg UNUSED)
     {
         thread_block(TASK_BLOCKED);
 
-        //执行hlt时必须要保证目前处在开中断的情况下
-        asm volatile("sti; hlt"
-                     :
-                     :
-                     : "memory");
+        // 没有别的线程要运行时,先预先清0一些页框,之后分配清0的页时就不用现场清0了
+        while (list_empty(&thread_ready_list) && zero_pool_fill_one())
+        {
+            ;
+        }
+
+        // 清0时可能被时钟中断换下过,已经有线程就绪了就不必等下一个中断
+        if (list_empty(&thread_ready_list))
+        {
+            //执行hlt时必须要保证目前处在开中断的情况下
+            asm volatile("sti; hlt"
+                         :
+                         :
+                         : "memory");
+        }
 
     }
 
@@ -187,6 +200,9 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
     pthread->elapsed_ticks = 0;               // 执行的时间数
     pthread->pgdir         = NULL;            // 所分配的页数
 
+    mem_magazine_init(pthread);               // 内存块缓存开始时为空
+    mem_usage_init(&pthread->mem);            // 什么也没占用,也不限制
+
     // 预留标准输入输出
     pthread->fd_table[0]   = 0;               // 标准输入
     pthread->fd_table[1]   = 1;               // 标准输出
@@ -209,11 +225,26 @@ void init_thread(struct task_struct *pthread, char *name, int prio)
     return;
 }
 
+// 分配一页内核内存做pcb,失败返回NULL
+struct task_struct *pcb_alloc(void)
+{
+    // pcb_cache缓存的是整页,pcb页的内容由init_thread或fork负责初始化
+    return kmem_cache_alloc(pcb_cache);
+}
+
+// 回收pcb所在的页
+void pcb_free(struct task_struct *pthread)
+{
+    kmem_cache_free(pcb_cache, pthread);
+
+    return;
+}
+
 // 创建一优先级为prio的线程,线程名为name,线程所执行的函数是function(func_arg)
 struct task_struct *thread_start(char *name, int prio, thread_func function, void *func_arg)
 {
     // pcb都位于内核空间,包括用户进程的pcb也是在内核空间
-    struct task_struct *thread = get_kernel_pages(1);       // 先申请一页内存
+    struct task_struct *thread = pcb_alloc();               // 先申请一页内存
 
     init_thread(thread, name, prio);                        // 初始化刚刚建立的thread线程
     thread_create(thread, function, func_arg);              // 创建刚刚建立的进程
@@ -428,44 +459,47 @@ static bool elem2thread_info(struct list_elem *pelem, int arg UNUSED)
     struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
     char out_pad[16] = {0};
 
-    pad_print(out_pad, 16, &pthread->pid, 'd');
+    pad_print(out_pad, PS_COL_WIDTH, &pthread->pid, 'd');
 
     if (pthread->parent_pid == -1)
     {
-        pad_print(out_pad, 16, "NULL", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "NULL", 's');
     }
     else
     {
-        pad_print(out_pad, 16, &pthread->parent_pid, 'd');
+        pad_print(out_pad, PS_COL_WIDTH, &pthread->parent_pid, 'd');
     }
 
     switch (pthread->status)
     {
     case 0:
-        pad_print(out_pad, 16, "RUNNING", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "RUNNING", 's');
         break;
 
     case 1:
-        pad_print(out_pad, 16, "READY", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "READY", 's');
         break;
 
     case 2:
-        pad_print(out_pad, 16, "BLOCKED", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "BLOCKED", 's');
         break;
 
     case 3:
-        pad_print(out_pad, 16, "WAITING", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "WAITING", 's');
         break;
 
     case 4:
-        pad_print(out_pad, 16, "HANGING", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "HANGING", 's');
         break;
 
     case 5:
-        pad_print(out_pad, 16, "DIED", 's');
+        pad_print(out_pad, PS_COL_WIDTH, "DIED", 's');
     }
 
-    pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+    pad_print(out_pad, PS_COL_WIDTH, &pthread->elapsed_ticks, 'x');
+    pad_print(out_pad, PS_COL_WIDTH, &pthread->min_flt, 'x');
+    pad_print(out_pad, PS_COL_WIDTH, &pthread->maj_flt, 'x');
+    pad_print(out_pad, PS_COL_WIDTH, &pthread->mem.rss, 'x');
 
     memset(out_pad, 0, 16);
     ASSERT(strlen(pthread->name) < 17);
@@ -482,7 +516,7 @@ static bool elem2thread_info(struct list_elem *pelem, int arg UNUSED)
 // 打印任务列表
 void sys_ps(void)
 {
-    char *ps_title = "PID            PPID           STAT           TICKS          COMMAND\n";
+    char *ps_title = "PID       PPID      STAT      TICKS     MINFLT    MAJFLT    RSS       COMMAND\n";
     sys_write(stdout_no, ps_title, strlen(ps_title));
     list_traversal(&thread_all_list, elem2thread_info, 0);
 
@@ -492,6 +526,13 @@ void sys_ps(void)
 // 回收thread_over的pcb和页表,并将其从调度队列中去除
 void thread_exit(struct task_struct *thread_over, bool need_schedule)
 {
+    // 内核线程缓存的是内核堆的块,还回去;进程的块在它自己的堆中,随地址空间一起回收
+    // 可能要等内核内存池的锁,所以在关中断之前
+    if (thread_over->pgdir == NULL)
+    {
+        mem_magazine_drain(thread_over);
+    }
+
     // 要保证schedule在关中断情况下调用
     intr_disable();
     thread_over->status = TASK_DIED;
@@ -504,6 +545,7 @@ void thread_exit(struct task_struct *thread_over, bool need_schedule)
 
     if (thread_over->pgdir) // 如是进程,回收进程的页表
     {
+        page_dir_unload(thread_over->pgdir);
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
     }
 
@@ -513,7 +555,7 @@ void thread_exit(struct task_struct *thread_over, bool need_schedule)
     // 回收pcb所在的页,主线程的pcb不在堆中,跨过
     if (thread_over != main_thread)
     {
-        mfree_page(PF_KERNEL, thread_over, 1);
+        pcb_free(thread_over);
     }
 
     // 归还pid
@@ -564,6 +606,11 @@ void thread_init(void)
     list_init(&thread_all_list);
     lock_init(&pid_lock);
     pid_pool_init();
+
+    // pcb正好一页,创建整页对象的cache
+    pcb_cache = kmem_cache_create("task_struct", PG_SIZE, NULL);
+    ASSERT(pcb_cache != NULL);
+
     process_execute(init, "init");
 
     // 将当前main函数创建为线程
@@ -4,6 +4,7 @@
 #include "../lib/kernel/list.h"
 #include "../lib/kernel/bitmap.h"
 #include "../kernel/memory.h"
+#include "../kernel/vma.h"
 
 #define TASK_NAME_LEN 16
 #define MAX_FILES_OPEN_PER_PROC 8
@@ -118,14 +119,23 @@ struct task_struct
 
     uint32_t         *pgdir;             // 进程自己页表的虚拟地址空间，而线程没有
 
-    struct virtual_addr userprog_vaddr;  // 进程自己的地址空间
+    struct vma_tree  vmas;               // 进程自己的地址空间,由互不重叠的区域组成
+    uint32_t         brk;                // 用户堆的结束地址,[USER_HEAP_START, brk)是堆,见sys_brk
 
     // 用户进程内存块描述符，实现堆管理
     struct mem_block_desc u_block_desc[DESC_CNT];
 
+    // 最近释放的小内存块,sys_malloc和sys_free的快速路径,内核线程缓存的是内核堆的块
+    struct mem_magazine   mags[DESC_CNT];
+
+    // 占用的页框、页表和堆,以及它们的上限
+    struct mem_usage      mem;
+
     uint32_t         cwd_inode_nr;       // 进程所在的工作目录的inode编号
     int16_t          parent_pid;         // 父进程pid
     int8_t           exit_status;        // 进程结束时自己调用exit传入的参数
+    uint32_t         min_flt;            // 不需要读磁盘就处理完的缺页次数(按需分配的零页、写时复制)
+    uint32_t         maj_flt;            // 需要从文件读入页面的缺页次数
     uint32_t         stack_magic;        // 用这串数字做栈的边界标记,用于检测栈的溢出
 };
 
@@ -167,6 +177,12 @@ pid_t fork_pid(void);
 // 打印任务列表
 void sys_ps(void);
 
+// 分配一页内核内存做pcb,失败返回NULL
+struct task_struct *pcb_alloc(void);
+
+// 回收pcb所在的页
+void pcb_free(struct task_struct *pthread);
+
 // 回收thread_over的pcb和页表,并将其从调度队列中去除
 void thread_exit(struct task_struct *thread_over, bool need_schedule);
 
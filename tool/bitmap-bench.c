@@ -0,0 +1,206 @@
+/**
+ * @brief
+ * 位图扫描的基准测试,在宿主机上编译运行,不进内核:
+ *
+ *   gcc -O2 -fno-builtin -iquote lib/kernel/ -iquote lib/ -iquote kernel/ -o bitmap-bench tool/bitmap-bench.c lib/kernel/bitmap.c
+ *   ./bitmap-bench
+ *
+ * 位图大小按512M内存、每页一位计算,共131072位,即16K字节。
+ * 对比旧的逐字节逐位扫描(old_bitmap_scan,照搬原来的实现)和新的按字扫描:
+ *   scan:  位图内容不变,反复从头扫描,比较扫描本身的速度
+ *   alloc: 反复扫描并置位,模拟分配,新实现可以利用next_fit
+ * 填充方式分为前缀填充(从头连续分配)和随机填充两种
+ *
+ * 用-iquote而不是-I,是为了让<stdio.h>等找到宿主机的头文件而不是lib/下的同名文件,
+ * 另外lib/stdint.h的int64_t和宿主机的不一致,所以不能包含<stdlib.h>
+ */
+
+#include "bitmap.h"
+#include "stdint.h"
+#include "debug.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+extern void exit(int status);
+
+#define BENCH_BITS     (512 * 1024 * 1024 / 4096)
+#define BENCH_BYTES    (BENCH_BITS / 8)
+#define BENCH_ROUNDS   1000
+
+static uint8_t bits_buf[BENCH_BYTES + 4];     // 旧实现会多读一个字节,留出余量
+static uint8_t fill_buf[BENCH_BYTES];
+static uint32_t rand_seed;
+
+// bitmap.c中的ASSERT需要它
+void panic_spin(char *filename, int line, const char *func, const char *condition)
+{
+    fprintf(stderr, "%s:%d %s: %s\n", filename, line, func, condition);
+    exit(1);
+}
+
+// 原来的bitmap_scan,先逐字节跳过0xff,再逐位检查连续的空闲位
+static int old_bitmap_scan(struct bitmap *btmp, uint32_t cnt)
+{
+    uint32_t idx_byte = 0;
+
+    while ((btmp->bits[idx_byte] == 0xff) && (idx_byte < btmp->btmp_bytes_len))
+    {
+        idx_byte++;
+    }
+
+    if (idx_byte == btmp->btmp_bytes_len)
+    {
+        return -1;
+    }
+
+    int idx_bit = 0;
+    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+    {
+        idx_bit++;
+    }
+
+    int bit_idx_start = idx_byte * 8 + idx_bit;
+    if (cnt == 1)
+    {
+        return bit_idx_start;
+    }
+
+    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);
+    uint32_t next_bit = bit_idx_start + 1;
+    uint32_t count    = 1;
+
+    bit_idx_start = -1;
+    while (bit_left-- > 0)
+    {
+        if (!(bitmap_scan_test(btmp, next_bit)))
+        {
+            count++;
+        }
+        else
+        {
+            count = 0;
+        }
+
+        if (count == cnt)
+        {
+            bit_idx_start = next_bit - cnt + 1;
+            break;
+        }
+
+        next_bit++;
+    }
+
+    return bit_idx_start;
+}
+
+// 线性同余的伪随机数,保证每次运行的填充结果相同
+static uint32_t bench_rand(void)
+{
+    rand_seed = rand_seed * 1103515245 + 12345;
+
+    return rand_seed >> 1;
+}
+
+// 返回纳秒级的时间
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 按percent的占用率生成填充好的位图,random为真时随机填充,否则从头连续填充
+static void make_fill(uint32_t percent, int random)
+{
+    uint32_t target = BENCH_BITS / 100 * percent;
+    uint32_t bit_idx;
+
+    memset(fill_buf, 0, BENCH_BYTES);
+    rand_seed = percent;
+
+    for (bit_idx = 0; bit_idx < target; bit_idx++)
+    {
+        uint32_t pos = random ? bench_rand() % BENCH_BITS : bit_idx;
+        fill_buf[pos / 8] |= 1 << (pos % 8);
+    }
+
+    return;
+}
+
+// 用old为真时测旧实现,否则测新实现,alloc为真时每次扫描后把找到的位置1
+static double bench(int old, int alloc, uint32_t cnt)
+{
+    struct bitmap btmp;
+    btmp.bits           = bits_buf;
+    btmp.btmp_bytes_len = BENCH_BYTES;
+    btmp.next_fit       = 0;
+
+    memcpy(bits_buf, fill_buf, BENCH_BYTES);
+
+    uint64_t start = now_ns();
+    uint32_t round;
+
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        int bit_idx;
+
+        if (old)
+        {
+            bit_idx = old_bitmap_scan(&btmp, cnt);
+        }
+        else
+        {
+            bit_idx = bitmap_scan(&btmp, cnt);
+
+            // 只比较扫描速度时,每次都从头开始
+            if (!alloc)
+            {
+                btmp.next_fit = 0;
+            }
+        }
+
+        if (bit_idx == -1)
+        {
+            break;
+        }
+
+        if (alloc)
+        {
+            bitmap_set_range(&btmp, bit_idx, cnt, 1);
+        }
+    }
+
+    return (double)(now_ns() - start) / BENCH_ROUNDS;
+}
+
+int main(void)
+{
+    static const uint32_t fills[] = {0, 10, 50, 90, 99};
+    static const uint32_t cnts[]  = {1, 8};
+    uint32_t f, c;
+    int random;
+
+    printf("bitmap of %d bits, %d rounds, ns per call\n", BENCH_BITS, BENCH_ROUNDS);
+    printf("%-8s %5s %4s %12s %12s %12s %12s\n", "fill", "used", "cnt",
+           "old scan", "new scan", "old alloc", "new alloc");
+
+    for (random = 0; random < 2; random++)
+    {
+        for (f = 0; f < sizeof(fills) / sizeof(fills[0]); f++)
+        {
+            make_fill(fills[f], random);
+
+            for (c = 0; c < sizeof(cnts) / sizeof(cnts[0]); c++)
+            {
+                printf("%-8s %4d%% %4d %12.1f %12.1f %12.1f %12.1f\n",
+                       random ? "random" : "prefix", fills[f], cnts[c],
+                       bench(1, 0, cnts[c]), bench(0, 0, cnts[c]),
+                       bench(1, 1, cnts[c]), bench(0, 1, cnts[c]));
+            }
+        }
+    }
+
+    return 0;
+}
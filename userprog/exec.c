@@ -2,9 +2,14 @@
 #include "../thread/thread.h"
 #include "../lib/kernel/stdio-kernel.h"
 #include "../fs/fs.h"
+#include "../fs/file.h"
 #include "../lib/string.h"
 #include "../kernel/global.h"
 #include "../kernel/memory.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/fault.h"
+#include "process.h"
+#include "mmap.h"
 
 extern void intr_exit(void);
 typedef uint32_t Elf32_Word;
@@ -61,60 +66,135 @@ enum segment_type
     PT_PHDR        // 程序头表
 };
 
-// 将文件描述符fd指向的文件中,偏移为offset,大小为filesz的段加载到虚拟地址为vaddr的内存
-static bool segment_load(int32_t fd, uint32_t offset, uint32_t filesz, uint32_t vaddr)
+/**
+ * @brief
+ * 段所在的页不再预先分配,也不在exec时从文件读入,只在进程的区域树中加一个文件映射的区域。
+ * 进程第一次访问时触发缺页异常,由vma_file_fault从文件读入并预读后面几页,
+ * p_memsz大于p_filesz的部分(bss)则由缺页异常分配清0的页框(见kernel/fault.c、kernel/vma.c)。
+ * 像cat这样运行很短的命令只会读入实际执行到的代码。
+ * 只读段的页直接映射页缓存中以(inode, 文件页号)为键的页框,靠页框的引用计数共享,
+ * 同一程序同时运行多份时代码只有一份,后启动的进程缺页时附近已缓存的页也一起映射上
+ */
+
+// 去掉[start, end)范围内的区域和已经映射的页
+static void exec_unmap_range(struct task_struct *cur, uint32_t start, uint32_t end)
 {
-    uint32_t vaddr_first_page = vaddr & 0xfffff000;     // vaddr地址所在的页框
+    uint32_t vaddr = start;
 
-    // 加载到内存后,文件在第一个页框中占用的字节大小
-    uint32_t size_in_first_page = PG_SIZE - (vaddr & 0x00000fff);
-    uint32_t occupy_pages = 0;
+    while (vaddr < end)
+    {
+        page_unmap(vaddr);
+        vaddr += PG_SIZE;
+    }
+
+    vma_unmap(&cur->vmas, start, end);
+
+    return;
+}
+
+// 去掉原进程体的所有文件映射区域,原进程的堆和栈保留,exec的参数可能就在里面
+static void exec_release_image(struct task_struct *cur)
+{
+    struct vm_area *vma = vma_find_next(&cur->vmas, 0);
 
-    // 若一个页框容不下该段
-    if (filesz > size_in_first_page)
+    while (vma != NULL)
     {
-        uint32_t left_size = filesz - size_in_first_page;
+        uint32_t end = vma->end;
+
+        if (vma->type == VMA_FILE)
+        {
+            exec_unmap_range(cur, vma->start, end);
+        }
 
-        // 1是指vaddr_first_page
-        occupy_pages = DIV_ROUND_UP(left_size, PG_SIZE) + 1;
+        vma = vma_find_next(&cur->vmas, end);
     }
-    else
+
+    return;
+}
+
+// 将文件描述符fd指向的文件中phdr描述的段映射到进程的地址空间,inode是fd对应的文件,成功返回true
+static bool segment_load(int32_t fd, struct inode *inode, struct Elf32_Phdr *phdr)
+{
+    struct task_struct *cur = running_thread();
+
+    uint32_t start    = phdr->p_vaddr & 0xfffff000;       // vaddr地址所在的页框
+    uint32_t end      = (phdr->p_vaddr + phdr->p_memsz + PG_SIZE - 1) & 0xfffff000;
+    uint32_t file_end = phdr->p_vaddr + phdr->p_filesz;
+
+    // 段不能和用户堆重叠,exec保留原进程的堆
+    if (phdr->p_memsz < phdr->p_filesz || start < USER_VADDR_START || end > USER_HEAP_START)
+    {
+        return false;
+    }
+
+    // elf的p_flags: 1可执行 2可写 4可读
+    uint8_t prot = (phdr->p_flags & 1 ? VM_EXEC : 0) | (phdr->p_flags & 2 ? VM_WRITE : 0) | (phdr->p_flags & 4 ? VM_READ : 0);
+
+    // 没有bss的只读段(代码)最后一页也整页取自文件,这一页才能直接映射页缓存,和运行同一程序的进程共用。
+    // 页中段之后的部分是文件中随后的内容,段本身用不到
+    if (!(prot & VM_WRITE) && phdr->p_memsz == phdr->p_filesz)
     {
-        occupy_pages = 1;
+        file_end = end;
     }
 
-    // 为进程分配内存
-    uint32_t page_idx   = 0;
-    uint32_t vaddr_page = vaddr_first_page;
+    // 段的第一页和前一个段的最后一页是同一页时,这一页归前一个段的区域,本段在这一页中的内容直接读入
+    struct vm_area *prev_vma = vma_find(&cur->vmas, start);
+    bool shared_first        = prev_vma != NULL && prev_vma->type == VMA_FILE;
 
-    while (page_idx < occupy_pages)
+    // 这一页要同时满足两个段的访问属性
+    if (shared_first)
     {
-        uint32_t *pde   = pde_ptr(vaddr_page);
-        uint32_t *pte   = pte_ptr(vaddr_page);
+        prev_vma->prot |= prot;
 
-        /**
-         * @brief 
-         * 如果pde不存在,或者pte不存在就分配内存.
-         * pde的判断要在pte之前,否则pde若不存在会导致
-         * 判断pte时缺页异常
-         * 
-         */
+        // 关中断,防止判断完之后页被换出
+        enum intr_status old_status = intr_disable();
 
-        if (!(*pde & 0x00000001) || !(*pte & 0x00000001))
+        if ((prot & VM_WRITE) && page_present(start))
         {
-            if (get_a_page(PF_USER, vaddr_page) == NULL)
-            {
-                return false;
-            }
+            page_set_writable(start, true);
+        }
 
-        } // 如果原进程的页表已经分配了,利用现有的物理页,直接覆盖进程体
+        intr_set_status(old_status);
 
-        vaddr_page += PG_SIZE;
-        page_idx++;
+        start += PG_SIZE;
     }
 
-    sys_lseek(fd, offset, SEEK_SET);
-    sys_read(fd, (void *)vaddr, filesz);
+    // exec沿用原进程的页表,原进程在这里的页要先去掉映射,让新进程重新从缺页开始
+    exec_unmap_range(cur, start, end);
+
+    if (start < end)
+    {
+        bool mapped = file_end > start ?
+                      vma_map_file(&cur->vmas, start, end, prot, inode, phdr->p_offset + (start - phdr->p_vaddr), file_end) :
+                      vma_map(&cur->vmas, start, (end - start) / PG_SIZE, prot, VMA_ANON);
+
+        if (!mapped)
+        {
+            return false;
+        }
+    }
+
+    if (shared_first && phdr->p_filesz > 0)
+    {
+        uint32_t size = PG_SIZE - (phdr->p_vaddr & 0x00000fff);
+        size = size < phdr->p_filesz ? size : phdr->p_filesz;
+
+        sys_lseek(fd, phdr->p_offset, SEEK_SET);
+
+        if (sys_read(fd, (void *)phdr->p_vaddr, size) != (int32_t)size)
+        {
+            return false;
+        }
+    }
+
+    // 前一个段的最后一页可能整页取自文件,本段的bss落在这一页中的部分要清0
+    if (shared_first && phdr->p_memsz > phdr->p_filesz && phdr->p_vaddr + phdr->p_filesz < start)
+    {
+        uint32_t bss_start = phdr->p_vaddr + phdr->p_filesz;
+        uint32_t bss_end   = phdr->p_vaddr + phdr->p_memsz < start ? phdr->p_vaddr + phdr->p_memsz : start;
+
+        memset((void *)bss_start, 0, bss_end - bss_start);
+    }
 
     return true;
 }
@@ -150,6 +230,11 @@ static int32_t load(const char *pathname)
         goto done;
     }
 
+    // 新的进程体来自这个文件,缺页时要从这里读入,原进程体的区域作废
+    struct inode *inode = file_table[fd_local2global(fd)].fd_inode;
+    msync_all();
+    exec_release_image(running_thread());
+
     Elf32_Off prog_header_offset = elf_header.e_phoff;
     Elf32_Half prog_header_size  = elf_header.e_phentsize;
 
@@ -172,7 +257,7 @@ static int32_t load(const char *pathname)
         // 如果是可加载段就调用segment_load加载到内存
         if (PT_LOAD == prog_header.p_type)
         {
-            if (!segment_load(fd, prog_header.p_offset, prog_header.p_filesz, prog_header.p_vaddr))
+            if (!segment_load(fd, inode, &prog_header))
             {
                 ret = -1;
                 goto done;
@@ -197,23 +282,59 @@ done:
 int32_t sys_execv(const char *path, const char *argv[])
 {
     uint32_t argc = 0;
+    const char *arg;
 
-    while (argv[argc])
+    // argv和path都来自用户进程,地址非法时返回-1,这时原进程体还没有被替换
+    while (1)
     {
+        if (copy_from_user(&arg, &argv[argc], sizeof(const char *)) != 0)
+        {
+            return -1;
+        }
+
+        if (arg == NULL)
+        {
+            break;
+        }
+
         argc++;
     }
 
-    int32_t entry_point = load(path);
+    // 堆在exec后保留,路径复制到堆中后load替换进程体时也不会丢失
+    char *kpath = sys_malloc(MAX_PATH_LEN);
+
+    if (kpath == NULL)
+    {
+        return -1;
+    }
+
+    if (strncpy_from_user(kpath, path, MAX_PATH_LEN) <= 0)
+    {
+        sys_free(kpath);
+        return -1;
+    }
+
+    int32_t entry_point = load(kpath);
     if (entry_point == -1) // 若加载失败则返回-1
     {
+        sys_free(kpath);
         return -1;
     }
 
     struct task_struct *cur = running_thread();
 
     // 修改进程名
-    memcpy(cur->name, path, TASK_NAME_LEN);
+    memcpy(cur->name, kpath, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN - 1] = 0;
+    sys_free(kpath);
+
+    // 从磁盘上执行的程序最多用用户内存池的7/8页框,一个程序失控也给init和shell留下余地
+    uint32_t page_limit = mem_default_page_limit();
+
+    if (cur->mem.limit[MEM_RES_PAGES] > page_limit)
+    {
+        cur->mem.limit[MEM_RES_PAGES] = page_limit;
+    }
 
     struct intr_stack *intr_0_stack = (struct intr_stack *)((uint32_t)cur + PG_SIZE - sizeof(struct intr_stack));
 
@@ -2,6 +2,8 @@
 #include "process.h"
 #include "../fs/file.h"
 #include "../kernel/memory.h"
+#include "../kernel/swap.h"
+#include "../kernel/kmap.h"
 #include "../kernel/interrupt.h"
 #include "../kernel/debug.h"
 #include "../thread/thread.h"
@@ -10,14 +12,16 @@
 
 extern void intr_exit(void);
 
-// 将父进程的pcb、虚拟地址位图拷贝给子进程
-static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
+// 将父进程的pcb、地址空间的区域树拷贝给子进程
+static int32_t copy_pcb_vma_stack0(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
     // 1. 复制pcb所在的整个页,里面包含进程pcb信息及特级0极的栈,里面包含了返回地址, 然后再单独修改个别部分
     memcpy(child_thread, parent_thread, PG_SIZE);
 
     child_thread->pid           = fork_pid();
     child_thread->elapsed_ticks = 0;
+    child_thread->min_flt       = 0;
+    child_thread->maj_flt       = 0;
     child_thread->status        = TASK_READY;
     child_thread->ticks         = child_thread->priority;         // 为新进程把时间片充满
 
@@ -26,21 +30,15 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct *child_thread, str
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
 
     block_desc_init(child_thread->u_block_desc);
+    mem_magazine_init(child_thread);
 
-    // 2. 复制父进程的虚拟地址池的位图
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    void *vaddr_btmp       = get_kernel_pages(bitmap_pg_cnt);
-
-    if (vaddr_btmp == NULL)
+    // 2. 复制父进程地址空间的区域树
+    // 此时child_thread->vmas还是指向父进程的区域树,下面为子进程复制一份自己的
+    if (!vma_tree_copy(&child_thread->vmas, &parent_thread->vmas))
     {
         return -1;
     }
 
-    // 此时child_thread->userprog_vaddr.vaddr_bitmap.bits还是指向父进程虚拟地址的位图地址
-    // 下面将child_thread->userprog_vaddr.vaddr_bitmap.bits指向自己的位图vaddr_btmp
-    memcpy(vaddr_btmp, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
-    child_thread->userprog_vaddr.vaddr_bitmap.bits = vaddr_btmp;
-
     // 调试用
     // ASSERT(strlen(child_thread->name) < 11); // pcb.name的长度是16,为避免下面strcat越界
     // strcat(child_thread->name, "_fork");
@@ -48,64 +46,147 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct *child_thread, str
     return 0;
 }
 
-// 复制子进程的进程体(代码和数据)及用户栈
-static void copy_body_stack3(struct task_struct *child_thread,
-                             struct task_struct *parent_thread, void *buf_page)
+/**
+ * @brief
+ * 写时复制:不再复制父进程用户空间的数据,而是让子进程的页表映射同样的物理页框。
+ * 父进程可写的页表项改为只读并打上PG_COW标记,再把整张页表复制给子进程,
+ * 页框的引用计数加1,等到有一方写的时候再由缺页异常处理程序复制这一页(见kernel/fault.c)
+ *
+ * 子进程的页表不用切换cr3去创建:页目录在内核空间中可以直接写,
+ * 新页表的页框用kmap临时映射到KMAP_COPY窗口上填入。全部复制完后重新加载一次cr3,
+ * 刷掉父进程tlb中还可写的旧表项
+ */
+
+// 复制页表中途失败时撤销已经给子进程的页表:页框和交换槽的引用计数减回去,
+// 父进程中只剩自己映射的写时复制页恢复可写,再释放子进程的页表,调用时页表还是父进程的
+static void undo_body_stack3(struct task_struct *child_thread)
 {
-    uint8_t *vaddr_btmp     = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start    = parent_thread->userprog_vaddr.vaddr_start;
-
-    uint32_t idx_byte       = 0;
-    uint32_t idx_bit        = 0;
-    uint32_t prog_vaddr     = 0;
+    uint32_t user_pde_nr = 768;
+    uint32_t pde_idx     = 0;
 
-    // 在父进程的用户空间中查找已有数据的页
-    while (idx_byte < btmp_bytes_len)
+    while (pde_idx < user_pde_nr)
     {
+        uint32_t pde = child_thread->pgdir[pde_idx];
+
+        if (!(pde & PG_P_1))
+        {
+            pde_idx++;
+            continue;
+        }
 
-        if (vaddr_btmp[idx_byte])
+        uint32_t  pt_phyaddr = pde & 0xfffff000;
+        uint32_t *parent_pte = pte_ptr(pde_idx * 0x400000);
+
+        enum intr_status old_status = intr_disable();
+        uint32_t *child_pt          = kmap(KMAP_COPY, pt_phyaddr);
+        uint32_t  pte_idx           = 0;
+
+        while (pte_idx < 1024)
         {
-            idx_bit = 0;
+            uint32_t pte = child_pt[pte_idx];
 
-            while (idx_bit < 8)
+            if (pte & PG_P_1)
             {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte])
+                uint32_t pg_phy_addr = pte & 0xfffff000;
+                pfree(pg_phy_addr);
+
+                // 零页是钉住的,不计引用计数,一直保持只读
+                if ((parent_pte[pte_idx] & (PG_P_1 | PG_COW)) == (PG_P_1 | PG_COW) &&
+                    (parent_pte[pte_idx] & 0xfffff000) == pg_phy_addr &&
+                    pg_phy_addr != zero_page_phy() && page_ref_count(pg_phy_addr) == 1)
                 {
-                    prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
+                    parent_pte[pte_idx] = (parent_pte[pte_idx] & ~PG_COW) | PG_RW_W;
+                }
+            }
+            else if (PTE_IS_SWAP(pte))
+            {
+                swap_free_entry(pte);
+            }
 
-                    /**
-                     * @brief 
-                     * 下面的操作是将父进程用户空间中的数据通过内核空间做中转,最终复制到子进程的用户空间
-                     */
+            pte_idx++;
+        }
 
-                    // A 将父进程在用户空间中的数据复制到内核缓冲区buf_page
-                    // 目的是下面切换到子进程的页表后,还能访问到父进程的数据
-                    memcpy(buf_page, (void *)prog_vaddr, PG_SIZE);
+        kunmap(KMAP_COPY, child_pt);
+        child_thread->pgdir[pde_idx] = 0;
+        intr_set_status(old_status);
 
-                    // B 将页表切换到子进程,目的是避免下面申请内存的函数将pte及pde安装在父进程的页表中
-                    page_dir_activate(child_thread);
+        free_a_phy_page(pt_phyaddr);
+        pde_idx++;
+    }
 
-                    // C 申请虚拟地址prog_vaddr
-                    get_a_page_without_op_vaddrbitmap(PF_USER, prog_vaddr);
+    return ;
+}
 
-                    // D 从内核缓冲区中将父进程数据复制到子进程的用户空间
-                    memcpy((void *)prog_vaddr, buf_page, PG_SIZE);
+// 让子进程共享父进程的进程体(代码和数据)及用户栈,成功返回0,失败返回-1
+static int32_t copy_body_stack3(struct task_struct *child_thread, struct task_struct *parent_thread)
+{
+    // 用户空间是0~3G,对应页目录项0~767
+    uint32_t user_pde_nr = 768;
+    uint32_t pde_idx     = 0;
+    int32_t  ret         = 0;
+
+    while (pde_idx < user_pde_nr)
+    {
+        uint32_t vaddr = pde_idx * 0x400000;          // 此页目录项覆盖的4M空间的起始地址
+
+        if (!(*pde_ptr(vaddr) & PG_P_1))
+        {
+            pde_idx++;
+            continue;
+        }
 
-                    // E 恢复父进程页表
-                    page_dir_activate(parent_thread);
+        // 子进程的页表一律从内核内存池分配,内容马上整页覆盖,不用清0
+        uint32_t pt_phyaddr = (uint32_t)get_a_phy_page(PF_KERNEL);
+
+        if (pt_phyaddr == 0)
+        {
+            undo_body_stack3(child_thread);
+            ret = -1;
+            break;
+        }
+
+        // A 父进程的页表项改为只读共享,页框的引用计数加1,已换出的页交换槽的引用计数加1
+        //   关中断到复制完页表,防止中途有页被换出
+        enum intr_status old_status = intr_disable();
+        uint32_t *first_pte         = pte_ptr(vaddr);
+        uint32_t  pte_idx           = 0;
+
+        while (pte_idx < 1024)
+        {
+            uint32_t *pte = first_pte + pte_idx;
+
+            if (*pte & PG_P_1)
+            {
+                if (*pte & PG_RW_W)
+                {
+                    *pte = (*pte & ~PG_RW_W) | PG_COW;
                 }
 
-                idx_bit++;
+                page_ref_inc(*pte & 0xfffff000);
+            }
+            else if (PTE_IS_SWAP(*pte))
+            {
+                swap_dup_entry(*pte);
             }
 
+            pte_idx++;
         }
 
-        idx_byte++;
+        // B 通过临时映射把父进程的页表复制到子进程的新页表中,再填入子进程的页目录项
+        void *child_pt = kmap(KMAP_COPY, pt_phyaddr);
+        memcpy(child_pt, first_pte, PG_SIZE);
+        kunmap(KMAP_COPY, child_pt);
 
+        child_thread->pgdir[pde_idx] = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+        intr_set_status(old_status);
+
+        pde_idx++;
     } // end while
 
-    return;
+    // C 重新加载cr3,刷新父进程tlb中可写的旧表项,失败时也要刷掉撤销前只读的表项
+    page_dir_activate(parent_thread);
+
+    return ret;
 }
 
 // 为子进程构建thread_stack和修改返回值
@@ -173,17 +254,11 @@ static void update_inode_open_cnts(struct task_struct *thread)
 // 拷贝父进程本身所占资源给子进程
 static int32_t copy_process(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
-    // 内核缓冲区,作为父进程用户空间的数据复制到子进程用户空间的中转
-    void *buf_page = get_kernel_pages(1);
-
-    if (buf_page == NULL)
-    {
-        return -1;
-    }
-
-    // A 复制父进程的pcb、虚拟地址位图、内核栈到子进程
-    if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1)
+    // A 复制父进程的pcb、区域树、内核栈到子进程
+    // 失败时把已经给子进程的资源都还回去,pcb由sys_fork回收
+    if (copy_pcb_vma_stack0(child_thread, parent_thread) == -1)
     {
+        release_pid(child_thread->pid);
         return -1;
     }
 
@@ -191,11 +266,19 @@ static int32_t copy_process(struct task_struct *child_thread, struct task_struct
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL)
     {
+        vma_tree_destroy(&child_thread->vmas);
+        release_pid(child_thread->pid);
         return -1;
     }
 
-    // C 复制父进程进程体及用户栈给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    // C 子进程以写时复制的方式共享父进程进程体及用户栈,失败时已撤销了复制的页表
+    if (copy_body_stack3(child_thread, parent_thread) == -1)
+    {
+        mfree_page(PF_KERNEL, child_thread->pgdir, 1);
+        vma_tree_destroy(&child_thread->vmas);
+        release_pid(child_thread->pid);
+        return -1;
+    }
 
     // D 构建子进程thread_stack和修改返回值pid
     build_child_stack(child_thread);
@@ -203,8 +286,6 @@ static int32_t copy_process(struct task_struct *child_thread, struct task_struct
     // E 更新文件inode的打开数
     update_inode_open_cnts(child_thread);
 
-    mfree_page(PF_KERNEL, buf_page, 1);
-
     return 0;
 }
 
@@ -214,7 +295,7 @@ pid_t sys_fork(void)
     struct task_struct *parent_thread = running_thread();
 
     // 为子进程创建pcb(task_struct结构)
-    struct task_struct *child_thread = get_kernel_pages(1);
+    struct task_struct *child_thread = pcb_alloc();
 
     if (child_thread == NULL)
     {
@@ -225,6 +306,7 @@ pid_t sys_fork(void)
 
     if (copy_process(child_thread, parent_thread) == -1)
     {
+        pcb_free(child_thread);
         return -1;
     }
 
@@ -0,0 +1,315 @@
+#include "mmap.h"
+#include "process.h"
+#include "../thread/thread.h"
+#include "../kernel/global.h"
+#include "../kernel/memory.h"
+#include "../kernel/vma.h"
+#include "../kernel/swap.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/fault.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../shell/pipe.h"
+
+/**
+ * @brief
+ * mmap/munmap/msync
+ *
+ * 映射只是在进程的区域树中加一个区域,并不分配页框,页在第一次访问时由缺页异常处理程序填充:
+ * 匿名映射分配清0的页框,文件映射从文件读入(见kernel/vma.c)。
+ * 所以扫描大文件时不必先read到缓冲区,访问到哪一页才读哪一页。
+ *
+ * 共享的文件映射靠页表项的D位知道哪些页被写过,在msync、munmap、exec和进程退出时
+ * 用file_overwrite经页缓存写回文件。写回只覆盖文件原有的内容,不会让文件变长。
+ * 按页对齐的整页直接映射页缓存的页框,映射同一个文件的进程看到的是同一份内容,
+ * 但fork出的子进程得到的是写时复制的副本
+ *
+ * brk/sbrk管理从USER_HEAP_START开始的用户堆,堆只是一个向上增长的匿名区域,
+ * 用户库(lib/user/malloc.c)在里面自己分配内存,只有堆要变大变小时才进入内核。
+ * mmap和内核的sys_malloc不自己选地址时从堆的最大范围之上找,不会挡住堆的增长
+ */
+
+// 用户堆的结束地址,再往上留给栈
+#define MMAP_END (0xc0000000 - USER_STACK3_LIMIT)
+
+// [start, end)是否是mmap可以使用的用户地址范围
+static bool mmap_range_ok(uint32_t start, uint32_t end)
+{
+    return start % PG_SIZE == 0 && start >= USER_VADDR_START && start < end && end <= MMAP_END;
+}
+
+// 返回进程的文件描述符fd对应的可以映射的文件,fd不是普通文件时返回NULL
+static struct file *mmap_get_file(int32_t fd)
+{
+    struct task_struct *cur = running_thread();
+
+    // 标准输入输出和管道都不能映射
+    if (fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC || cur->fd_table[fd] == -1 || is_pipe(fd))
+    {
+        return NULL;
+    }
+
+    return &file_table[fd_local2global(fd)];
+}
+
+// 共享文件映射区域vma中的页vaddr被写过时写回文件
+static void mmap_writeback_page(struct vm_area *vma, uint32_t vaddr)
+{
+    if (vaddr >= vma->file_end || !(*pde_ptr(vaddr) & PG_P_1))
+    {
+        return ;
+    }
+
+    // 换出到交换分区的页可能写过,页表项中保留着D位,先读回来
+    if (PTE_IS_SWAP(*pte_ptr(vaddr)) && !swap_in(vaddr))
+    {
+        return ;
+    }
+
+    // 关中断,防止判断完之后页被换出
+    enum intr_status old_status = intr_disable();
+    bool dirty                  = page_present(vaddr) && page_test_clean(vaddr);
+    intr_set_status(old_status);
+
+    if (!dirty)
+    {
+        return ;
+    }
+
+    uint32_t size = vma->file_end - vaddr < PG_SIZE ? vma->file_end - vaddr : PG_SIZE;
+    file_overwrite(vma->file, vma->file_off + (vaddr - vma->start), (void *)vaddr, size);
+
+    return ;
+}
+
+// 把[start, end)中共享文件映射写过的页写回文件
+static void mmap_writeback(uint32_t start, uint32_t end)
+{
+    struct task_struct *cur = running_thread();
+    struct vm_area *vma     = vma_find_next(&cur->vmas, start);
+
+    while (vma != NULL && vma->start < end)
+    {
+        uint32_t vma_end = vma->end;
+
+        if (vma->type == VMA_FILE && (vma->prot & VM_SHARED))
+        {
+            uint32_t vaddr = vma->start > start ? vma->start : start;
+            uint32_t last  = vma_end < end ? vma_end : end;
+
+            while (vaddr < last)
+            {
+                mmap_writeback_page(vma, vaddr);
+                vaddr += PG_SIZE;
+            }
+        }
+
+        vma = vma_find_next(&cur->vmas, vma_end);
+    }
+
+    return ;
+}
+
+// 按args建立映射,成功返回映射的起始地址,失败返回MAP_FAILED
+void *sys_mmap(struct mmap_args *args)
+{
+    struct task_struct *cur = running_thread();
+
+    // 先复制到内核栈上,用户可能在别的线程中修改它
+    struct mmap_args a;
+
+    if (copy_from_user(&a, args, sizeof(struct mmap_args)) != 0)
+    {
+        return MAP_FAILED;
+    }
+
+    uint32_t share = a.flags & (MAP_SHARED | MAP_PRIVATE);
+
+    if (a.length == 0 || a.length > MMAP_END || (share != MAP_SHARED && share != MAP_PRIVATE))
+    {
+        return MAP_FAILED;
+    }
+
+    uint32_t pg_cnt = DIV_ROUND_UP(a.length, PG_SIZE);
+    uint8_t prot    = a.prot & (VM_READ | VM_WRITE | VM_EXEC);
+
+    // 1 选定映射的地址,希望的地址可用就用它,否则在堆的范围内找一段空闲的
+    uint32_t start = (uint32_t)a.addr;
+
+    if (start == 0 || !mmap_range_ok(start, start + pg_cnt * PG_SIZE))
+    {
+        start = 0;
+    }
+    else
+    {
+        struct vm_area *next = vma_find_next(&cur->vmas, start);
+
+        if (next != NULL && next->start < start + pg_cnt * PG_SIZE)
+        {
+            start = 0;
+        }
+    }
+
+    if (start == 0)
+    {
+        start = vma_get_unmapped(&cur->vmas, pg_cnt);
+
+        if (start == 0)
+        {
+            return MAP_FAILED;
+        }
+    }
+
+    // 2 匿名映射,子进程得到的是写时复制的副本,所以不支持共享的匿名映射
+    if (a.flags & MAP_ANONYMOUS)
+    {
+        if (share != MAP_PRIVATE || !vma_map(&cur->vmas, start, pg_cnt, prot, VMA_ANON))
+        {
+            return MAP_FAILED;
+        }
+
+        return (void *)start;
+    }
+
+    // 3 文件映射,文件必须可读,共享的可写映射还要求文件以读写方式打开
+    struct file *file = mmap_get_file(a.fd);
+
+    if (file == NULL || a.offset % PG_SIZE != 0 || (file->fd_flag & O_WRONLY))
+    {
+        return MAP_FAILED;
+    }
+
+    if (share == MAP_SHARED)
+    {
+        if ((prot & VM_WRITE) && !(file->fd_flag & O_RDWR))
+        {
+            return MAP_FAILED;
+        }
+
+        prot |= VM_SHARED;
+    }
+
+    uint32_t end = start + pg_cnt * PG_SIZE;
+
+    if (!vma_map_file(&cur->vmas, start, end, prot, file->fd_inode, a.offset, start + a.length))
+    {
+        return MAP_FAILED;
+    }
+
+    return (void *)start;
+}
+
+// 解除[addr, addr + length)的映射,共享文件映射中写过的页先写回文件,成功返回0,失败返回-1
+int32_t sys_munmap(void *addr, uint32_t length)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t start          = (uint32_t)addr;
+    uint32_t end            = start + DIV_ROUND_UP(length, PG_SIZE) * PG_SIZE;
+
+    if (length == 0 || length > MMAP_END || !mmap_range_ok(start, end))
+    {
+        return -1;
+    }
+
+    mmap_writeback(start, end);
+
+    uint32_t vaddr = start;
+
+    while (vaddr < end)
+    {
+        page_unmap(vaddr);
+        vaddr += PG_SIZE;
+    }
+
+    return vma_unmap(&cur->vmas, start, end) ? 0 : -1;
+}
+
+// 把[addr, addr + length)中共享文件映射写过的页写回文件,成功返回0,失败返回-1
+int32_t sys_msync(void *addr, uint32_t length)
+{
+    uint32_t start = (uint32_t)addr;
+    uint32_t end   = start + DIV_ROUND_UP(length, PG_SIZE) * PG_SIZE;
+
+    if (length == 0 || length > MMAP_END || !mmap_range_ok(start, end))
+    {
+        return -1;
+    }
+
+    mmap_writeback(start, end);
+
+    return 0;
+}
+
+// 把当前进程所有共享文件映射中写过的页写回文件,在进程退出或exec丢弃原地址空间之前调用
+void msync_all(void)
+{
+    mmap_writeback(USER_VADDR_START, 0xc0000000);
+
+    return ;
+}
+
+// 把当前进程的堆结束地址设为addr,addr为NULL时只查询,成功返回新的结束地址,失败返回原来的
+void *sys_brk(void *addr)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t new_brk        = (uint32_t)addr;
+    uint32_t old_brk        = cur->brk;
+
+    // 堆的第一页留给用户库,不能去掉
+    if (new_brk < USER_HEAP_START + PG_SIZE || new_brk > USER_HEAP_START + USER_HEAP_MAX)
+    {
+        return (void *)old_brk;
+    }
+
+    uint32_t old_end = DIV_ROUND_UP(old_brk, PG_SIZE) * PG_SIZE;
+    uint32_t new_end = DIV_ROUND_UP(new_brk, PG_SIZE) * PG_SIZE;
+
+    if (new_end > old_end)
+    {
+        // 只增加区域,页框在第一次访问时由缺页异常分配
+        struct vm_area *next = vma_find_next(&cur->vmas, old_end);
+
+        if ((next != NULL && next->start < new_end) ||
+            !vma_map(&cur->vmas, old_end, (new_end - old_end) / PG_SIZE, VM_READ | VM_WRITE, VMA_ANON))
+        {
+            return (void *)old_brk;
+        }
+    }
+    else if (new_end < old_end)
+    {
+        // 缩小时归还页框和交换槽
+        uint32_t vaddr = new_end;
+
+        while (vaddr < old_end)
+        {
+            page_unmap(vaddr);
+            vaddr += PG_SIZE;
+        }
+
+        vma_unmap(&cur->vmas, new_end, old_end);
+    }
+
+    cur->brk = new_brk;
+
+    return (void *)new_brk;
+}
+
+// 把当前进程的堆扩大increment字节,为负时缩小,成功返回原来的结束地址,失败返回(void *)-1
+void *sys_sbrk(int32_t increment)
+{
+    uint32_t old_brk = running_thread()->brk;
+    uint32_t new_brk = old_brk + increment;
+
+    // 加减之后绕回去了
+    if ((increment > 0 && new_brk < old_brk) || (increment < 0 && new_brk > old_brk))
+    {
+        return (void *)-1;
+    }
+
+    if ((uint32_t)sys_brk((void *)new_brk) != new_brk)
+    {
+        return (void *)-1;
+    }
+
+    return (void *)old_brk;
+}
@@ -0,0 +1,46 @@
+#ifndef __USERPROG_MMAP_H
+#define __USERPROG_MMAP_H
+#include "stdint.h"
+
+// 映射区域的访问属性,和kernel/vma.h中的VM_READ/VM_WRITE/VM_EXEC取值相同
+#define PROT_READ  1               // 可读
+#define PROT_WRITE 2               // 可写
+#define PROT_EXEC  4               // 可执行
+
+// 映射的方式,MAP_SHARED和MAP_PRIVATE必须且只能选一个
+#define MAP_SHARED    1            // 共享的文件映射,写入的内容在msync、munmap或进程退出时写回文件
+#define MAP_PRIVATE   2            // 私有映射,写入的内容只对本进程可见
+#define MAP_ANONYMOUS 4            // 匿名映射,不对应文件,页第一次访问时清0
+
+#define MAP_FAILED ((void *)-1)    // mmap失败的返回值
+
+// 系统调用最多只能传3个参数,mmap的6个参数放在结构体中传递
+struct mmap_args
+{
+    void    *addr;                 // 希望映射到的地址,按页对齐,为NULL或已被占用时由内核选择
+    uint32_t length;               // 映射的字节数
+    uint32_t prot;                 // PROT_READ/PROT_WRITE/PROT_EXEC的组合
+    uint32_t flags;                // MAP_SHARED/MAP_PRIVATE/MAP_ANONYMOUS的组合
+    int32_t  fd;                   // 映射的文件,匿名映射时忽略
+    uint32_t offset;               // 从文件的offset处开始映射,按页对齐
+};
+
+// 按args建立映射,成功返回映射的起始地址,失败返回MAP_FAILED
+void *sys_mmap(struct mmap_args *args);
+
+// 解除[addr, addr + length)的映射,共享文件映射中写过的页先写回文件,成功返回0,失败返回-1
+int32_t sys_munmap(void *addr, uint32_t length);
+
+// 把[addr, addr + length)中共享文件映射写过的页写回文件,成功返回0,失败返回-1
+int32_t sys_msync(void *addr, uint32_t length);
+
+// 把当前进程所有共享文件映射中写过的页写回文件,在进程退出或exec丢弃原地址空间之前调用
+void msync_all(void);
+
+// 把当前进程的堆结束地址设为addr,addr为NULL时只查询,成功返回新的结束地址,失败返回原来的
+void *sys_brk(void *addr);
+
+// 把当前进程的堆扩大increment字节,为负时缩小,成功返回原来的结束地址,失败返回(void *)-1
+void *sys_sbrk(int32_t increment);
+
+#endif // __USERPROG_MMAP_H
@@ -8,10 +8,18 @@
 #include "../thread/thread.h"
 #include "../lib/string.h"
 #include "../lib/kernel/list.h"
+#ifdef SWITCH_BENCH
+#include "../lib/kernel/io.h"
+#include "../lib/kernel/stdio-kernel.h"
+#endif
 
 
 extern void intr_exit(void);         // 用户进程进入3特权级别的关键
 
+#define KERNEL_PAGE_DIR 0x100000     // 内核页目录的物理地址,内核线程用的页目录
+
+static bool cr3_lazy = true;         // 为false时每次切换任务都重新加载cr3,基准测试用来对比
+
 // 构建用户进程初始上下文信息
 void start_process(void *filename)   // 用户程序的名称
 {
@@ -55,9 +63,16 @@ void start_process(void *filename)   // 用户程序的名称
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
 
     // 关键点4： 为用户进程分配3特权级下的栈，并且将栈中段寄存器的选择之必须指向DPL为3的内存段
-    proc_stack->esp = (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE);
+    // 栈页不预先分配,第一次压栈时由缺页异常分配,之后随着使用向下增长
+    vma_map(&cur->vmas, USER_STACK3_VADDR, 1, VM_READ | VM_WRITE, VMA_STACK);
+    proc_stack->esp = (void *)(USER_STACK3_VADDR + PG_SIZE);
     proc_stack->ss  = SELECTOR_U_DATA;
 
+    // 用户堆的第一页,第一次访问时分配清0的页框,用户库看到全0就知道堆还没有初始化
+    // fork和exec都保留堆,所以只有这里要建
+    vma_map(&cur->vmas, USER_HEAP_START, 1, VM_READ | VM_WRITE, VMA_ANON);
+    cur->brk = USER_HEAP_START + PG_SIZE;
+
     // 通过内联汇编，将esp替换曾proc_stack，然后通过jmp intr_exit使得程序条大中断出口地址intr_exit，然后将其
     // 载入CPU的寄存器，从而使得假装退出中断
     // 关键点1： 从中断返回，必须经过intr_exit，即使是假装
@@ -70,6 +85,15 @@ void start_process(void *filename)   // 用户程序的名称
 }
 
 // 激活页表
+// 返回cr3中当前加载的页目录的物理地址
+static uint32_t cr3_read(void)
+{
+    uint32_t cr3 = 0;
+    asm volatile("movl %%cr3, %0" : "=r"(cr3));
+
+    return cr3 & 0xfffff000;
+}
+
 void page_dir_activate(struct task_struct *p_thread)
 {
     /**
@@ -80,7 +104,7 @@ void page_dir_activate(struct task_struct *p_thread)
      */
 
     // 若为内核线程,需要重新填充页表为0x100000
-    uint32_t pagedir_phy_addr = 0x100000;     // 默认为内核的页目录物理地址,也就是内核线程所用的页目录表
+    uint32_t pagedir_phy_addr = KERNEL_PAGE_DIR;     // 默认为内核的页目录物理地址,也就是内核线程所用的页目录表
 
     if (p_thread->pgdir != NULL) // 用户态进程有自己的页目录表
     { 
@@ -102,8 +126,16 @@ void process_activate(struct task_struct *p_thread)
 {
     ASSERT(p_thread != NULL);
 
-    // 激活该进程或线程的页表
-    page_dir_activate(p_thread);
+    /**
+     * @brief
+     * 激活该进程或线程的页表。重新加载cr3会清空tlb中所有非全局的表项,所以能不加载就不加载:
+     * 内核线程只访问内核部分,所有页目录的内核部分都相同,直接借用上一个任务的页目录;
+     * 要切换到的进程的页目录已经在cr3中(中间只运行过内核线程,或者是同一进程)时也不用重新加载
+     */
+    if (!cr3_lazy || (p_thread->pgdir != NULL && cr3_read() != addr_v2p((uint32_t)p_thread->pgdir)))
+    {
+        page_dir_activate(p_thread);
+    }
 
     // 内核线程特权级本身就是0,处理器进入中断时并不会从tss中获取0特权级栈地址,故不需要更新esp0
     if (p_thread->pgdir)
@@ -116,6 +148,17 @@ void process_activate(struct task_struct *p_thread)
     return;
 }
 
+// 页目录pgdir要释放了,若内核线程正借用着它,先换成内核页目录
+void page_dir_unload(uint32_t *pgdir)
+{
+    if (cr3_read() == addr_v2p((uint32_t)pgdir))
+    {
+        asm volatile("movl %0, %%cr3" ::"r"(KERNEL_PAGE_DIR) : "memory");
+    }
+
+    return;
+}
+
 // 创建页目录表,将当前页表的表示内核空间的pde复制,成功则返回页目录的虚拟地址,否则返回-1
 uint32_t *create_page_dir(void)
 {
@@ -175,46 +218,18 @@ uint32_t *create_page_dir(void)
      */
 }
 
-// 创建用户进程虚拟地址位图,创建虚拟内存池
-void create_user_vaddr_bitmap(struct task_struct *user_prog)
-{
-    /**
-     * @brief user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START
-     * 
-     * 是位图中所管理的内存空间的起始地址,为用户进程定的起始地址是USER_VADDR_START
-     * 该值定义在process.h,其值为0x8048_000
-     * 
-     */
-
-    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-
-    // 用来记录位图所需的内存页数，DIV_ROUND_UP定义在global.h中进行取整
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-
-    // 为位图分配内存
-    user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-
-    // 记录位图长度
-    user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
-
-    // 进行位图初始化，用户虚拟地址位图创建完成
-    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
-
-    return;
-}
-
 // 创建用户进程
 void process_execute(void *filename, char *name)
 {
     // pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请
     // 1. 申请1页内存创建进程的PCB
-    struct task_struct *thread = get_kernel_pages(1);
+    struct task_struct *thread = pcb_alloc();
 
     // 2. 对thread进行初始化
     init_thread(thread, name, default_prio);
 
-    // 3. 为用户进程创建管理虚拟地址空间
-    create_user_vaddr_bitmap(thread);
+    // 3. 为用户进程创建管理虚拟地址空间的区域树,开始时是空的
+    vma_tree_init(&thread->vmas);
 
     // 4. 创建线程
     thread_create(thread, start_process, filename);
@@ -233,4 +248,91 @@ void process_execute(void *filename, char *name)
     intr_set_status(old_status);
 
     return;
-}
\ No newline at end of file
+}
+
+#ifdef SWITCH_BENCH
+
+#define SWITCH_BENCH_ROUNDS 1000       // 每种配置下来回切换的次数
+#define SWITCH_BENCH_PAGES  32         // 每次切换回来后访问的内核页数,模拟任务的工作集
+
+static uint8_t      *bench_buf;        // 两个线程轮流访问的内核页
+static volatile bool bench_stop;       // 通知陪跑线程结束
+
+// 访问bench_buf的每一页,tlb中没有这些页的表项时就要重新查页表
+static void bench_touch(void)
+{
+    uint32_t pg_idx = 0;
+
+    while (pg_idx < SWITCH_BENCH_PAGES)
+    {
+        ((volatile uint8_t *)bench_buf)[pg_idx * PG_SIZE]++;
+        pg_idx++;
+    }
+
+    return;
+}
+
+// 陪跑的内核线程,和主线程轮流让出cpu,测试结束后一直阻塞
+static void bench_partner(void *arg UNUSED)
+{
+    while (!bench_stop)
+    {
+        bench_touch();
+        thread_yield();
+    }
+
+    thread_block(TASK_BLOCKED);
+
+    return;
+}
+
+// 测量当前配置下一次来回切换(包括两边各访问一遍工作集)的平均周期数
+static void bench_run(char *name)
+{
+    uint32_t round = 0;
+    uint64_t start = rdtsc();
+
+    while (round < SWITCH_BENCH_ROUNDS)
+    {
+        bench_touch();
+        thread_yield();
+        round++;
+    }
+
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    printk("  %s: %d cycles per round trip\n", name, cycles / SWITCH_BENCH_ROUNDS);
+
+    return;
+}
+
+// 任务切换的微基准测试,对比有无全局页和按需加载cr3时切换回来重新填充tlb的开销,在init_all之后调用
+void switch_bench(void)
+{
+    printk("switch bench start\n");
+
+    bench_buf = get_kernel_pages(SWITCH_BENCH_PAGES);
+    ASSERT(bench_buf != NULL);
+
+    thread_start("switch_bench", default_prio, bench_partner, NULL);
+
+    // 1 原来的做法:每次切换都重新加载cr3,内核的表项也一起被清出tlb
+    page_global_enable(false);
+    cr3_lazy = false;
+    bench_run("reload cr3, no global pages");
+
+    // 2 内核部分是全局页,重新加载cr3也留在tlb中
+    page_global_enable(true);
+    bench_run("reload cr3, global pages   ");
+
+    // 3 内核线程之间切换不再加载cr3
+    cr3_lazy = true;
+    bench_run("lazy cr3, global pages     ");
+
+    bench_stop = true;
+    mfree_page(PF_KERNEL, bench_buf, SWITCH_BENCH_PAGES);
+
+    printk("switch bench done\n");
+
+    return;
+}
+#endif
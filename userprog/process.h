@@ -7,6 +7,9 @@
 #define default_prio      31
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000)
 #define USER_VADDR_START  0x8048000
+#define USER_STACK3_LIMIT (8 * 1024 * 1024)     // 用户栈最多从0xc0000000向下增长8M
+#define USER_HEAP_START   0x10000000            // 用户堆(brk)的起始地址,第一页由内核建好,留给用户库记录堆的管理信息
+#define USER_HEAP_MAX     (256 * 1024 * 1024)   // 用户堆最多256M,再往上是mmap和sys_malloc用的地址
 
 // 创建用户进程
 void process_execute(void *filename, char *name);
@@ -20,11 +23,16 @@ void process_activate(struct task_struct *p_thread);
 // 激活页表
 void page_dir_activate(struct task_struct *p_thread);
 
+// 页目录pgdir要释放了,若内核线程正借用着它,先换成内核页目录
+void page_dir_unload(uint32_t *pgdir);
+
 // 创建页目录表，将当前页表的表示内核空间的pde复制
 uint32_t *create_page_dir(void);
 
-// 创建用户进程虚拟地址图
-void create_user_vaddr_bitmap(struct task_struct *user_prog);
+#ifdef SWITCH_BENCH
+// 任务切换的微基准测试,对比有无全局页和按需加载cr3时切换回来重新填充tlb的开销,在init_all之后调用
+void switch_bench(void);
+#endif
 
 
 #endif // __USERPROG_PROCESS_H
\ No newline at end of file
@@ -6,13 +6,15 @@
 #include "../lib/string.h"
 #include "../device/console.h"
 #include "../kernel/memory.h"
+#include "../kernel/kmprof.h"
 #include "../fs/fs.h"
 #include "fork.h"
 #include "exec.h"
 #include "wait_exit.h"
 #include "../shell/pipe.h"
+#include "mmap.h"
 
-#define syscall_nr 32
+#define syscall_nr 37
 typedef void *syscall;
 syscall syscall_table[syscall_nr];
 
@@ -52,8 +54,18 @@ void syscall_init(void)
     syscall_table[SYS_EXECV]       = sys_execv;
     syscall_table[SYS_EXIT]        = sys_exit;
     syscall_table[SYS_WAIT]        = sys_wait;
+    syscall_table[SYS_PIPE]        = sys_pipe;
     syscall_table[SYS_FD_REDIRECT] = sys_fd_redirect;
     syscall_table[SYS_HELP]        = sys_help;
+    syscall_table[SYS_MEMINFO]     = sys_meminfo;
+    syscall_table[SYS_MMAP]        = sys_mmap;
+    syscall_table[SYS_MUNMAP]      = sys_munmap;
+    syscall_table[SYS_MSYNC]       = sys_msync;
+    syscall_table[SYS_BRK]         = sys_brk;
+    syscall_table[SYS_SBRK]        = sys_sbrk;
+    syscall_table[SYS_MEMSTAT]     = sys_memstat;
+    syscall_table[SYS_MEMLIMIT]    = sys_memlimit;
+    syscall_table[SYS_KMPROF]      = sys_kmprof;
 
     put_str("syscall_init done\n");
 
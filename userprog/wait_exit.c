@@ -2,6 +2,10 @@
 #include "../kernel/global.h"
 #include "../kernel/debug.h"
 #include "../kernel/memory.h"
+#include "../kernel/swap.h"
+#include "../kernel/vma.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/fault.h"
 #include "../thread/thread.h"
 #include "../lib/kernel/list.h"
 #include "../lib/kernel/bitmap.h"
@@ -9,72 +13,128 @@
 #include "../fs/fs.h"
 #include "../fs/file.h"
 #include "../shell/pipe.h"
+#include "mmap.h"
+#ifdef EXIT_BENCH
+#include "../lib/kernel/io.h"
+#endif
+
+#define FREE_BATCH 64         // 退出时攒够这么多页框批量释放一次
+
+// 释放[start, end)中映射的页框和交换槽,end不跨过start所在的4M,调用时关中断。
+// 释放的页表项随即清0,开中断后换页的clock扫描和内存规整在页目录项清掉之前仍会看到这个页表,
+// 不能让它们再碰到已经还回去的页框和交换槽
+static void release_pte_range(uint32_t start, uint32_t end, uint32_t *batch, uint32_t *batch_cnt)
+{
+    uint32_t *v_pte_ptr = pte_ptr(start);
+    uint32_t vaddr      = start;
+
+    while (vaddr < end)
+    {
+        uint32_t pte = *v_pte_ptr;
+
+        if (pte & PG_P_1)
+        {
+            batch[(*batch_cnt)++] = pte & 0xfffff000;
+
+            if (*batch_cnt == FREE_BATCH)
+            {
+                pfree_batch(batch, FREE_BATCH);
+                *batch_cnt = 0;
+            }
+        }
+        else if (PTE_IS_SWAP(pte))
+        {
+            swap_free_entry(pte);
+        }
+
+        *v_pte_ptr = 0;
+        v_pte_ptr++;
+        vaddr += PG_SIZE;
+    }
+
+    return ;
+}
 
 static void release_prog_resource(struct task_struct *release_thread)
 {
     /**
      * @brief static void release_prog_resource(struct task_struct* release_thread)
      * 释放用户进程资源: 
-     * 1 页表中对应的物理页
-     * 2 虚拟内存池占物理页框
+     * 0 共享文件映射中写过的页写回文件
+     * 1 页表中对应的物理页和交换槽
+     * 2 地址空间的区域树
      * 3 关闭打开的文件 
+     *
+     * 用户页只会映射在区域树的区域中,munmap、brk缩小和exec去掉区域时都先清掉了其中的页表项,
+     * 所以只按区域遍历页表项,没有页表的4M整段跳过,不用把768个页表的所有页表项都看一遍。
+     * 页框攒成一批用pfree_batch释放,最后再释放页表本身
      */
 
     uint32_t *pgdir_vaddr = release_thread->pgdir;
     uint16_t user_pde_nr  = 768;
     uint16_t pde_idx      = 0;
-    uint32_t pde          = 0;
-    uint32_t *v_pde_ptr   = NULL;             // v表示var,和函数pde_ptr区分
+    uint32_t batch[FREE_BATCH];
+    uint32_t batch_cnt    = 0;
 
-    uint16_t user_pte_nr  = 1024;
-    uint16_t pte_idx      = 0;
-    uint32_t pte          = 0;
-    uint32_t *v_pte_ptr  = NULL;              // 加个v表示var,和函数pte_ptr区分
-    uint32_t *first_pte_vaddr_in_pde = NULL;  // 用来记录pde中第0个pte的地址
+#ifdef EXIT_BENCH
+    uint64_t bench_start  = rdtsc();
+#endif
 
-    uint32_t pg_phy_addr  = 0;
+    // 只有进程自己会调用,页表还是当前的页表
+    ASSERT(release_thread == running_thread());
+    msync_all();
 
-    // 回收页表中用户空间的页框
-    while (pde_idx < user_pde_nr)
+    // 1 按区域回收页表中用户空间的页框
+    struct vm_area *vma = vma_find_next(&release_thread->vmas, 0);
+
+    while (vma != NULL)
     {
-        v_pde_ptr = pgdir_vaddr + pde_idx;
-        pde = *v_pde_ptr;
+        uint32_t vaddr = vma->start;
 
-        if (pde & 0x00000001) // 如果页目录项p位为1,表示该页目录项下可能有页表项
+        while (vaddr < vma->end)
         {
-            // 一个页表表示的内存容量是4M,即0x400000
-            first_pte_vaddr_in_pde = pte_ptr(pde_idx * 0x400000);
-            pte_idx = 0;
+            // 本段不超过vaddr所在的4M
+            uint32_t seg_end = (vaddr & 0xffc00000) + 0x400000;
+            seg_end          = seg_end == 0 || seg_end > vma->end ? vma->end : seg_end;
 
-            while (pte_idx < user_pte_nr)
+            if (*pde_ptr(vaddr) & PG_P_1)
             {
-                v_pte_ptr = first_pte_vaddr_in_pde + pte_idx;
-                pte = *v_pte_ptr;
-
-                if (pte & 0x00000001)
-                {
-                    // 将pte中记录的物理页框直接在相应内存池的位图中清0
-                    pg_phy_addr = pte & 0xfffff000;
-                    free_a_phy_page(pg_phy_addr);
-                }
+                // 关中断,防止释放途中页被换出
+                enum intr_status old_status = intr_disable();
+                release_pte_range(vaddr, seg_end, batch, &batch_cnt);
 
-                pte_idx++;
+                pfree_batch(batch, batch_cnt);
+                batch_cnt = 0;
+                intr_set_status(old_status);
             }
 
-            // 将pde中记录的物理页框直接在相应内存池的位图中清0
-            pg_phy_addr = pde & 0xfffff000;
-            free_a_phy_page(pg_phy_addr);
+            vaddr = seg_end;
+        }
+
+        vma = vma_find_next(&release_thread->vmas, vma->end);
+    }
 
+    // 2 释放页表,页目录项也清掉,换页时不会再扫描这个页表
+    while (pde_idx < user_pde_nr)
+    {
+        if (pgdir_vaddr[pde_idx] & PG_P_1)
+        {
+            free_a_phy_page(pgdir_vaddr[pde_idx] & 0xfffff000);
+            pgdir_vaddr[pde_idx] = 0;
         }
 
         pde_idx++;
     }
 
-    // 回收用户虚拟地址池所占的物理内存
-    uint32_t bitmap_pg_cnt = (release_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len) / PG_SIZE;
-    uint8_t *user_vaddr_pool_bitmap = release_thread->userprog_vaddr.vaddr_bitmap.bits;
+    release_thread->mem.rss      = 0;
+    release_thread->mem.pt_pages = 0;
 
-    mfree_page(PF_KERNEL, user_vaddr_pool_bitmap, bitmap_pg_cnt);
+#ifdef EXIT_BENCH
+    printk("exit %s: release address space %d cycles\n", release_thread->name, (uint32_t)(rdtsc() - bench_start));
+#endif
+
+    // 回收地址空间的区域树,文件映射的区域同时关闭文件
+    vma_tree_destroy(&release_thread->vmas);
 
     // 关闭进程打开的文件
     uint8_t local_fd = 3;
@@ -86,12 +146,7 @@ static void release_prog_resource(struct task_struct *release_thread)
             if (is_pipe(local_fd))
             {
                 uint32_t global_fd = fd_local2global(local_fd);
-
-                if (--file_table[global_fd].fd_pos == 0)
-                {
-                    mfree_page(PF_KERNEL, file_table[global_fd].fd_inode, 1);
-                    file_table[global_fd].fd_inode = NULL;
-                }
+                pipe_release(global_fd);
             }
             else
             {
@@ -161,7 +216,14 @@ pid_t sys_wait(int32_t *status)
         if (child_elem != NULL)
         {
             struct task_struct *child_thread = elem2entry(struct task_struct, all_list_tag, child_elem);
-            *status = child_thread->exit_status;
+
+            int32_t exit_status = child_thread->exit_status;
+
+            // status的地址非法时不回收子进程,直接返回失败
+            if (copy_to_user(status, &exit_status, sizeof(int32_t)) != 0)
+            {
+                return -1;
+            }
 
             // 1.thread_exit之后,pcb会被回收,因此提前获取pid
             uint16_t child_pid = child_thread->pid;